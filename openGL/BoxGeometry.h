@@ -0,0 +1,61 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <cstdint>
+
+// Box vertex as it sits in the vertex buffers
+struct BoxVertex {
+    float position[3];
+    uint8_t color[4];
+};
+
+const int boxVertexCount = 24; // 6 faces * 4 corners, same layout as Mesh::draw
+const int boxIndexCount = 36;  // 6 faces * 2 triangles
+
+// Two triangles per face, the faces are quads of 4 vertices
+inline void writeBoxIndices(GLuint* out) {
+    for (int face = 0; face < 6; face++) {
+        GLuint first = face * 4;
+        out[face * 6 + 0] = first;
+        out[face * 6 + 1] = first + 1;
+        out[face * 6 + 2] = first + 2;
+        out[face * 6 + 3] = first;
+        out[face * 6 + 4] = first + 2;
+        out[face * 6 + 5] = first + 3;
+    }
+}
+
+// Writes the 24 face corners of a box, color is 0-255 RGB
+inline void writeBoxVertices(const float* boxMin, const float* boxMax, const float* color, BoxVertex* out) {
+    float x = boxMin[0];
+    float y = boxMin[1];
+    float z = boxMin[2];
+    float x2 = boxMax[0];
+    float y2 = boxMax[1];
+    float z2 = boxMax[2];
+
+    const float corners[boxVertexCount][3] = {
+        // Front face
+        { x, y, z }, { x2, y, z }, { x2, y2, z }, { x, y2, z },
+        // Back face
+        { x, y, z2 }, { x2, y, z2 }, { x2, y2, z2 }, { x, y2, z2 },
+        // Top face
+        { x, y2, z }, { x2, y2, z }, { x2, y2, z2 }, { x, y2, z2 },
+        // Bottom face
+        { x, y, z }, { x2, y, z }, { x2, y, z2 }, { x, y, z2 },
+        // Right face
+        { x2, y, z }, { x2, y2, z }, { x2, y2, z2 }, { x2, y, z2 },
+        // Left face
+        { x, y, z }, { x, y2, z }, { x, y2, z2 }, { x, y, z2 },
+    };
+
+    for (int i = 0; i < boxVertexCount; i++) {
+        out[i].position[0] = corners[i][0];
+        out[i].position[1] = corners[i][1];
+        out[i].position[2] = corners[i][2];
+        out[i].color[0] = static_cast<uint8_t>(color[0]);
+        out[i].color[1] = static_cast<uint8_t>(color[1]);
+        out[i].color[2] = static_cast<uint8_t>(color[2]);
+        out[i].color[3] = 255;
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "FrustumCulling.h"
+#include "MathLib.h"
+#include <cstdint>
+
+// First person camera
+//
+// Position and pitch/yaw are the only real state. The orientation
+// quaternion, basis vectors, matrices and frustum planes are cached and only
+// rebuilt when something they depend on changed, so reading them any number
+// of times per frame costs nothing extra
+class Camera {
+public:
+    Camera() : position(makePoint(0.0f, 0.0f, 0.0f)) {}
+
+    void setPosition(float x, float y, float z) {
+        if (x == position.x && y == position.y && z == position.z) {
+            return;
+        }
+        position = makePoint(x, y, z);
+        viewDirty = true;
+        version++;
+    }
+
+    void setPosition(const Vec4& newPosition) {
+        setPosition(newPosition.x, newPosition.y, newPosition.z);
+    }
+
+    // Moves by the xyz of offset
+    void translate(const Vec4& offset) {
+        position = makePoint(position.x + offset.x, position.y + offset.y, position.z + offset.z);
+        viewDirty = true;
+        version++;
+    }
+
+    // Angles in degrees, pitch looks up and yaw turns right from the +x axis
+    void setRotation(float newPitch, float newYaw) {
+        if (newPitch == pitch && newYaw == yaw) {
+            return;
+        }
+        pitch = newPitch;
+        yaw = newYaw;
+        basisDirty = true;
+        viewDirty = true;
+        version++;
+    }
+
+    void rotate(float pitchDelta, float yawDelta) {
+        setRotation(pitch + pitchDelta, yaw + yawDelta);
+    }
+
+    void setPerspective(float newFieldOfView, float newAspect, float newNear, float newFar) {
+        if (newFieldOfView == fieldOfView && newAspect == aspect && newNear == zNear && newFar == zFar) {
+            return;
+        }
+        fieldOfView = newFieldOfView;
+        aspect = newAspect;
+        zNear = newNear;
+        zFar = newFar;
+        projectionDirty = true;
+        version++;
+    }
+
+    const Vec4& getPosition() const { return position; }
+    float getPitch() const { return pitch; }
+    float getYaw() const { return yaw; }
+    float getFieldOfView() const { return fieldOfView; }
+    float getAspect() const { return aspect; }
+    float getNear() const { return zNear; }
+    float getFar() const { return zFar; }
+
+    // Goes up whenever the position, rotation or projection really changes, for telling if the view needs drawing again
+    uint64_t getVersion() const { return version; }
+
+    const Quat& getOrientation() const { updateBasis(); return orientation; }
+    const Vec4& getForward() const { updateBasis(); return forward; }
+    const Vec4& getRight() const { updateBasis(); return right; }
+    const Vec4& getUp() const { updateBasis(); return up; }
+
+    const Mat4& getView() const { updateView(); return view; }
+    const Mat4& getProjection() const { updateProjection(); return projection; }
+    const Mat4& getViewProjection() const { updateViewProjection(); return viewProjection; }
+    const Frustum& getFrustum() const { updateViewProjection(); return frustum; }
+
+    // Takes clip space back to the world, for unprojecting the mouse
+    const Mat4& getInverseViewProjection() const {
+        updateViewProjection();
+        if (inverseDirty) {
+            inverseViewProjection = inverse(viewProjection);
+            inverseDirty = false;
+        }
+        return inverseViewProjection;
+    }
+
+    // Screen pixels covered by one unit at distance 1, for a viewport this many pixels tall
+    float getPixelsPerUnit(float viewportHeight) const {
+        return viewportHeight * 0.5f * getProjection().columns[1].y;
+    }
+
+private:
+    Vec4 position;
+    float pitch = 0.0f;
+    float yaw = 0.0f;
+
+    float fieldOfView = 45.0f;
+    float aspect = 1.0f;
+    float zNear = 0.1f;
+    float zFar = 1000.0f;
+    uint64_t version = 0;
+
+    mutable Quat orientation;
+    mutable Vec4 forward;
+    mutable Vec4 right;
+    mutable Vec4 up;
+    mutable Mat4 view;
+    mutable Mat4 projection;
+    mutable Mat4 viewProjection;
+    mutable Mat4 inverseViewProjection;
+    mutable Frustum frustum;
+
+    mutable bool basisDirty = true;
+    mutable bool viewDirty = true;
+    mutable bool projectionDirty = true;
+    mutable bool viewProjectionDirty = true;
+    mutable bool inverseDirty = true;
+
+    void updateBasis() const {
+        if (!basisDirty) {
+            return;
+        }
+
+        // Pitch around z tilts +x up, then yaw around y turns it towards +z
+        Quat yawRotation = Quat::fromAxisAngle(Vec4(0.0f, 1.0f, 0.0f), -toRadians(yaw));
+        Quat pitchRotation = Quat::fromAxisAngle(Vec4(0.0f, 0.0f, 1.0f), toRadians(pitch));
+        orientation = normalize(yawRotation * pitchRotation);
+
+        forward = ::rotate(orientation, Vec4(1.0f, 0.0f, 0.0f));
+        right = ::rotate(orientation, Vec4(0.0f, 0.0f, 1.0f));
+        up = ::rotate(orientation, Vec4(0.0f, 1.0f, 0.0f));
+
+        basisDirty = false;
+    }
+
+    void updateView() const {
+        updateBasis();
+        if (!viewDirty) {
+            return;
+        }
+
+        // Rows are the basis, so the rotation part is the transposed orientation
+        Mat4 rotation;
+        rotation.columns[0] = right;
+        rotation.columns[1] = up;
+        rotation.columns[2] = -forward;
+        rotation.columns[3] = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        view = transpose(rotation);
+        view.columns[3] = Vec4(-dot3(right, position), -dot3(up, position), dot3(forward, position), 1.0f);
+
+        viewDirty = false;
+        viewProjectionDirty = true;
+    }
+
+    void updateProjection() const {
+        if (!projectionDirty) {
+            return;
+        }
+        projection = perspective(fieldOfView, aspect, zNear, zFar);
+        projectionDirty = false;
+        viewProjectionDirty = true;
+    }
+
+    void updateViewProjection() const {
+        updateView();
+        updateProjection();
+        if (!viewProjectionDirty) {
+            return;
+        }
+        viewProjection = projection * view;
+        frustum.fromMatrix(viewProjection.data());
+        viewProjectionDirty = false;
+        inverseDirty = true;
+    }
+};
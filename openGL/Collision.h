@@ -0,0 +1,99 @@
+#pragma once
+
+#include "MathLib.h"
+#include "Mesh.h"
+#include "SpatialGrid.h"
+#include <algorithm>
+#include <vector>
+
+// When a point moving by delta first enters the box, as a fraction of delta,
+// and the axis of the face it comes in through. A point that starts inside
+// isn't stopped, so something stuck in a box can still move out of it
+inline bool sweepPoint(const Vec4& origin, const Vec4& delta, const float* boxMin, const float* boxMax, float& time, int& axis) {
+    float enter = -INFINITY;
+    float exit = INFINITY;
+    axis = -1;
+
+    for (int i = 0; i < 3; i++) {
+        if (delta[i] == 0.0f) {
+            if (origin[i] <= boxMin[i] || origin[i] >= boxMax[i]) {
+                return false;
+            }
+            continue;
+        }
+
+        float t0 = (boxMin[i] - origin[i]) / delta[i];
+        float t1 = (boxMax[i] - origin[i]) / delta[i];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        if (t0 > enter) {
+            enter = t0;
+            axis = i;
+        }
+        exit = std::min(exit, t1);
+    }
+
+    if (axis < 0 || enter > exit || enter < 0.0f || enter > 1.0f) {
+        return false;
+    }
+    time = enter;
+    return true;
+}
+
+// Moves a box by delta through the boxes in the grid and returns its new center
+//
+// Each pass sweeps the box against the meshes the grid has around the move.
+// Sweeping a box against a box is the same as sweeping its center against
+// the other box grown by its half size. At the first hit the box stops a
+// little short and the rest of the move loses its part along that face, so
+// it slides along walls and floors instead of sticking to them
+inline Vec4 sweepBox(const SpatialGrid& grid, const Vec4& center, const Vec4& halfSize, const Vec4& delta, std::vector<Mesh*>& candidates) {
+    // Gap kept to surfaces so the next move doesn't start touching them
+    const float skin = 0.001f;
+
+    Vec4 position = center;
+    Vec4 remaining = Vec4(delta.x, delta.y, delta.z, 0.0f);
+
+    // Three passes are enough to slide into a corner
+    for (int pass = 0; pass < 3 && dot3(remaining, remaining) > 0.0f; pass++) {
+        Vec4 end = position + remaining;
+        float sweptMin[3];
+        float sweptMax[3];
+        for (int axis = 0; axis < 3; axis++) {
+            sweptMin[axis] = std::min(position[axis], end[axis]) - halfSize[axis] - skin;
+            sweptMax[axis] = std::max(position[axis], end[axis]) + halfSize[axis] + skin;
+        }
+        grid.queryBox(sweptMin, sweptMax, candidates);
+
+        float firstTime = 1.0f;
+        int firstAxis = -1;
+        for (const Mesh* mesh : candidates) {
+            float grownMin[3];
+            float grownMax[3];
+            for (int axis = 0; axis < 3; axis++) {
+                grownMin[axis] = mesh->location[axis] - halfSize[axis];
+                grownMax[axis] = mesh->location[axis] + mesh->size[axis] + halfSize[axis];
+            }
+
+            float time;
+            int axis;
+            if (sweepPoint(position, remaining, grownMin, grownMax, time, axis) && time < firstTime) {
+                firstTime = time;
+                firstAxis = axis;
+            }
+        }
+
+        if (firstAxis < 0) {
+            return position + remaining;
+        }
+
+        position = position + remaining * firstTime;
+        position[firstAxis] -= remaining[firstAxis] > 0.0f ? skin : -skin;
+
+        remaining = remaining * (1.0f - firstTime);
+        remaining[firstAxis] = 0.0f;
+    }
+
+    return position;
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "Mesh.h"
+#include "Physics.h"
+#include "RayBenchmark.h"
+#include "SpatialGrid.h"
+#include "SweepAndPrune.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// Broadphase pair finding over moving boxes, run with --bench-sap, and the
+// rigid body step over falling towers, run with --bench-physics
+
+namespace collisionbench {
+
+    // Every pair of overlapping boxes found through the grid, as sorted pair keys
+    inline std::vector<uint64_t> gridPairs(std::list<Mesh>& meshes, const std::unordered_map<const Mesh*, SweepAndPrune::ProxyId>& proxyOf) {
+        SpatialGrid grid(16.0f, meshes.size() * 2);
+        grid.build(meshes);
+
+        std::vector<uint64_t> keys;
+        std::vector<Mesh*> candidates;
+        for (Mesh& mesh : meshes) {
+            float boxMin[3] = { mesh.location[0], mesh.location[1], mesh.location[2] };
+            float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+            grid.queryBox(boxMin, boxMax, candidates);
+
+            SweepAndPrune::ProxyId self = proxyOf.at(&mesh);
+            for (const Mesh* other : candidates) {
+                SweepAndPrune::ProxyId otherProxy = proxyOf.at(other);
+                if (self < otherProxy) {
+                    keys.push_back((static_cast<uint64_t>(self) << 32) | otherProxy);
+                }
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+    // One row of the table, boxes drifting at up to maxSpeed units a frame
+    inline void runDrift(size_t boxCount, float maxSpeed, int frameCount) {
+        std::list<Mesh> meshes = raybench::makeScene(boxCount, 1);
+
+        std::mt19937 random(4);
+        std::uniform_real_distribution<float> speed(-maxSpeed, maxSpeed);
+        std::vector<Mesh*> bodies;
+        std::vector<Vec4> velocities;
+        for (Mesh& mesh : meshes) {
+            bodies.push_back(&mesh);
+            velocities.push_back(Vec4(speed(random), speed(random) * 0.2f, speed(random), 0.0f));
+        }
+
+        SweepAndPrune broadphase;
+        std::vector<SweepAndPrune::ProxyId> proxies;
+        std::unordered_map<const Mesh*, SweepAndPrune::ProxyId> proxyOf;
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        for (Mesh* mesh : bodies) {
+            float boxMin[3] = { mesh->location[0], mesh->location[1], mesh->location[2] };
+            float boxMax[3] = { mesh->location[0] + mesh->size[0], mesh->location[1] + mesh->size[1], mesh->location[2] + mesh->size[2] };
+            proxies.push_back(broadphase.addProxy(boxMin, boxMax));
+        }
+        broadphase.updatePairs();
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+        double buildMilliseconds = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+        for (size_t i = 0; i < bodies.size(); i++) {
+            proxyOf[bodies[i]] = proxies[i];
+        }
+
+        // Boxes bounce off the edges of the area so the density stays the same
+        double frameSeconds = 0.0;
+        size_t swaps = 0;
+        size_t pairCount = 0;
+        for (int frame = 0; frame < frameCount; frame++) {
+            auto frameStart = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < bodies.size(); i++) {
+                Mesh& mesh = *bodies[i];
+                Vec4& velocity = velocities[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    float limit = axis == 1 ? 100.0f : 500.0f;
+                    float low = axis == 1 ? 0.0f : -500.0f;
+                    mesh.location[axis] += velocity[axis];
+                    if (mesh.location[axis] < low || mesh.location[axis] > limit) {
+                        velocity[axis] = -velocity[axis];
+                    }
+                }
+
+                float boxMin[3] = { mesh.location[0], mesh.location[1], mesh.location[2] };
+                float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+                broadphase.moveProxy(proxies[i], boxMin, boxMax);
+            }
+            broadphase.updatePairs();
+            pairCount = broadphase.getPairs().size();
+            auto frameEnd = std::chrono::high_resolution_clock::now();
+            frameSeconds += std::chrono::duration<double>(frameEnd - frameStart).count();
+            swaps += broadphase.getSwapCount();
+        }
+
+        // The same boxes from scratch, what every frame would cost without the coherence
+        SweepAndPrune fresh;
+        auto rebuildStart = std::chrono::high_resolution_clock::now();
+        for (Mesh* mesh : bodies) {
+            float boxMin[3] = { mesh->location[0], mesh->location[1], mesh->location[2] };
+            float boxMax[3] = { mesh->location[0] + mesh->size[0], mesh->location[1] + mesh->size[1], mesh->location[2] + mesh->size[2] };
+            fresh.addProxy(boxMin, boxMax);
+        }
+        fresh.updatePairs();
+        auto rebuildEnd = std::chrono::high_resolution_clock::now();
+        double rebuildMilliseconds = std::chrono::duration<double, std::milli>(rebuildEnd - rebuildStart).count();
+
+        // The pairs after all the moves against a check through the grid
+        std::vector<uint64_t> sweepKeys;
+        for (const SweepAndPrune::Pair& pair : broadphase.getPairs()) {
+            sweepKeys.push_back((static_cast<uint64_t>(pair.first) << 32) | pair.second);
+        }
+        std::sort(sweepKeys.begin(), sweepKeys.end());
+        std::vector<uint64_t> checkKeys = gridPairs(meshes, proxyOf);
+        std::vector<uint64_t> difference;
+        std::set_symmetric_difference(sweepKeys.begin(), sweepKeys.end(), checkKeys.begin(), checkKeys.end(), std::back_inserter(difference));
+
+        std::printf("%-8zu %8.2f %12.2f %12.3f %12zu %12zu %12.2f %10zu\n", boxCount, maxSpeed, buildMilliseconds, frameSeconds * 1000.0 / frameCount,
+            swaps / frameCount, pairCount, rebuildMilliseconds, difference.size());
+    }
+
+    // Towers of boxes a little apart over a static floor, each tower drops, stacks up and goes to sleep
+    inline std::list<Mesh> makeTowers(size_t bodyCount, size_t towerHeight, unsigned seed) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> offset(-0.3f, 0.3f);
+
+        size_t towerCount = (bodyCount + towerHeight - 1) / towerHeight;
+        size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(towerCount))));
+        const float spacing = 4.0f;
+        float extent = side * spacing;
+
+        std::list<Mesh> meshes;
+        meshes.push_back({ { -spacing, -1.0f, -spacing }, { extent + 2.0f * spacing, 1.0f, extent + 2.0f * spacing }, { 0, 255, 0 } });
+        for (size_t i = 0; i < bodyCount; i++) {
+            size_t tower = i / towerHeight;
+            size_t level = i % towerHeight;
+            float x = (tower % side) * spacing + offset(random);
+            float z = (tower / side) * spacing + offset(random);
+            meshes.push_back({ { x, 0.5f + level * 2.5f, z }, { 2.0f, 2.0f, 2.0f }, { 255, 255, 255 }, true });
+        }
+        return meshes;
+    }
+
+    // Steps one scene on the pool, one line of the table per phase of the run
+    inline void runTowers(size_t bodyCount, ThreadPool& pool) {
+        const float stepTime = 1.0f / 60.0f;
+        std::list<Mesh> meshes = makeTowers(bodyCount, 10, 5);
+
+        PhysicsWorld world;
+        world.build(meshes);
+
+        // Falling and settling, then everything is asleep
+        const int phaseSteps[] = { 60, 60, 60 };
+        const char* phaseNames[] = { "falling", "settling", "resting" };
+        for (int phase = 0; phase < 3; phase++) {
+            double seconds = 0.0;
+            size_t awake = 0;
+            size_t islands = 0;
+            size_t contacts = 0;
+            for (int step = 0; step < phaseSteps[phase]; step++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                world.step(stepTime, pool);
+                auto end = std::chrono::high_resolution_clock::now();
+                seconds += std::chrono::duration<double>(end - start).count();
+                awake += world.getAwakeCount();
+                islands += world.getIslandCount();
+                contacts += world.getContactCount();
+            }
+
+            // How far boxes sank into each other or the floor, dropped through means it's badly wrong
+            float deepest = 0.0f;
+            size_t fallen = 0;
+            for (const Mesh& mesh : meshes) {
+                if (mesh.dynamic) {
+                    deepest = std::max(deepest, -mesh.location[1]);
+                    fallen += mesh.location[1] < -1.0f;
+                }
+            }
+
+            int steps = phaseSteps[phase];
+            std::printf("%-8zu %8u %-9s %10.3f %10zu %10zu %10zu %10.3f %8zu\n", bodyCount, pool.getThreadCount(), phaseNames[phase],
+                seconds * 1000.0 / steps, awake / steps, islands / steps, contacts / steps, deepest, fallen);
+        }
+    }
+
+}
+
+inline void runSweepAndPruneBenchmark() {
+    const int frameCount = 50;
+
+    // The work per frame follows how far boxes move past each other, so it's run slow and fast
+    std::printf("Sweep and prune benchmark, %d frames of drifting boxes\n", frameCount);
+    std::printf("%-8s %8s %12s %12s %12s %12s %12s %10s\n", "boxes", "speed", "build ms", "frame ms", "swaps", "pairs", "rebuild ms", "mismatch");
+
+    const size_t boxCounts[] = { 10000, 25000, 50000, 100000 };
+    for (size_t boxCount : boxCounts) {
+        collisionbench::runDrift(boxCount, 0.05f, frameCount);
+        collisionbench::runDrift(boxCount, 0.5f, frameCount);
+    }
+}
+
+inline void runPhysicsBenchmark() {
+    std::printf("Physics benchmark, towers of 10 boxes, 60 steps a second, each phase is one second\n");
+    std::printf("%-8s %8s %-9s %10s %10s %10s %10s %10s %8s\n", "bodies", "threads", "phase", "step ms", "awake", "islands", "contacts", "sunk", "fallen");
+
+    ThreadPool single(1);
+    ThreadPool all;
+    const size_t bodyCounts[] = { 5000, 50000 };
+    for (size_t bodyCount : bodyCounts) {
+        collisionbench::runTowers(bodyCount, single);
+        collisionbench::runTowers(bodyCount, all);
+    }
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "FrameStats.h"
+#include "Log.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#if defined(_WIN32)
+// From winmm, declared here so windows.h and its min and max macros stay out
+extern "C" __declspec(dllimport) unsigned int __stdcall timeBeginPeriod(unsigned int period);
+extern "C" __declspec(dllimport) unsigned int __stdcall timeEndPeriod(unsigned int period);
+#endif
+
+// How buffer swaps wait for the display
+enum class VsyncMode {
+    Off,
+    On,
+    Adaptive, // waits for the display, but a late frame tears instead of waiting a whole refresh more
+};
+
+// Sets the swap interval for the current context, adaptive falls back to on without the tear control extension
+inline VsyncMode applyVsync(VsyncMode mode) {
+    if (mode == VsyncMode::Adaptive && !glfwExtensionSupported("WGL_EXT_swap_control_tear") && !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+        LOG_WARNING("Adaptive vsync not supported, using vsync");
+        mode = VsyncMode::On;
+    }
+    glfwSwapInterval(mode == VsyncMode::Off ? 0 : mode == VsyncMode::On ? 1 : -1);
+    return mode;
+}
+
+inline const char* getVsyncName(VsyncMode mode) {
+    switch (mode) {
+    case VsyncMode::Off:
+        return "off";
+    case VsyncMode::On:
+        return "on";
+    case VsyncMode::Adaptive:
+        return "adaptive";
+    }
+    return "";
+}
+
+// False if the name isn't off, on or adaptive
+inline bool parseVsyncMode(const char* name, VsyncMode& mode) {
+    const VsyncMode modes[] = { VsyncMode::Off, VsyncMode::On, VsyncMode::Adaptive };
+    for (VsyncMode candidate : modes) {
+        if (std::strcmp(name, getVsyncName(candidate)) == 0) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Holds frames to a target rate and measures how evenly they're delivered
+//
+// Each frame has a deadline one period after the last one's, so a frame
+// that ran long is made up for by the next one waiting less and the average
+// rate stays on target. Waiting sleeps until just short of the deadline and
+// spins the rest, since a sleep can wake a millisecond or more late. How
+// late sleeps have been waking is tracked, so the spin is only as long as
+// this machine needs. Windows sleeps in steps of the system timer, 15.6 ms
+// by default, so while a rate is set the timer is raised to 1 ms. Jitter
+// is how much each present to present interval differs from the one before
+// it, uneven delivery reads as stutter even when the average frame time is
+// fine
+class FramePacer {
+public:
+    explicit FramePacer(double reportSeconds) : reportInterval(reportSeconds) {}
+
+    ~FramePacer() {
+        setFineTimer(false);
+    }
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // 0 doesn't limit the rate
+    void setTargetRate(double framesPerSecond) {
+        period = framesPerSecond > 0.0 ? 1.0 / framesPerSecond : 0.0;
+        deadline = Clock::now();
+        setFineTimer(period > 0.0);
+    }
+
+    double getTargetRate() const {
+        return period > 0.0 ? 1.0 / period : 0.0;
+    }
+
+    // Call just before the swap, returns once the frame's deadline has come
+    void waitForDeadline() {
+        if (period <= 0.0) {
+            return;
+        }
+        deadline += toDuration(period);
+        Clock::time_point now = Clock::now();
+
+        // More than a period behind, start over from now instead of rushing frames out to catch up
+        if (now > deadline + toDuration(period)) {
+            deadline = now;
+            return;
+        }
+
+        Clock::duration remaining = deadline - now;
+        if (remaining > toDuration(spinMargin)) {
+            Clock::duration sleep = remaining - toDuration(spinMargin);
+            std::this_thread::sleep_for(sleep);
+            double overshoot = std::chrono::duration<double>(Clock::now() - now - sleep).count();
+            spinMargin = std::min(std::max(std::max(overshoot * 1.25, spinMargin * marginDecay), minSpinMargin), maxSpinMargin);
+        }
+        while (Clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Call right after the swap
+    void framePresented() {
+        Clock::time_point now = Clock::now();
+        if (hasLastPresent) {
+            double interval = std::chrono::duration<double>(now - lastPresent).count();
+            if (hasLastInterval) {
+                double change = std::fabs(interval - lastInterval);
+                recentJitter.record(change);
+                overallJitter.record(change);
+            }
+            recentIntervals.record(interval);
+            overallIntervals.record(interval);
+            lastInterval = interval;
+            hasLastInterval = true;
+
+            sinceReport += interval;
+            if (sinceReport >= reportInterval) {
+                report("Frame pacing", recentIntervals, recentJitter);
+                recentIntervals.reset();
+                recentJitter.reset();
+                sinceReport = 0.0;
+            }
+        }
+        lastPresent = now;
+        hasLastPresent = true;
+    }
+
+    // The next present follows a deliberate wait, like idling or a path trace, and isn't timed against this one
+    void skipInterval() {
+        hasLastPresent = false;
+        hasLastInterval = false;
+        deadline = Clock::now();
+    }
+
+    void printSummary() const {
+        report("Frame pacing overall", overallIntervals, overallJitter);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const double minSpinMargin = 0.0002;
+    const double maxSpinMargin = 0.004;
+    const double marginDecay = 0.995; // lets the margin come back down after a one off late wake
+
+    double period = 0.0;
+    double spinMargin = 0.002;
+    bool fineTimer = false;
+    Clock::time_point deadline = Clock::now();
+
+    double reportInterval;
+    double sinceReport = 0.0;
+    Clock::time_point lastPresent;
+    bool hasLastPresent = false;
+    double lastInterval = 0.0;
+    bool hasLastInterval = false;
+    FrameTimeHistogram recentIntervals;
+    FrameTimeHistogram recentJitter;
+    FrameTimeHistogram overallIntervals;
+    FrameTimeHistogram overallJitter;
+
+    // The timer resolution is system wide, so it's only raised while sleeps need it
+    void setFineTimer(bool fine) {
+        if (fine == fineTimer) {
+            return;
+        }
+#if defined(_WIN32)
+        if (fine) {
+            timeBeginPeriod(1);
+        }
+        else {
+            timeEndPeriod(1);
+        }
+#endif
+        fineTimer = fine;
+    }
+
+    static Clock::duration toDuration(double seconds) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    void report(const char* label, const FrameTimeHistogram& intervals, const FrameTimeHistogram& jitter) const {
+        if (jitter.getCount() == 0) {
+            return;
+        }
+        LOG_INFO(label << " (ms): interval p50 " << roundMilliseconds(intervals.getPercentile(0.5)) << ", p99 " << roundMilliseconds(intervals.getPercentile(0.99))
+            << ", jitter p50 " << roundMilliseconds(jitter.getPercentile(0.5)) << ", p99 " << roundMilliseconds(jitter.getPercentile(0.99))
+            << ", max " << roundMilliseconds(jitter.getMax()));
+    }
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "Log.h"
+
+// Seconds as milliseconds to two decimals, for printing
+inline double roundMilliseconds(double seconds) {
+    return std::round(seconds * 1e5) / 100.0;
+}
+
+// Frame times in log buckets like an HDR histogram
+//
+// Up to 256 µs every microsecond has its own bucket, above that each power
+// of two is split into 128 buckets, so a percentile is never off by more
+// than 1% however long the frames get. The counts are a fixed array, so
+// recording a frame never allocates and costs a few instructions
+class FrameTimeHistogram {
+public:
+    FrameTimeHistogram() {
+        reset();
+    }
+
+    void record(double seconds) {
+        uint64_t microseconds = static_cast<uint64_t>(std::max(seconds, 0.0) * 1e6 + 0.5);
+        counts[bucketOf(microseconds)]++;
+        count++;
+        total += seconds;
+        maxSeconds = std::max(maxSeconds, seconds);
+    }
+
+    void reset() {
+        std::memset(counts, 0, sizeof(counts));
+        count = 0;
+        total = 0.0;
+        maxSeconds = 0.0;
+    }
+
+    // Smallest time at least that fraction of the frames took no longer than, 0.99 for p99
+    double getPercentile(double fraction) const {
+        if (count == 0) {
+            return 0.0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * count)));
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < bucketCount; bucket++) {
+            seen += counts[bucket];
+            if (seen >= rank) {
+                // Top of the bucket, but never past the slowest frame really seen
+                return std::min(upperBoundOf(bucket) * 1e-6, maxSeconds);
+            }
+        }
+        return maxSeconds;
+    }
+
+    double getMax() const {
+        return maxSeconds;
+    }
+
+    double getAverage() const {
+        return count ? total / count : 0.0;
+    }
+
+    uint64_t getCount() const {
+        return count;
+    }
+
+private:
+    static const int linearBuckets = 256;
+    static const int subBucketBits = 7;
+    static const int subBuckets = 1 << subBucketBits;
+    static const int bucketCount = linearBuckets + 40 * subBuckets; // past an hour, the last bucket takes the rest
+
+    uint64_t counts[bucketCount];
+    uint64_t count;
+    double total;
+    double maxSeconds;
+
+    static int bucketOf(uint64_t microseconds) {
+        if (microseconds < linearBuckets) {
+            return static_cast<int>(microseconds);
+        }
+        int shift = 0;
+        while ((microseconds >> shift) >= 2 * subBuckets) {
+            shift++;
+        }
+        int bucket = linearBuckets + (shift - 1) * subBuckets + static_cast<int>((microseconds >> shift) - subBuckets);
+        return std::min(bucket, bucketCount - 1);
+    }
+
+    // Largest microsecond count that lands in the bucket
+    static double upperBoundOf(int bucket) {
+        if (bucket < linearBuckets) {
+            return bucket;
+        }
+        int shift = (bucket - linearBuckets) / subBuckets + 1;
+        uint64_t mantissa = subBuckets + (bucket - linearBuckets) % subBuckets;
+        return static_cast<double>(((mantissa + 1) << shift) - 1);
+    }
+};
+
+// Wall time of named parts of the frame, for telling what made a slow frame slow
+//
+// Zones are added once at startup and timed with begin and end, or with a
+// ProfileZone for a scope. A zone can run more than once a frame and its
+// times add up. endFrame keeps a running average per zone and clears the
+// frame's times
+class FrameProfiler {
+public:
+    static const int maxZones = 16;
+
+    // Returns the id to time the zone with, name has to outlive the profiler
+    int addZone(const char* name) {
+        if (zoneCount == maxZones) {
+            return maxZones - 1;
+        }
+        zones[zoneCount].name = name;
+        return zoneCount++;
+    }
+
+    void begin(int zone) {
+        zones[zone].start = std::chrono::steady_clock::now();
+    }
+
+    void end(int zone) {
+        Zone& entry = zones[zone];
+        entry.frameSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - entry.start).count();
+    }
+
+    void endFrame() {
+        for (int zone = 0; zone < zoneCount; zone++) {
+            Zone& entry = zones[zone];
+            entry.lastSeconds = entry.frameSeconds;
+            entry.averageSeconds = entry.averaged ? entry.averageSeconds + (entry.frameSeconds - entry.averageSeconds) * averageWeight : entry.frameSeconds;
+            entry.averaged = true;
+            entry.frameSeconds = 0.0;
+        }
+    }
+
+    // Forgets the times so far this frame, for a frame that was started and then not drawn
+    void discardFrame() {
+        for (int zone = 0; zone < zoneCount; zone++) {
+            zones[zone].frameSeconds = 0.0;
+        }
+    }
+
+    int getZoneCount() const {
+        return zoneCount;
+    }
+
+    const char* getZoneName(int zone) const {
+        return zones[zone].name;
+    }
+
+    // Time in the zone during the frame endFrame last closed
+    double getLastTime(int zone) const {
+        return zones[zone].lastSeconds;
+    }
+
+    // Average over roughly the last hundred frames
+    double getAverageTime(int zone) const {
+        return zones[zone].averageSeconds;
+    }
+
+private:
+    struct Zone {
+        const char* name = "";
+        std::chrono::steady_clock::time_point start;
+        double frameSeconds = 0.0;
+        double lastSeconds = 0.0;
+        double averageSeconds = 0.0;
+        bool averaged = false;
+    };
+
+    const double averageWeight = 0.01;
+    Zone zones[maxZones];
+    int zoneCount = 0;
+};
+
+// Times the scope it's in into a profiler zone
+class ProfileZone {
+public:
+    ProfileZone(FrameProfiler& profiler, int zone) : profiler(profiler), zone(zone) {
+        profiler.begin(zone);
+    }
+
+    ~ProfileZone() {
+        profiler.end(zone);
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    FrameProfiler& profiler;
+    int zone;
+};
+
+// Frame time percentiles over the last few seconds and the whole run, and
+// the frames over budget with the zones that ran long in them
+//
+// Averages hide hitches, one 100 ms frame in a second of 10 ms ones barely
+// moves the mean, so what gets reported is the tail: p50, p95, p99 and max.
+// Only the first few stalls of each interval get a line of their own, a
+// scene too heavy for the budget would otherwise print one every frame
+class FrameStats {
+public:
+    FrameStats(double budgetSeconds, double reportSeconds) : budget(budgetSeconds), reportInterval(reportSeconds) {}
+
+    // A finished frame, after the profiler's endFrame closed the same frame
+    void addFrame(double seconds, const FrameProfiler& profiler) {
+        recent.record(seconds);
+        overall.record(seconds);
+        if (seconds > budget) {
+            stallCount++;
+            if (recentStalls++ < stallLinesPerInterval) {
+                reportStall(seconds, profiler);
+            }
+        }
+
+        sinceReport += seconds;
+        if (sinceReport >= reportInterval) {
+            report("Frame times", recent);
+            if (recentStalls > stallLinesPerInterval) {
+                LOG_INFO(recentStalls << " frames over budget, " << recentStalls - stallLinesPerInterval << " not shown");
+            }
+            recent.reset();
+            recentStalls = 0;
+            sinceReport = 0.0;
+        }
+    }
+
+    // For exit, the whole run
+    void printSummary() const {
+        report("Frame times overall", overall);
+        LOG_INFO("Frames over the " << roundMilliseconds(budget) << " ms budget: " << stallCount << " of " << overall.getCount());
+    }
+
+    const FrameTimeHistogram& getOverall() const {
+        return overall;
+    }
+
+    uint64_t getStallCount() const {
+        return stallCount;
+    }
+
+private:
+    // A zone ran long when it took this much more than usual, and at least a millisecond more
+    const double longZoneRatio = 1.5;
+    const double longZoneMinimum = 0.001;
+    // Zones this big a part of the stalled frame are shown even when they're always that slow
+    const double bigZoneShare = 0.2;
+    const uint64_t stallLinesPerInterval = 5;
+
+    double budget;
+    double reportInterval;
+    double sinceReport = 0.0;
+    FrameTimeHistogram recent;
+    FrameTimeHistogram overall;
+    uint64_t stallCount = 0;
+    uint64_t recentStalls = 0;
+
+    static void report(const char* label, const FrameTimeHistogram& histogram) {
+        if (histogram.getCount() == 0) {
+            return;
+        }
+        LOG_INFO(label << " (ms, " << histogram.getCount() << " frames): p50 " << roundMilliseconds(histogram.getPercentile(0.5))
+            << ", p95 " << roundMilliseconds(histogram.getPercentile(0.95)) << ", p99 " << roundMilliseconds(histogram.getPercentile(0.99))
+            << ", max " << roundMilliseconds(histogram.getMax()) << ", mean " << roundMilliseconds(histogram.getAverage()));
+    }
+
+    void reportStall(double seconds, const FrameProfiler& profiler) const {
+        if (!getLogger().isEnabled(LogLevel::Warning)) {
+            return;
+        }
+        LogLine line(LogLevel::Warning);
+        line << "Stall: " << roundMilliseconds(seconds) << " ms frame";
+        bool anyShown = false;
+        for (int zone = 0; zone < profiler.getZoneCount(); zone++) {
+            double last = profiler.getLastTime(zone);
+            double usual = profiler.getAverageTime(zone);
+            bool ranLong = last > usual * longZoneRatio && last - usual > longZoneMinimum;
+            if (!ranLong && last < seconds * bigZoneShare) {
+                continue;
+            }
+            line << ", " << profiler.getZoneName(zone) << " " << roundMilliseconds(last) << " ms";
+            if (ranLong) {
+                line << " (long, usually " << roundMilliseconds(usual) << ")";
+            }
+            anyShown = true;
+        }
+        if (!anyShown) {
+            line << ", no zone stands out, the time went outside the zones";
+        }
+    }
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+#include "GLExtensions.h"
+#include "Log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Plane as a*x + b*y + c*z + d, points with a positive distance are inside
+struct Plane {
+    float a, b, c, d;
+};
+
+// The six planes of the camera frustum
+struct Frustum {
+    Plane planes[6]; // left, right, bottom, top, near, far
+
+    // Pulls the planes out of a projection * view matrix (Gribb/Hartmann)
+    void fromMatrix(const float* m) {
+        // Rows of the column major matrix
+        float row0[4] = { m[0], m[4], m[8], m[12] };
+        float row1[4] = { m[1], m[5], m[9], m[13] };
+        float row2[4] = { m[2], m[6], m[10], m[14] };
+        float row3[4] = { m[3], m[7], m[11], m[15] };
+
+        for (int i = 0; i < 3; i++) {
+            const float* row = i == 0 ? row0 : (i == 1 ? row1 : row2);
+            planes[i * 2] = { row3[0] + row[0], row3[1] + row[1], row3[2] + row[2], row3[3] + row[3] };
+            planes[i * 2 + 1] = { row3[0] - row[0], row3[1] - row[1], row3[2] - row[2], row3[3] - row[3] };
+        }
+    }
+
+    // False only if the box is fully outside one of the planes
+    bool intersectsBox(const float* boxMin, const float* boxMax) const {
+        for (int i = 0; i < 6; i++) {
+            const Plane& plane = planes[i];
+
+            // Corner of the box furthest along the plane normal
+            float x = plane.a >= 0.0f ? boxMax[0] : boxMin[0];
+            float y = plane.b >= 0.0f ? boxMax[1] : boxMin[1];
+            float z = plane.c >= 0.0f ? boxMax[2] : boxMin[2];
+
+            if (plane.a * x + plane.b * y + plane.c * z + plane.d < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Frustum culling on the GPU
+//
+// One compute invocation per box tests it against the planes, visible boxes
+// get their draw command appended to a compacted output buffer through an
+// atomic counter, the counter is then used as the indirect draw count
+//
+// The same pass can drop the boxes level of detail replaced, from a byte per
+// box mask, and the boxes behind the CPU built occlusion pyramid, which is
+// uploaded each frame and tested the way OcclusionCuller::isVisible does, so
+// neither needs the CPU to walk every box
+class GpuFrustumCuller {
+public:
+    bool init() {
+        if (!glext::hasComputeShaders) {
+            return false;
+        }
+
+        program = createProgram();
+        if (!program) {
+            return false;
+        }
+
+        planesLocation = glext::GetUniformLocation(program, "planes");
+        boxCountLocation = glext::GetUniformLocation(program, "boxCount");
+        useFullDetailLocation = glext::GetUniformLocation(program, "useFullDetail");
+        useOcclusionLocation = glext::GetUniformLocation(program, "useOcclusion");
+        viewProjectionLocation = glext::GetUniformLocation(program, "viewProjection");
+        pyramidSizeLocation = glext::GetUniformLocation(program, "pyramidSize");
+        levelCountLocation = glext::GetUniformLocation(program, "levelCount");
+
+        glext::GenBuffers(1, &boundsBuffer);
+        glext::GenBuffers(1, &outputBuffer);
+        glext::GenBuffers(1, &countBuffer);
+        glext::GenBuffers(1, &fullDetailBuffer);
+        glext::GenBuffers(1, &pyramidBuffer);
+
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glext::BufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        available = true;
+        return true;
+    }
+
+    void release() {
+        if (available) {
+            glext::DeleteProgram(program);
+            glext::DeleteBuffers(1, &boundsBuffer);
+            glext::DeleteBuffers(1, &outputBuffer);
+            glext::DeleteBuffers(1, &countBuffer);
+            glext::DeleteBuffers(1, &fullDetailBuffer);
+            glext::DeleteBuffers(1, &pyramidBuffer);
+            available = false;
+        }
+    }
+
+    bool isAvailable() const {
+        return available;
+    }
+
+    GLuint getOutputBuffer() const {
+        return outputBuffer;
+    }
+
+    GLuint getCountBuffer() const {
+        return countBuffer;
+    }
+
+    // Uploads the box bounds as min, max pairs of vec4 and sizes the output buffer
+    void setBounds(const std::vector<float>& bounds, size_t boxCount) {
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+        glext::BufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(float), bounds.data(), GL_DYNAMIC_DRAW);
+
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, outputBuffer);
+        glext::BufferData(GL_SHADER_STORAGE_BUFFER, boxCount * commandSize, nullptr, GL_DYNAMIC_COPY);
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Rewrites the bounds of count boxes from first on, after they moved
+    void updateBounds(const std::vector<float>& bounds, size_t first, size_t count) {
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+        glext::BufferSubData(GL_SHADER_STORAGE_BUFFER, first * 8 * sizeof(float), count * 8 * sizeof(float), &bounds[first * 8]);
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Boxes whose byte is 0 are skipped by the next cull, null tests every box
+    void setFullDetail(const std::vector<uint8_t>* mask) {
+        useFullDetail = mask != nullptr && !mask->empty();
+        if (!useFullDetail) {
+            return;
+        }
+        // The shader reads the bytes four to a uint
+        GLsizeiptr size = static_cast<GLsizeiptr>(mask->size());
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, fullDetailBuffer);
+        glext::BufferData(GL_SHADER_STORAGE_BUFFER, (size + 3) & ~GLsizeiptr(3), nullptr, GL_STREAM_DRAW);
+        glext::BufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, mask->data());
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Boxes behind the pyramid are dropped by the next cull, levels[l] is levels[0]'s size >> l texels across
+    // and viewProjection the column major matrix it was rasterized with. Null levels turn the test off
+    void setOcclusion(const float* viewProjection, const std::vector<std::vector<float>>* levels) {
+        useOcclusion = levels != nullptr && !levels->empty();
+        if (!useOcclusion) {
+            return;
+        }
+        std::copy(viewProjection, viewProjection + 16, occlusionMatrix);
+        levelCount = static_cast<GLuint>(levels->size());
+        pyramidSize = static_cast<GLuint>(std::lround(std::sqrt(static_cast<double>((*levels)[0].size()))));
+
+        GLsizeiptr total = 0;
+        for (const std::vector<float>& level : *levels) {
+            total += level.size() * sizeof(float);
+        }
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, pyramidBuffer);
+        glext::BufferData(GL_SHADER_STORAGE_BUFFER, total, nullptr, GL_STREAM_DRAW);
+        GLintptr offset = 0;
+        for (const std::vector<float>& level : *levels) {
+            glext::BufferSubData(GL_SHADER_STORAGE_BUFFER, offset, level.size() * sizeof(float), level.data());
+            offset += level.size() * sizeof(float);
+        }
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Culls the commands in commandBuffer into the output buffer
+    void cull(const Frustum& frustum, GLuint commandBuffer, GLuint boxCount) {
+        // Zeroed commands draw nothing, so the leftover tail is harmless without an indirect count
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, outputBuffer);
+        glext::ClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glext::ClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glext::BindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glext::UseProgram(program);
+        glext::Uniform4fv(planesLocation, 6, &frustum.planes[0].a);
+        glext::Uniform1ui(boxCountLocation, boxCount);
+        glext::Uniform1ui(useFullDetailLocation, useFullDetail ? 1 : 0);
+        glext::Uniform1ui(useOcclusionLocation, useOcclusion ? 1 : 0);
+        if (useOcclusion) {
+            glext::Uniform4fv(viewProjectionLocation, 4, occlusionMatrix);
+            glext::Uniform1ui(pyramidSizeLocation, pyramidSize);
+            glext::Uniform1ui(levelCountLocation, levelCount);
+        }
+
+        glext::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, boundsBuffer);
+        glext::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+        glext::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, outputBuffer);
+        glext::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countBuffer);
+        glext::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, fullDetailBuffer);
+        glext::BindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, pyramidBuffer);
+
+        glext::DispatchCompute((boxCount + groupSize - 1) / groupSize, 1, 1);
+
+        glext::UseProgram(0);
+
+        // The draw reads the commands and the count straight after
+        glext::MemoryBarrierGL(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+private:
+    static const GLuint groupSize = 64;
+    static const size_t commandSize = sizeof(GLuint) * 5;
+
+    GLuint program = 0;
+    GLuint boundsBuffer = 0;
+    GLuint outputBuffer = 0;
+    GLuint countBuffer = 0;
+    GLuint fullDetailBuffer = 0;
+    GLuint pyramidBuffer = 0; // every level of the pyramid one after the other
+    GLint planesLocation = -1;
+    GLint boxCountLocation = -1;
+    GLint useFullDetailLocation = -1;
+    GLint useOcclusionLocation = -1;
+    GLint viewProjectionLocation = -1;
+    GLint pyramidSizeLocation = -1;
+    GLint levelCountLocation = -1;
+    bool useFullDetail = false;
+    bool useOcclusion = false;
+    float occlusionMatrix[16] = { 0 };
+    GLuint pyramidSize = 0;
+    GLuint levelCount = 0;
+    bool available = false;
+
+    static GLuint createProgram() {
+        const char* source = R"(#version 430
+layout(local_size_x = 64) in;
+
+struct Command {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Bounds { vec4 bounds[]; };
+layout(std430, binding = 1) readonly buffer InCommands { Command inCommands[]; };
+layout(std430, binding = 2) writeonly buffer OutCommands { Command outCommands[]; };
+layout(std430, binding = 3) buffer DrawCount { uint drawCount; };
+layout(std430, binding = 4) readonly buffer FullDetail { uint fullDetail[]; };
+layout(std430, binding = 5) readonly buffer Pyramid { float pyramid[]; };
+
+uniform vec4 planes[6];
+uniform uint boxCount;
+uniform uint useFullDetail;
+uniform uint useOcclusion;
+uniform vec4 viewProjection[4]; // columns
+uniform uint pyramidSize;
+uniform uint levelCount;
+
+// OcclusionCuller::isVisible
+bool isOccluded(vec3 boxMin, vec3 boxMax) {
+    mat4 matrix = mat4(viewProjection[0], viewProjection[1], viewProjection[2], viewProjection[3]);
+    float size = float(pyramidSize);
+    vec2 rectMin = vec2(1e30);
+    vec2 rectMax = vec2(-1e30);
+    float nearestDepth = 1.0;
+    for (int c = 0; c < 8; c++) {
+        vec3 corner = vec3((c & 1) != 0 ? boxMax.x : boxMin.x, (c & 2) != 0 ? boxMax.y : boxMin.y, (c & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 clip = matrix * vec4(corner, 1.0);
+        if (clip.w <= 1e-5 || clip.z < -clip.w) {
+            return false; // crosses the near plane, can't be behind anything
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 screen = vec2(ndc.x * 0.5 + 0.5, 0.5 - ndc.y * 0.5) * size;
+        rectMin = min(rectMin, screen);
+        rectMax = max(rectMax, screen);
+        nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+    }
+
+    rectMin = max(rectMin, vec2(0.0));
+    rectMax = min(rectMax, vec2(size - 1.0));
+    if (rectMin.x > rectMax.x || rectMin.y > rectMax.y) {
+        return false;
+    }
+
+    float extent = max(rectMax.x - rectMin.x, rectMax.y - rectMin.y);
+    uint level = 0u;
+    uint offset = 0u;
+    uint levelSize = pyramidSize;
+    while (extent > 2.0 && level + 1u < levelCount) {
+        extent *= 0.5;
+        offset += levelSize * levelSize;
+        levelSize >>= 1;
+        level++;
+    }
+
+    uvec2 first = uvec2(rectMin) >> level;
+    uvec2 last = min(uvec2(rectMax) >> level, uvec2(levelSize - 1u));
+    float farthest = 0.0;
+    for (uint y = first.y; y <= last.y; y++) {
+        for (uint x = first.x; x <= last.x; x++) {
+            farthest = max(farthest, pyramid[offset + y * levelSize + x]);
+        }
+    }
+    return nearestDepth > farthest;
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= boxCount) {
+        return;
+    }
+
+    if (useFullDetail != 0u && ((fullDetail[i >> 2] >> ((i & 3u) * 8u)) & 0xFFu) == 0u) {
+        return;
+    }
+
+    vec3 boxMin = bounds[i * 2].xyz;
+    vec3 boxMax = bounds[i * 2 + 1].xyz;
+
+    for (int p = 0; p < 6; p++) {
+        vec3 corner = mix(boxMin, boxMax, greaterThanEqual(planes[p].xyz, vec3(0.0)));
+        if (dot(planes[p].xyz, corner) + planes[p].w < 0.0) {
+            return;
+        }
+    }
+
+    if (useOcclusion != 0u && isOccluded(boxMin, boxMax)) {
+        return;
+    }
+
+    outCommands[atomicAdd(drawCount, 1u)] = inCommands[i];
+}
+)";
+
+        GLuint shader = glext::CreateShader(GL_COMPUTE_SHADER);
+        glext::ShaderSource(shader, 1, &source, nullptr);
+        glext::CompileShader(shader);
+
+        GLint status = 0;
+        glext::GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (!status) {
+            char log[1024];
+            glext::GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            LOG_ERROR("Culling shader failed to compile: " << log);
+            glext::DeleteShader(shader);
+            return 0;
+        }
+
+        GLuint program = glext::CreateProgram();
+        glext::AttachShader(program, shader);
+        glext::LinkProgram(program);
+        glext::DeleteShader(shader);
+
+        glext::GetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status) {
+            char log[1024];
+            glext::GetProgramInfoLog(program, sizeof(log), nullptr, log);
+            LOG_ERROR("Culling shader failed to link: " << log);
+            glext::DeleteProgram(program);
+            return 0;
+        }
+
+        return program;
+    }
+};
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <cstddef>
+
+// Windows only ships the OpenGL 1.1 header, so anything newer has to be
+// declared here and loaded at runtime through glfwGetProcAddress
+
+#if defined(_WIN32)
+#define GLEXT_APIENTRY __stdcall
+#else
+#define GLEXT_APIENTRY
+#endif
+
+#ifndef GL_VERSION_1_5
+typedef ptrdiff_t GLsizeiptr;
+typedef ptrdiff_t GLintptr;
+#endif
+#ifndef GL_VERSION_2_0
+typedef char GLchar;
+#endif
+#ifndef GL_VERSION_3_2
+typedef struct __GLsync* GLsync;
+typedef unsigned long long GLuint64;
+#endif
+
+// Buffer targets and usage
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_ELEMENT_ARRAY_BUFFER
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_DYNAMIC_DRAW
+#define GL_DYNAMIC_DRAW 0x88E8
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_DYNAMIC_COPY
+#define GL_DYNAMIC_COPY 0x88EA
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_PARAMETER_BUFFER
+#define GL_PARAMETER_BUFFER 0x80EE
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+
+// Shaders
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_VERTEX_SHADER 0x8B31
+#endif
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+#ifndef GL_INFO_LOG_LENGTH
+#define GL_INFO_LOG_LENGTH 0x8B84
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+
+// Texture formats
+#ifndef GL_R32UI
+#define GL_R32UI 0x8236
+#endif
+#ifndef GL_RED_INTEGER
+#define GL_RED_INTEGER 0x8D94
+#endif
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+
+// Framebuffer objects
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_RENDERBUFFER
+#define GL_RENDERBUFFER 0x8D41
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_DEPTH_ATTACHMENT
+#define GL_DEPTH_ATTACHMENT 0x8D00
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+
+// Sync objects
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+
+namespace glext {
+
+    using GenBuffersProc = void (GLEXT_APIENTRY*)(GLsizei n, GLuint* buffers);
+    using DeleteBuffersProc = void (GLEXT_APIENTRY*)(GLsizei n, const GLuint* buffers);
+    using BindBufferProc = void (GLEXT_APIENTRY*)(GLenum target, GLuint buffer);
+    using BufferDataProc = void (GLEXT_APIENTRY*)(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+    using BufferSubDataProc = void (GLEXT_APIENTRY*)(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+    using ClearBufferDataProc = void (GLEXT_APIENTRY*)(GLenum target, GLenum internalformat, GLenum format, GLenum type, const void* data);
+    using BindBufferBaseProc = void (GLEXT_APIENTRY*)(GLenum target, GLuint index, GLuint buffer);
+    using MultiDrawElementsIndirectProc = void (GLEXT_APIENTRY*)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+    using MultiDrawElementsIndirectCountProc = void (GLEXT_APIENTRY*)(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+    using GetBufferSubDataProc = void (GLEXT_APIENTRY*)(GLenum target, GLintptr offset, GLsizeiptr size, void* data);
+
+    using GenFramebuffersProc = void (GLEXT_APIENTRY*)(GLsizei n, GLuint* framebuffers);
+    using DeleteFramebuffersProc = void (GLEXT_APIENTRY*)(GLsizei n, const GLuint* framebuffers);
+    using BindFramebufferProc = void (GLEXT_APIENTRY*)(GLenum target, GLuint framebuffer);
+    using CheckFramebufferStatusProc = GLenum (GLEXT_APIENTRY*)(GLenum target);
+    using GenRenderbuffersProc = void (GLEXT_APIENTRY*)(GLsizei n, GLuint* renderbuffers);
+    using DeleteRenderbuffersProc = void (GLEXT_APIENTRY*)(GLsizei n, const GLuint* renderbuffers);
+    using BindRenderbufferProc = void (GLEXT_APIENTRY*)(GLenum target, GLuint renderbuffer);
+    using RenderbufferStorageProc = void (GLEXT_APIENTRY*)(GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+    using FramebufferRenderbufferProc = void (GLEXT_APIENTRY*)(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+    using ClearBufferuivProc = void (GLEXT_APIENTRY*)(GLenum buffer, GLint drawbuffer, const GLuint* value);
+
+    using FenceSyncProc = GLsync (GLEXT_APIENTRY*)(GLenum condition, GLbitfield flags);
+    using ClientWaitSyncProc = GLenum (GLEXT_APIENTRY*)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+    using DeleteSyncProc = void (GLEXT_APIENTRY*)(GLsync sync);
+
+    using CreateShaderProc = GLuint (GLEXT_APIENTRY*)(GLenum type);
+    using DeleteShaderProc = void (GLEXT_APIENTRY*)(GLuint shader);
+    using ShaderSourceProc = void (GLEXT_APIENTRY*)(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+    using CompileShaderProc = void (GLEXT_APIENTRY*)(GLuint shader);
+    using GetShaderivProc = void (GLEXT_APIENTRY*)(GLuint shader, GLenum pname, GLint* params);
+    using GetShaderInfoLogProc = void (GLEXT_APIENTRY*)(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+    using CreateProgramProc = GLuint (GLEXT_APIENTRY*)();
+    using DeleteProgramProc = void (GLEXT_APIENTRY*)(GLuint program);
+    using AttachShaderProc = void (GLEXT_APIENTRY*)(GLuint program, GLuint shader);
+    using LinkProgramProc = void (GLEXT_APIENTRY*)(GLuint program);
+    using GetProgramivProc = void (GLEXT_APIENTRY*)(GLuint program, GLenum pname, GLint* params);
+    using GetProgramInfoLogProc = void (GLEXT_APIENTRY*)(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+    using UseProgramProc = void (GLEXT_APIENTRY*)(GLuint program);
+    using GetUniformLocationProc = GLint (GLEXT_APIENTRY*)(GLuint program, const GLchar* name);
+    using Uniform1uiProc = void (GLEXT_APIENTRY*)(GLint location, GLuint v0);
+    using Uniform4fvProc = void (GLEXT_APIENTRY*)(GLint location, GLsizei count, const GLfloat* value);
+    using BindAttribLocationProc = void (GLEXT_APIENTRY*)(GLuint program, GLuint index, const GLchar* name);
+    using EnableVertexAttribArrayProc = void (GLEXT_APIENTRY*)(GLuint index);
+    using DisableVertexAttribArrayProc = void (GLEXT_APIENTRY*)(GLuint index);
+    using VertexAttribIPointerProc = void (GLEXT_APIENTRY*)(GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer);
+    using VertexAttribDivisorProc = void (GLEXT_APIENTRY*)(GLuint index, GLuint divisor);
+    using DispatchComputeProc = void (GLEXT_APIENTRY*)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+    using MemoryBarrierProc = void (GLEXT_APIENTRY*)(GLbitfield barriers);
+
+    inline GenBuffersProc GenBuffers = nullptr;
+    inline DeleteBuffersProc DeleteBuffers = nullptr;
+    inline BindBufferProc BindBuffer = nullptr;
+    inline BufferDataProc BufferData = nullptr;
+    inline BufferSubDataProc BufferSubData = nullptr;
+    inline ClearBufferDataProc ClearBufferData = nullptr;
+    inline BindBufferBaseProc BindBufferBase = nullptr;
+    inline MultiDrawElementsIndirectProc MultiDrawElementsIndirect = nullptr;
+    inline MultiDrawElementsIndirectCountProc MultiDrawElementsIndirectCount = nullptr;
+    inline GetBufferSubDataProc GetBufferSubData = nullptr;
+
+    inline GenFramebuffersProc GenFramebuffers = nullptr;
+    inline DeleteFramebuffersProc DeleteFramebuffers = nullptr;
+    inline BindFramebufferProc BindFramebuffer = nullptr;
+    inline CheckFramebufferStatusProc CheckFramebufferStatus = nullptr;
+    inline GenRenderbuffersProc GenRenderbuffers = nullptr;
+    inline DeleteRenderbuffersProc DeleteRenderbuffers = nullptr;
+    inline BindRenderbufferProc BindRenderbuffer = nullptr;
+    inline RenderbufferStorageProc RenderbufferStorage = nullptr;
+    inline FramebufferRenderbufferProc FramebufferRenderbuffer = nullptr;
+    inline ClearBufferuivProc ClearBufferuiv = nullptr;
+
+    inline FenceSyncProc FenceSync = nullptr;
+    inline ClientWaitSyncProc ClientWaitSync = nullptr;
+    inline DeleteSyncProc DeleteSync = nullptr;
+
+    inline CreateShaderProc CreateShader = nullptr;
+    inline DeleteShaderProc DeleteShader = nullptr;
+    inline ShaderSourceProc ShaderSource = nullptr;
+    inline CompileShaderProc CompileShader = nullptr;
+    inline GetShaderivProc GetShaderiv = nullptr;
+    inline GetShaderInfoLogProc GetShaderInfoLog = nullptr;
+    inline CreateProgramProc CreateProgram = nullptr;
+    inline DeleteProgramProc DeleteProgram = nullptr;
+    inline AttachShaderProc AttachShader = nullptr;
+    inline LinkProgramProc LinkProgram = nullptr;
+    inline GetProgramivProc GetProgramiv = nullptr;
+    inline GetProgramInfoLogProc GetProgramInfoLog = nullptr;
+    inline UseProgramProc UseProgram = nullptr;
+    inline GetUniformLocationProc GetUniformLocation = nullptr;
+    inline Uniform1uiProc Uniform1ui = nullptr;
+    inline Uniform4fvProc Uniform4fv = nullptr;
+    inline BindAttribLocationProc BindAttribLocation = nullptr;
+    inline EnableVertexAttribArrayProc EnableVertexAttribArray = nullptr;
+    inline DisableVertexAttribArrayProc DisableVertexAttribArray = nullptr;
+    inline VertexAttribIPointerProc VertexAttribIPointer = nullptr;
+    inline VertexAttribDivisorProc VertexAttribDivisor = nullptr;
+    inline DispatchComputeProc DispatchCompute = nullptr;
+    inline MemoryBarrierProc MemoryBarrierGL = nullptr; // MemoryBarrier is a macro in winnt.h
+
+    // Feature flags, filled in by load()
+    inline bool hasBufferObjects = false;
+    inline bool hasMultiDrawIndirect = false;
+    inline bool hasIndirectCount = false;
+    inline bool hasComputeShaders = false;
+    inline bool hasShaders = false;
+    inline bool hasIntegerFramebuffers = false;
+    inline bool hasPixelBuffers = false;
+    inline bool hasSync = false;
+    inline bool hasPerDrawAttributes = false;
+
+    // True if the current context is at least the given version
+    inline bool hasVersion(int major, int minor) {
+        GLFWwindow* context = glfwGetCurrentContext();
+        if (!context) {
+            return false;
+        }
+
+        int contextMajor = glfwGetWindowAttrib(context, GLFW_CONTEXT_VERSION_MAJOR);
+        int contextMinor = glfwGetWindowAttrib(context, GLFW_CONTEXT_VERSION_MINOR);
+        return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+    }
+
+    template <typename Proc>
+    inline Proc loadProc(const char* name) {
+        return reinterpret_cast<Proc>(glfwGetProcAddress(name));
+    }
+
+    // Loads every entry point the engine uses, needs a current context
+    inline void load() {
+        GenBuffers = loadProc<GenBuffersProc>("glGenBuffers");
+        DeleteBuffers = loadProc<DeleteBuffersProc>("glDeleteBuffers");
+        BindBuffer = loadProc<BindBufferProc>("glBindBuffer");
+        BufferData = loadProc<BufferDataProc>("glBufferData");
+        BufferSubData = loadProc<BufferSubDataProc>("glBufferSubData");
+        ClearBufferData = loadProc<ClearBufferDataProc>("glClearBufferData");
+        BindBufferBase = loadProc<BindBufferBaseProc>("glBindBufferBase");
+        MultiDrawElementsIndirect = loadProc<MultiDrawElementsIndirectProc>("glMultiDrawElementsIndirect");
+        GetBufferSubData = loadProc<GetBufferSubDataProc>("glGetBufferSubData");
+
+        GenFramebuffers = loadProc<GenFramebuffersProc>("glGenFramebuffers");
+        DeleteFramebuffers = loadProc<DeleteFramebuffersProc>("glDeleteFramebuffers");
+        BindFramebuffer = loadProc<BindFramebufferProc>("glBindFramebuffer");
+        CheckFramebufferStatus = loadProc<CheckFramebufferStatusProc>("glCheckFramebufferStatus");
+        GenRenderbuffers = loadProc<GenRenderbuffersProc>("glGenRenderbuffers");
+        DeleteRenderbuffers = loadProc<DeleteRenderbuffersProc>("glDeleteRenderbuffers");
+        BindRenderbuffer = loadProc<BindRenderbufferProc>("glBindRenderbuffer");
+        RenderbufferStorage = loadProc<RenderbufferStorageProc>("glRenderbufferStorage");
+        FramebufferRenderbuffer = loadProc<FramebufferRenderbufferProc>("glFramebufferRenderbuffer");
+        ClearBufferuiv = loadProc<ClearBufferuivProc>("glClearBufferuiv");
+
+        FenceSync = loadProc<FenceSyncProc>("glFenceSync");
+        ClientWaitSync = loadProc<ClientWaitSyncProc>("glClientWaitSync");
+        DeleteSync = loadProc<DeleteSyncProc>("glDeleteSync");
+
+        CreateShader = loadProc<CreateShaderProc>("glCreateShader");
+        DeleteShader = loadProc<DeleteShaderProc>("glDeleteShader");
+        ShaderSource = loadProc<ShaderSourceProc>("glShaderSource");
+        CompileShader = loadProc<CompileShaderProc>("glCompileShader");
+        GetShaderiv = loadProc<GetShaderivProc>("glGetShaderiv");
+        GetShaderInfoLog = loadProc<GetShaderInfoLogProc>("glGetShaderInfoLog");
+        CreateProgram = loadProc<CreateProgramProc>("glCreateProgram");
+        DeleteProgram = loadProc<DeleteProgramProc>("glDeleteProgram");
+        AttachShader = loadProc<AttachShaderProc>("glAttachShader");
+        LinkProgram = loadProc<LinkProgramProc>("glLinkProgram");
+        GetProgramiv = loadProc<GetProgramivProc>("glGetProgramiv");
+        GetProgramInfoLog = loadProc<GetProgramInfoLogProc>("glGetProgramInfoLog");
+        UseProgram = loadProc<UseProgramProc>("glUseProgram");
+        GetUniformLocation = loadProc<GetUniformLocationProc>("glGetUniformLocation");
+        Uniform1ui = loadProc<Uniform1uiProc>("glUniform1ui");
+        Uniform4fv = loadProc<Uniform4fvProc>("glUniform4fv");
+        BindAttribLocation = loadProc<BindAttribLocationProc>("glBindAttribLocation");
+        EnableVertexAttribArray = loadProc<EnableVertexAttribArrayProc>("glEnableVertexAttribArray");
+        DisableVertexAttribArray = loadProc<DisableVertexAttribArrayProc>("glDisableVertexAttribArray");
+        VertexAttribIPointer = loadProc<VertexAttribIPointerProc>("glVertexAttribIPointer");
+        VertexAttribDivisor = loadProc<VertexAttribDivisorProc>("glVertexAttribDivisor");
+        DispatchCompute = loadProc<DispatchComputeProc>("glDispatchCompute");
+        MemoryBarrierGL = loadProc<MemoryBarrierProc>("glMemoryBarrier");
+
+        // Core in 4.6, before that it's the ARB version
+        if (hasVersion(4, 6)) {
+            MultiDrawElementsIndirectCount = loadProc<MultiDrawElementsIndirectCountProc>("glMultiDrawElementsIndirectCount");
+        }
+        else if (glfwExtensionSupported("GL_ARB_indirect_parameters")) {
+            MultiDrawElementsIndirectCount = loadProc<MultiDrawElementsIndirectCountProc>("glMultiDrawElementsIndirectCountARB");
+        }
+
+        hasBufferObjects = hasVersion(1, 5) && GenBuffers && DeleteBuffers && BindBuffer && BufferData && BufferSubData;
+
+        // GLX hands out a pointer for any name, so the version or extension has to be checked too
+        hasMultiDrawIndirect = hasBufferObjects && MultiDrawElementsIndirect &&
+            (hasVersion(4, 3) || glfwExtensionSupported("GL_ARB_multi_draw_indirect"));
+
+        hasIndirectCount = hasMultiDrawIndirect && MultiDrawElementsIndirectCount;
+
+        hasShaders = hasVersion(2, 0) &&
+            CreateShader && DeleteShader && ShaderSource && CompileShader && GetShaderiv && GetShaderInfoLog &&
+            CreateProgram && DeleteProgram && AttachShader && LinkProgram && GetProgramiv && GetProgramInfoLog &&
+            UseProgram && GetUniformLocation && Uniform4fv;
+
+        hasComputeShaders = hasBufferObjects && hasShaders && hasVersion(4, 3) &&
+            Uniform1ui && DispatchCompute && MemoryBarrierGL && BindBufferBase && ClearBufferData;
+
+        // Integer color buffers, glClearBuffer and unsigned uniforms all came with 3.0
+        hasIntegerFramebuffers = hasShaders && hasVersion(3, 0) && Uniform1ui && ClearBufferuiv &&
+            GenFramebuffers && DeleteFramebuffers && BindFramebuffer && CheckFramebufferStatus &&
+            GenRenderbuffers && DeleteRenderbuffers && BindRenderbuffer && RenderbufferStorage && FramebufferRenderbuffer;
+
+        hasPixelBuffers = hasBufferObjects && hasVersion(2, 1) && GetBufferSubData;
+
+        hasSync = (hasVersion(3, 2) || glfwExtensionSupported("GL_ARB_sync")) && FenceSync && ClientWaitSync && DeleteSync;
+
+        // An instanced integer attribute read at each indirect command's baseInstance, which needs 4.2
+        hasPerDrawAttributes = hasMultiDrawIndirect && hasShaders && (hasVersion(4, 2) || glfwExtensionSupported("GL_ARB_base_instance")) &&
+            BindAttribLocation && EnableVertexAttribArray && DisableVertexAttribArray && VertexAttribIPointer && VertexAttribDivisor;
+    }
+
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "GLExtensions.h"
+#include "IndirectRenderer.h"
+#include "Log.h"
+#include "Mesh.h"
+#include "RenderQueue.h"
+#include <cstdint>
+#include <list>
+#include <vector>
+
+// Picking on the GPU through an ID buffer
+//
+// The boxes that can cover the pixel under the cursor, the ones in the grid
+// cells along its ray, are drawn into an integer framebuffer with their
+// handles as the color, scissored to that one pixel, in one indirect draw
+// where the handle comes in as a per draw attribute. That pixel is read into
+// a pixel buffer with a fence behind it, and the fence is only polled, so
+// the handle shows up a frame or two later instead of stalling the pipeline.
+// Everything used is GL 4.3, which software renderers like llvmpipe have too
+class GpuPicker {
+public:
+    bool init(int newWidth, int newHeight) {
+        if (!glext::hasIntegerFramebuffers || !glext::hasPixelBuffers || !glext::hasSync || !glext::hasPerDrawAttributes) {
+            return false;
+        }
+
+        program = createProgram();
+        if (!program) {
+            return false;
+        }
+        glext::GenRenderbuffers(1, &colorBuffer);
+        glext::GenRenderbuffers(1, &depthBuffer);
+        allocate(newWidth, newHeight);
+
+        glext::GenFramebuffers(1, &framebuffer);
+        glext::BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glext::FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glext::FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        GLenum status = glext::CheckFramebufferStatus(GL_FRAMEBUFFER);
+        glext::BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (Readback& readback : readbacks) {
+            glext::GenBuffers(1, &readback.buffer);
+            glext::BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            glext::BufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ);
+        }
+        glext::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        available = true;
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERROR("ID buffer framebuffer incomplete: " << status);
+            release();
+            return false;
+        }
+        return true;
+    }
+
+    void release() {
+        if (!available) {
+            return;
+        }
+        for (Readback& readback : readbacks) {
+            if (readback.fence) {
+                glext::DeleteSync(readback.fence);
+                readback.fence = nullptr;
+            }
+            glext::DeleteBuffers(1, &readback.buffer);
+        }
+        glext::DeleteFramebuffers(1, &framebuffer);
+        glext::DeleteRenderbuffers(1, &colorBuffer);
+        glext::DeleteRenderbuffers(1, &depthBuffer);
+        glext::DeleteProgram(program);
+        available = false;
+    }
+
+    bool isAvailable() const {
+        return available;
+    }
+
+    // Call when the framebuffer changes size, so every pixel of it can be picked
+    void resize(int newWidth, int newHeight) {
+        if (!available || (newWidth == width && newHeight == height)) {
+            return;
+        }
+        allocate(newWidth, newHeight);
+    }
+
+    // Draws the handles of the candidates at the framebuffer pixel, counted
+    // from the bottom left, and queues its readback. Uses the projection and
+    // modelview that are loaded
+    void render(IndirectRenderer& boxes, const std::list<Mesh>& meshes, const std::vector<Mesh*>& candidates, int pixelX, int pixelY, GLStateCache& cache) {
+        collect();
+
+        if (pixelX < 0 || pixelY < 0 || pixelX >= width || pixelY >= height) {
+            return;
+        }
+
+        // Three frames in flight, if the oldest still isn't done it's dropped rather than waited on
+        Readback& readback = readbacks[nextReadback];
+        nextReadback = (nextReadback + 1) % readbackCount;
+        if (readback.fence) {
+            glext::DeleteSync(readback.fence);
+            readback.fence = nullptr;
+            dropped++;
+        }
+
+        glext::BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        cache.setScissorTest(true);
+        glScissor(pixelX, pixelY, 1, 1);
+
+        const GLuint clearHandle[4] = { noMeshHandle, 0, 0, 0 };
+        glext::ClearBufferuiv(GL_COLOR, 0, clearHandle);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        cache.setDepthTest(true);
+        cache.setBlend(false);
+        cache.useProgram(program);
+
+        boxes.drawHandles(meshes, candidates, handleAttribute);
+
+        glext::BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glReadPixels(pixelX, pixelY, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glext::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.fence = glext::FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback.frame = frame++;
+
+        cache.setScissorTest(false);
+        glext::BindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // render, then waits for that pixel instead of picking it up a frame later, for checks
+    MeshHandle pickNow(IndirectRenderer& boxes, const std::list<Mesh>& meshes, const std::vector<Mesh*>& candidates, int pixelX, int pixelY, GLStateCache& cache) {
+        render(boxes, meshes, candidates, pixelX, pixelY, cache);
+        Readback& readback = readbacks[(nextReadback + readbackCount - 1) % readbackCount];
+        if (readback.fence) {
+            glext::ClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        collect();
+        return result;
+    }
+
+    // Newest handle that has come back, noMeshHandle over empty space
+    MeshHandle getResult() const {
+        return result;
+    }
+
+    // Frames between the draw and the readback of the current result
+    uint64_t getLatency() const {
+        return latency;
+    }
+
+    uint64_t getDroppedCount() const {
+        return dropped;
+    }
+
+private:
+    static const int readbackCount = 3;
+    static const GLuint handleAttribute = 1; // 0 is gl_Vertex in the compatibility profile
+
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        uint64_t frame = 0;
+    };
+
+    GLuint program = 0;
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    int width = 0;
+    int height = 0;
+    bool available = false;
+
+    Readback readbacks[readbackCount];
+    int nextReadback = 0;
+    uint64_t frame = 0;
+    uint64_t resultFrame = 0;
+    MeshHandle result = noMeshHandle;
+    uint64_t latency = 0;
+    uint64_t dropped = 0;
+
+    // Storage for both renderbuffers, they stay attached to the framebuffer
+    void allocate(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+
+        glext::BindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glext::RenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+        glext::BindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glext::RenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glext::BindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+
+    // Reads back every fenced pixel the GPU has finished, never waits
+    void collect() {
+        for (Readback& readback : readbacks) {
+            if (!readback.fence) {
+                continue;
+            }
+
+            GLenum status = glext::ClientWaitSync(readback.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                continue;
+            }
+            glext::DeleteSync(readback.fence);
+            readback.fence = nullptr;
+
+            // An older pick finishing late mustn't replace a newer one
+            if (readback.frame < resultFrame) {
+                continue;
+            }
+
+            GLuint handle = noMeshHandle;
+            glext::BindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            glext::GetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(handle), &handle);
+            glext::BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            result = handle;
+            resultFrame = readback.frame;
+            latency = frame - readback.frame;
+        }
+    }
+
+    static GLuint compileShader(GLenum type, const char* source) {
+        GLuint shader = glext::CreateShader(type);
+        glext::ShaderSource(shader, 1, &source, nullptr);
+        glext::CompileShader(shader);
+
+        GLint status = 0;
+        glext::GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (!status) {
+            char log[1024];
+            glext::GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            LOG_ERROR("ID buffer shader failed to compile: " << log);
+            glext::DeleteShader(shader);
+            return 0;
+        }
+        return shader;
+    }
+
+    static GLuint createProgram() {
+        const char* vertexSource = R"(#version 130
+in uint meshHandle;
+flat out uint handle;
+
+void main() {
+    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+    handle = meshHandle;
+}
+)";
+
+        const char* fragmentSource = R"(#version 130
+flat in uint handle;
+out uint pickedHandle;
+
+void main() {
+    pickedHandle = handle;
+}
+)";
+
+        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+        if (!vertexShader || !fragmentShader) {
+            if (vertexShader) {
+                glext::DeleteShader(vertexShader);
+            }
+            if (fragmentShader) {
+                glext::DeleteShader(fragmentShader);
+            }
+            return 0;
+        }
+
+        GLuint program = glext::CreateProgram();
+        glext::AttachShader(program, vertexShader);
+        glext::AttachShader(program, fragmentShader);
+        glext::BindAttribLocation(program, handleAttribute, "meshHandle");
+        glext::LinkProgram(program);
+        glext::DeleteShader(vertexShader);
+        glext::DeleteShader(fragmentShader);
+
+        GLint status = 0;
+        glext::GetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status) {
+            char log[1024];
+            glext::GetProgramInfoLog(program, sizeof(log), nullptr, log);
+            LOG_ERROR("ID buffer shader failed to link: " << log);
+            glext::DeleteProgram(program);
+            return 0;
+        }
+
+        return program;
+    }
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include "Log.h"
+#include <fstream>
+
+// Saves 8 bit RGB rows, top row first, as a binary PPM, the simplest format anything can open
+inline bool writePpm(const char* path, int width, int height, const uint8_t* rgb) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        LOG_ERROR("Could not open " << path << " for writing");
+        return false;
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(rgb), static_cast<std::streamsize>(width) * height * 3);
+    return static_cast<bool>(file);
+}
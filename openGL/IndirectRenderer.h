@@ -0,0 +1,364 @@
+#pragma once
+
+#include "BoxGeometry.h"
+#include "FrustumCulling.h"
+#include "GLExtensions.h"
+#include "LevelOfDetail.h"
+#include "Mesh.h"
+#include "OcclusionCulling.h"
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Layout glMultiDrawElementsIndirect reads from the indirect buffer
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Draws every mesh with one glMultiDrawElementsIndirect call
+//
+// All boxes share one vertex buffer (24 vertices each) and one 36 entry index
+// buffer, every command just points baseVertex at its own box, so the CPU cost
+// of a frame no longer depends on how many meshes there are. baseInstance is
+// the box's index, so an attribute with a divisor of 1 gives each draw its own
+// value, which is how drawHandles hands the GPU picker each box's handle
+//
+// Boxes outside the frustum, hidden behind the occluders or replaced by level
+// of detail are culled by a compute shader when the context has one, and on
+// the CPU otherwise. The occlusion pyramid and the level of detail mask are
+// still built on the CPU, the compute pass only reads them
+//
+// Moved meshes only have their own boxes rewritten in place, the buffers are
+// recreated when meshes are added or removed
+class IndirectRenderer {
+public:
+    // Creates the buffers, returns false if the context can't do indirect draws
+    bool init(bool allowGpuCulling = true) {
+        if (!glext::hasMultiDrawIndirect) {
+            return false;
+        }
+
+        glext::GenBuffers(1, &vertexBuffer);
+        glext::GenBuffers(1, &indexBuffer);
+        glext::GenBuffers(1, &commandBuffer);
+        glext::GenBuffers(1, &visibleBuffer);
+        glext::GenBuffers(1, &handleBuffer);
+        glext::GenBuffers(1, &handleCommandBuffer);
+
+        if (allowGpuCulling) {
+            gpuCuller.init();
+        }
+
+        GLuint indices[boxIndexCount];
+        writeBoxIndices(indices);
+
+        glext::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glext::BufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glext::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        available = true;
+        dirty = true;
+        return true;
+    }
+
+    // Has to run while the context is still alive, so before glfwTerminate
+    void release() {
+        if (available) {
+            glext::DeleteBuffers(1, &vertexBuffer);
+            glext::DeleteBuffers(1, &indexBuffer);
+            glext::DeleteBuffers(1, &commandBuffer);
+            glext::DeleteBuffers(1, &visibleBuffer);
+            glext::DeleteBuffers(1, &handleBuffer);
+            glext::DeleteBuffers(1, &handleCommandBuffer);
+            gpuCuller.release();
+            available = false;
+        }
+    }
+
+    bool isAvailable() const {
+        return available;
+    }
+
+    bool isGpuCulling() const {
+        return gpuCuller.isAvailable();
+    }
+
+    // Boxes that passed the CPU cull last frame, the GPU count stays on the GPU
+    size_t getVisibleCount() const {
+        return visibleCommands.size();
+    }
+
+    // Boxes inside the frustum but hidden behind occluders last frame, the GPU cull doesn't count them
+    size_t getOccludedCount() const {
+        return occludedCount;
+    }
+
+    // Call whenever a mesh is added or removed
+    void invalidate() {
+        dirty = true;
+    }
+
+    // Rewrites the boxes of these meshes after they moved, runs of neighbouring boxes go up in one call
+    void update(const std::vector<Mesh*>& moved) {
+        if (dirty || !available) {
+            return;
+        }
+
+        movedIndices.clear();
+        for (const Mesh* mesh : moved) {
+            auto found = meshIndices.find(mesh->handle);
+            if (found == meshIndices.end()) {
+                dirty = true;
+                return;
+            }
+            movedIndices.push_back(found->second);
+            writeBox(found->second, *mesh);
+        }
+        std::sort(movedIndices.begin(), movedIndices.end());
+        movedIndices.erase(std::unique(movedIndices.begin(), movedIndices.end()), movedIndices.end());
+
+        glext::BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        for (size_t run = 0; run < movedIndices.size();) {
+            size_t end = run + 1;
+            while (end < movedIndices.size() && movedIndices[end] == movedIndices[end - 1] + 1) {
+                end++;
+            }
+            size_t first = movedIndices[run];
+            size_t count = end - run;
+            glext::BufferSubData(GL_ARRAY_BUFFER, first * boxVertexCount * sizeof(BoxVertex), count * boxVertexCount * sizeof(BoxVertex), &vertices[first * boxVertexCount]);
+            if (gpuCuller.isAvailable()) {
+                gpuCuller.updateBounds(bounds, first, count);
+            }
+            run = end;
+        }
+        glext::BindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void draw(const std::list<Mesh>& meshes, const Frustum& frustum, const OcclusionCuller* occlusion = nullptr, const LodSelector* lod = nullptr) {
+        if (dirty || meshes.size() != commands.size()) {
+            rebuild(meshes);
+        }
+
+        if (commands.empty()) {
+            return;
+        }
+
+        GLsizei boxCount = static_cast<GLsizei>(commands.size());
+
+        bool cullOnGpu = gpuCuller.isAvailable();
+
+        if (cullOnGpu) {
+            gpuCuller.setFullDetail(lod ? &lod->getFullDetailMask() : nullptr);
+            bool occluded = occlusion && occlusion->getOccluderCount() > 0;
+            gpuCuller.setOcclusion(occluded ? occlusion->getMatrix() : nullptr, occluded ? &occlusion->getLevels() : nullptr);
+            gpuCuller.cull(frustum, commandBuffer, boxCount);
+        }
+        else {
+            cullOnCpu(frustum, occlusion, lod);
+            if (visibleCommands.empty()) {
+                return;
+            }
+        }
+
+        glext::BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(BoxVertex), reinterpret_cast<const void*>(offsetof(BoxVertex, position)));
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BoxVertex), reinterpret_cast<const void*>(offsetof(BoxVertex, color)));
+
+        glext::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+        if (cullOnGpu) {
+            glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCuller.getOutputBuffer());
+
+            if (glext::hasIndirectCount) {
+                glext::BindBuffer(GL_PARAMETER_BUFFER, gpuCuller.getCountBuffer());
+                glext::MultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0, boxCount, 0);
+                glext::BindBuffer(GL_PARAMETER_BUFFER, 0);
+            }
+            else {
+                glext::MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, boxCount, 0);
+            }
+        }
+        else {
+            glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, visibleBuffer);
+            glext::MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(visibleCommands.size()), 0);
+        }
+
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glext::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glext::BindBuffer(GL_ARRAY_BUFFER, 0);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    // Draws the boxes of the given meshes with their handles in the integer attribute handleAttribute and no
+    // colors, for the ID buffer. Needs glext::hasPerDrawAttributes
+    void drawHandles(const std::list<Mesh>& meshes, const std::vector<Mesh*>& selected, GLuint handleAttribute) {
+        if (dirty || meshes.size() != commands.size()) {
+            rebuild(meshes);
+        }
+
+        // The commands keep their baseInstance, so each box still reads its own handle
+        handleCommands.clear();
+        for (const Mesh* mesh : selected) {
+            auto found = meshIndices.find(mesh->handle);
+            if (found != meshIndices.end()) {
+                handleCommands.push_back(commands[found->second]);
+            }
+        }
+
+        if (handleCommands.empty()) {
+            return;
+        }
+
+        // In list order like the full draw, so boxes at the same depth resolve the same way
+        std::sort(handleCommands.begin(), handleCommands.end(), [](const DrawElementsIndirectCommand& a, const DrawElementsIndirectCommand& b) {
+            return a.baseInstance < b.baseInstance;
+        });
+
+        // Orphan the old storage so the driver doesn't wait on last frame's draw
+        GLsizeiptr size = handleCommands.size() * sizeof(DrawElementsIndirectCommand);
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, handleCommandBuffer);
+        glext::BufferData(GL_DRAW_INDIRECT_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glext::BufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, handleCommands.data());
+
+        glext::BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(BoxVertex), reinterpret_cast<const void*>(offsetof(BoxVertex, position)));
+
+        glext::BindBuffer(GL_ARRAY_BUFFER, handleBuffer);
+        glext::EnableVertexAttribArray(handleAttribute);
+        glext::VertexAttribIPointer(handleAttribute, 1, GL_UNSIGNED_INT, 0, nullptr);
+        glext::VertexAttribDivisor(handleAttribute, 1);
+
+        glext::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glext::MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(handleCommands.size()), 0);
+
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glext::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glext::VertexAttribDivisor(handleAttribute, 0);
+        glext::DisableVertexAttribArray(handleAttribute);
+        glext::BindBuffer(GL_ARRAY_BUFFER, 0);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+private:
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+    GLuint commandBuffer = 0; // every box, input of the GPU cull
+    GLuint visibleBuffer = 0; // boxes that passed the CPU cull
+    GLuint handleBuffer = 0;  // mesh handle per box
+    GLuint handleCommandBuffer = 0; // boxes drawn into the ID buffer
+    bool available = false;
+    bool dirty = true;
+    size_t occludedCount = 0;
+
+    GpuFrustumCuller gpuCuller;
+
+    std::vector<BoxVertex> vertices;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<DrawElementsIndirectCommand> visibleCommands;
+    std::vector<DrawElementsIndirectCommand> handleCommands;
+    std::vector<GLuint> handles;
+    std::vector<float> bounds; // min and max corner per box, padded to vec4 for the GPU
+    std::unordered_map<MeshHandle, uint32_t> meshIndices; // list position of each mesh
+    std::vector<uint32_t> movedIndices;
+
+    void cullOnCpu(const Frustum& frustum, const OcclusionCuller* occlusion, const LodSelector* lod) {
+        visibleCommands.clear();
+        occludedCount = 0;
+
+        for (size_t i = 0; i < commands.size(); i++) {
+            if (lod && !lod->isFullDetail(i)) {
+                continue;
+            }
+
+            const float* boxMin = &bounds[i * 8];
+            const float* boxMax = &bounds[i * 8 + 4];
+
+            if (!frustum.intersectsBox(boxMin, boxMax)) {
+                continue;
+            }
+
+            if (occlusion && !occlusion->isVisible(boxMin, boxMax)) {
+                occludedCount++;
+                continue;
+            }
+
+            visibleCommands.push_back(commands[i]);
+        }
+
+        if (visibleCommands.empty()) {
+            return;
+        }
+
+        // Orphan the old storage so the driver doesn't wait on last frame's draw
+        GLsizeiptr size = visibleCommands.size() * sizeof(DrawElementsIndirectCommand);
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, visibleBuffer);
+        glext::BufferData(GL_DRAW_INDIRECT_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glext::BufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, visibleCommands.data());
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // Bounds and vertices of box i on the CPU side
+    void writeBox(size_t i, const Mesh& mesh) {
+        float* box = &bounds[i * 8];
+        box[0] = mesh.location[0];
+        box[1] = mesh.location[1];
+        box[2] = mesh.location[2];
+        box[3] = 0.0f;
+        box[4] = mesh.location[0] + mesh.size[0];
+        box[5] = mesh.location[1] + mesh.size[1];
+        box[6] = mesh.location[2] + mesh.size[2];
+        box[7] = 0.0f;
+
+        writeBoxVertices(&box[0], &box[4], mesh.color.data(), &vertices[i * boxVertexCount]);
+    }
+
+    // Rewrites the vertex and command buffers from the mesh list
+    void rebuild(const std::list<Mesh>& meshes) {
+        vertices.resize(meshes.size() * boxVertexCount);
+        commands.resize(meshes.size());
+        bounds.resize(meshes.size() * 8);
+        handles.resize(meshes.size());
+
+        meshIndices.clear();
+
+        size_t i = 0;
+        for (auto it = meshes.begin(); it != meshes.end(); ++it, ++i) {
+            writeBox(i, *it);
+            meshIndices[it->handle] = static_cast<uint32_t>(i);
+            handles[i] = it->handle;
+
+            DrawElementsIndirectCommand& command = commands[i];
+            command.count = boxIndexCount;
+            command.instanceCount = 1;
+            command.firstIndex = 0;
+            command.baseVertex = static_cast<GLint>(i * boxVertexCount);
+            command.baseInstance = static_cast<GLuint>(i);
+        }
+
+        glext::BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glext::BufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(BoxVertex), vertices.data(), GL_DYNAMIC_DRAW);
+        glext::BindBuffer(GL_ARRAY_BUFFER, handleBuffer);
+        glext::BufferData(GL_ARRAY_BUFFER, handles.size() * sizeof(GLuint), handles.data(), GL_STATIC_DRAW);
+        glext::BindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glext::BufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+        glext::BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        if (gpuCuller.isAvailable()) {
+            gpuCuller.setBounds(bounds, commands.size());
+        }
+
+        dirty = false;
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "FrameStats.h"
+#include "GLExtensions.h"
+#include "Log.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+
+// Time from input to the frame showing it, and a cap on how far ahead of
+// the GPU the CPU may run
+//
+// Every frame gets a fence after its swap. Right after that the fences the
+// GPU has passed are collected, and with a cap on frames ahead the oldest
+// one is waited on until few enough frames are queued, before the next
+// frame samples its input. Each frame that applied input records two
+// latencies: to the swap call returning, and to the GPU finishing the frame,
+// which is as close to the display as GL can tell. A fence found already
+// passed is timed when it's found, so the second number can be late by up
+// to a frame unless the cap makes the engine wait for every fence. A cap of
+// 1 is the lowest latency, the CPU then never starts on a frame while the
+// last one is still queued, at the cost of the overlap between the two
+class InputLatencyMonitor {
+public:
+    explicit InputLatencyMonitor(double reportSeconds) : reportInterval(reportSeconds) {}
+
+    // 0 leaves it to the driver, which usually queues up to three frames
+    void setMaxFramesAhead(int frames) {
+        maxFramesAhead = std::min(std::max(frames, 0), maxFences - 1);
+    }
+
+    int getMaxFramesAhead() const {
+        return maxFramesAhead;
+    }
+
+    // Call after framePresented, before the next frame samples input
+    void waitForFrameSlot() {
+        collectFences(maxFramesAhead > 0 ? maxFramesAhead - 1 : maxFences);
+    }
+
+    // Call right after the swap, inputTime is when the oldest input the frame applied came in, negative for none
+    void framePresented(double inputTime) {
+        double now = glfwGetTime();
+        if (inputTime >= 0.0) {
+            recentSwap.record(now - inputTime);
+            overallSwap.record(now - inputTime);
+        }
+
+        if (glext::hasSync) {
+            // The ring being full means the GPU is far behind, wait for the oldest to make room
+            if (fenceCount == maxFences) {
+                collectFences(maxFences - 1);
+            }
+            Fence& fence = fences[(fenceStart + fenceCount) % maxFences];
+            fence.sync = glext::FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            fence.inputTime = inputTime;
+            fenceCount++;
+        }
+
+        sinceReport += now - lastReportCheck;
+        lastReportCheck = now;
+        if (sinceReport >= reportInterval) {
+            report("Input latency", recentSwap, recentDone);
+            recentSwap.reset();
+            recentDone.reset();
+            sinceReport = 0.0;
+        }
+    }
+
+    // The time since the last frame was a deliberate wait, it doesn't count towards the report interval
+    void skipInterval() {
+        lastReportCheck = glfwGetTime();
+    }
+
+    void printSummary() const {
+        report("Input latency overall", overallSwap, overallDone);
+    }
+
+    // Fences left at exit, call while the context is still current
+    void release() {
+        while (fenceCount > 0) {
+            glext::DeleteSync(fences[fenceStart].sync);
+            fenceStart = (fenceStart + 1) % maxFences;
+            fenceCount--;
+        }
+    }
+
+private:
+    struct Fence {
+        GLsync sync = nullptr;
+        double inputTime = -1.0;
+    };
+
+    static const int maxFences = 8;
+    const GLuint64 fenceTimeout = 1000000000; // a second in nanoseconds, a hung GPU doesn't hang the loop forever
+
+    Fence fences[maxFences];
+    int fenceStart = 0;
+    int fenceCount = 0;
+    int maxFramesAhead = 0;
+
+    double reportInterval;
+    double sinceReport = 0.0;
+    double lastReportCheck = 0.0;
+    FrameTimeHistogram recentSwap;
+    FrameTimeHistogram recentDone;
+    FrameTimeHistogram overallSwap;
+    FrameTimeHistogram overallDone;
+
+    // Frees the fences the GPU has passed, waiting on the oldest while more than keep are left
+    void collectFences(int keep) {
+        if (!glext::hasSync) {
+            return;
+        }
+        while (fenceCount > 0) {
+            Fence& oldest = fences[fenceStart];
+            bool mustWait = fenceCount > keep;
+            GLenum status = glext::ClientWaitSync(oldest.sync, mustWait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, mustWait ? fenceTimeout : 0);
+            if (status == GL_TIMEOUT_EXPIRED && !mustWait) {
+                break;
+            }
+            if (oldest.inputTime >= 0.0 && (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)) {
+                double latency = glfwGetTime() - oldest.inputTime;
+                recentDone.record(latency);
+                overallDone.record(latency);
+            }
+            glext::DeleteSync(oldest.sync);
+            fenceStart = (fenceStart + 1) % maxFences;
+            fenceCount--;
+        }
+    }
+
+    static void report(const char* label, const FrameTimeHistogram& swap, const FrameTimeHistogram& done) {
+        if (swap.getCount() == 0) {
+            return;
+        }
+        if (done.getCount() == 0) {
+            LOG_INFO(label << " (ms, " << swap.getCount() << " frames): to swap p50 " << roundMilliseconds(swap.getPercentile(0.5))
+                << ", p99 " << roundMilliseconds(swap.getPercentile(0.99)) << ", max " << roundMilliseconds(swap.getMax()));
+            return;
+        }
+        LOG_INFO(label << " (ms, " << swap.getCount() << " frames): to swap p50 " << roundMilliseconds(swap.getPercentile(0.5))
+            << ", p99 " << roundMilliseconds(swap.getPercentile(0.99)) << ", to GPU done p50 " << roundMilliseconds(done.getPercentile(0.5))
+            << ", p99 " << roundMilliseconds(done.getPercentile(0.99)) << ", max " << roundMilliseconds(done.getMax()));
+    }
+};
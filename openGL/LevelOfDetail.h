@@ -0,0 +1,450 @@
+#pragma once
+
+#include "BoxGeometry.h"
+#include "FrustumCulling.h"
+#include "Memory.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+class SoftwareRasterizer;
+
+// Distance based level of detail for boxes
+//
+// Boxes are grouped into clusters on a coarse grid. Each frame a cluster is
+// drawn as its own boxes, as one proxy box around all of them, or as a single
+// camera facing billboard, picked by how many pixels of detail would be lost.
+// The level only changes once the error is clearly past the threshold in
+// either direction, so clusters near the switch distance don't pop
+//
+// Boxes the physics moves keep the cluster they were built into, only the
+// clusters holding them are refit. The grouping is redone when meshes are
+// added or removed, clusters keep their level through that by their cell
+class LodSelector {
+public:
+    enum Level : uint8_t {
+        Full,     // every box in the cluster
+        Proxy,    // one box covering the cluster
+        Impostor, // one billboard
+    };
+
+    float cellSize = 40.0f;      // world size of a cluster cell
+    float pixelThreshold = 6.0f; // screen space error allowed before refining
+    float hysteresis = 0.25f;    // fraction around the threshold where the level is kept
+
+    // Call whenever a mesh is added or removed
+    void invalidate() {
+        dirty = true;
+    }
+
+    // Refits the clusters holding these meshes after they moved
+    void update(const std::vector<Mesh*>& moved) {
+        if (dirty) {
+            return;
+        }
+
+        refitClusters.clear();
+        for (const Mesh* mesh : moved) {
+            auto found = meshIndices.find(mesh->handle);
+            if (found == meshIndices.end()) {
+                dirty = true;
+                return;
+            }
+            refitClusters.push_back(meshClusters[found->second]);
+        }
+        std::sort(refitClusters.begin(), refitClusters.end());
+        refitClusters.erase(std::unique(refitClusters.begin(), refitClusters.end()), refitClusters.end());
+
+        for (uint32_t clusterIndex : refitClusters) {
+            fitCluster(clusters[clusterIndex]);
+        }
+    }
+
+    // Picks a level per cluster, pixelsPerUnit is the screen size of one unit at distance 1
+    void select(const std::list<Mesh>& meshes, const float* eye, float pixelsPerUnit, const Frustum& frustum) {
+        if (dirty || meshes.size() != fullDetail.size()) {
+            build(meshes);
+        }
+
+        proxyVertices.clear();
+        proxyIndices.clear();
+        proxyClusters.clear();
+        impostorVertices.clear();
+        proxyCount = 0;
+        impostorCount = 0;
+        lodVertexCount = 0;
+        replacedVertexCount = 0;
+
+        float refineAbove = pixelThreshold * (1.0f + hysteresis);
+        float coarsenBelow = pixelThreshold * (1.0f - hysteresis);
+
+        for (Cluster& cluster : clusters) {
+            if (!frustum.intersectsBox(cluster.boxMin, cluster.boxMax)) {
+                setMembers(cluster, 0);
+                continue;
+            }
+
+            float pixels = pixelsPerUnit / std::max(distanceToBox(eye, cluster.boxMin, cluster.boxMax), 1e-3f);
+            float proxyError = cluster.proxyError * pixels;
+            float impostorError = cluster.impostorError * pixels;
+
+            // Refine while the current level loses too much, then coarsen while it loses little
+            Level level = cluster.level;
+            if (level == Impostor && impostorError > refineAbove) {
+                level = Proxy;
+            }
+            if (level == Proxy && proxyError > refineAbove) {
+                level = Full;
+            }
+            if (level == Full && proxyError < coarsenBelow) {
+                level = Proxy;
+            }
+            if (level == Proxy && impostorError < coarsenBelow) {
+                level = Impostor;
+            }
+            cluster.level = level;
+
+            // A proxy of one box is the box itself
+            bool single = cluster.memberCount == 1;
+            if (level == Full || (level == Proxy && single)) {
+                setMembers(cluster, 1);
+                continue;
+            }
+
+            setMembers(cluster, 0);
+            replacedVertexCount += cluster.memberCount * boxIndexCount;
+
+            if (level == Proxy) {
+                proxyClusters.push_back(static_cast<uint32_t>(&cluster - clusters.data()));
+                addProxy(cluster);
+                lodVertexCount += boxIndexCount;
+            }
+            else {
+                impostorVertices.push_back(static_cast<uint32_t>(proxyVertices.size()));
+                addImpostor(cluster, eye);
+                lodVertexCount += 6;
+            }
+        }
+    }
+
+    // Draws the proxies and impostors picked by select in one call
+    void draw() const {
+        if (proxyIndices.empty()) {
+            return;
+        }
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(BoxVertex), &proxyVertices[0].position);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BoxVertex), &proxyVertices[0].color);
+
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(proxyIndices.size()), GL_UNSIGNED_INT, proxyIndices.data());
+
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    // The same proxies and impostors through the software rasterizer, defined in SoftwareRasterizer.h
+    void draw(SoftwareRasterizer& target) const;
+
+    // False if the mesh at this list position is covered by a proxy, impostor or the frustum
+    bool isFullDetail(size_t meshIndex) const {
+        return fullDetail[meshIndex] != 0;
+    }
+
+    // One byte per mesh in list order, 1 where the mesh is drawn itself
+    const std::vector<uint8_t>& getFullDetailMask() const {
+        return fullDetail;
+    }
+
+    size_t getProxyCount() const {
+        return proxyCount;
+    }
+
+    size_t getImpostorCount() const {
+        return impostorCount;
+    }
+
+    // Vertices drawn for proxies and impostors, against what their boxes would have cost
+    size_t getLodVertexCount() const {
+        return lodVertexCount;
+    }
+
+    size_t getReplacedVertexCount() const {
+        return replacedVertexCount;
+    }
+
+private:
+    struct Cluster {
+        float boxMin[3];
+        float boxMax[3];
+        float color[3];
+        float proxyError;    // how far a proxy's faces stand off the boxes, or the size of a box it shows in the wrong color
+        float impostorError; // world size of the detail a billboard hides
+        Level level = Full;
+        int64_t key;          // grid cell, or the negative of the handle for a box bigger than a cell
+        uint32_t firstMember; // range in clusterMembers
+        uint32_t memberCount;
+    };
+
+    std::vector<Cluster> clusters;
+    std::vector<uint32_t> clusterMembers;
+    std::vector<uint8_t> fullDetail;
+    bool dirty = true;
+
+    // Kept between builds so a rebuild doesn't go to the heap
+    std::unordered_map<int64_t, uint32_t, std::hash<int64_t>, std::equal_to<int64_t>, PoolAllocator<std::pair<const int64_t, uint32_t>>> cellClusters;
+    std::unordered_map<int64_t, Level, std::hash<int64_t>, std::equal_to<int64_t>, PoolAllocator<std::pair<const int64_t, Level>>> previousLevels;
+    std::unordered_map<MeshHandle, uint32_t, std::hash<MeshHandle>, std::equal_to<MeshHandle>, PoolAllocator<std::pair<const MeshHandle, uint32_t>>> meshIndices;
+    std::vector<const Mesh*> meshPointers; // list order
+    std::vector<uint32_t> meshClusters;
+    std::vector<uint32_t> refitClusters;
+
+    // Nearest member side seen from each face of a proxy, a grid of faceSamples x faceSamples
+    static const int faceSamples = 16;
+    std::vector<float> frontMax;
+    std::vector<float> frontMin;
+
+    std::vector<BoxVertex> proxyVertices;
+    std::vector<GLuint> proxyIndices;
+    std::vector<uint32_t> proxyClusters;    // clusters select drew as proxies
+    std::vector<uint32_t> impostorVertices; // first of the 4 proxyVertices of each impostor
+    size_t proxyCount = 0;
+    size_t impostorCount = 0;
+    size_t lodVertexCount = 0;
+    size_t replacedVertexCount = 0;
+
+    static float distanceToBox(const float* point, const float* boxMin, const float* boxMax) {
+        float dx = std::max(std::max(boxMin[0] - point[0], 0.0f), point[0] - boxMax[0]);
+        float dy = std::max(std::max(boxMin[1] - point[1], 0.0f), point[1] - boxMax[1]);
+        float dz = std::max(std::max(boxMin[2] - point[2], 0.0f), point[2] - boxMax[2]);
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    void setMembers(const Cluster& cluster, uint8_t value) {
+        for (uint32_t i = 0; i < cluster.memberCount; i++) {
+            fullDetail[clusterMembers[cluster.firstMember + i]] = value;
+        }
+    }
+
+    // Groups boxes by the grid cell of their center, boxes bigger than a cell stay alone
+    void build(const std::list<Mesh>& meshes) {
+        previousLevels.clear();
+        for (const Cluster& cluster : clusters) {
+            previousLevels[cluster.key] = cluster.level;
+        }
+
+        clusters.clear();
+        fullDetail.assign(meshes.size(), 1);
+        cellClusters.clear();
+        meshIndices.clear();
+        meshPointers.clear();
+        meshClusters.clear();
+
+        uint32_t index = 0;
+        for (auto it = meshes.begin(); it != meshes.end(); ++it, ++index) {
+            const Mesh& mesh = *it;
+            float largest = std::max(mesh.size[0], std::max(mesh.size[1], mesh.size[2]));
+
+            uint32_t clusterIndex = static_cast<uint32_t>(clusters.size());
+            int64_t key = -1 - static_cast<int64_t>(mesh.handle);
+            if (largest <= cellSize) {
+                int64_t cellX = static_cast<int64_t>(std::floor((mesh.location[0] + mesh.size[0] * 0.5f) / cellSize));
+                int64_t cellY = static_cast<int64_t>(std::floor((mesh.location[1] + mesh.size[1] * 0.5f) / cellSize));
+                int64_t cellZ = static_cast<int64_t>(std::floor((mesh.location[2] + mesh.size[2] * 0.5f) / cellSize));
+                key = ((cellX & 0x1FFFFF) << 42) | ((cellY & 0x1FFFFF) << 21) | (cellZ & 0x1FFFFF);
+
+                auto found = cellClusters.find(key);
+                if (found != cellClusters.end()) {
+                    clusterIndex = found->second;
+                }
+                else {
+                    cellClusters[key] = clusterIndex;
+                }
+            }
+
+            if (clusterIndex == clusters.size()) {
+                Cluster cluster;
+                cluster.key = key;
+                cluster.memberCount = 0;
+                auto previous = previousLevels.find(key);
+                if (previous != previousLevels.end()) {
+                    cluster.level = previous->second;
+                }
+                clusters.push_back(cluster);
+            }
+
+            clusters[clusterIndex].memberCount++;
+            meshClusters.push_back(clusterIndex);
+            meshIndices[mesh.handle] = index;
+            meshPointers.push_back(&mesh);
+        }
+
+        // Members laid out cluster after cluster, in list order within each
+        uint32_t offset = 0;
+        for (Cluster& cluster : clusters) {
+            cluster.firstMember = offset;
+            offset += cluster.memberCount;
+            cluster.memberCount = 0;
+        }
+        clusterMembers.resize(meshClusters.size());
+        for (uint32_t i = 0; i < meshClusters.size(); i++) {
+            Cluster& cluster = clusters[meshClusters[i]];
+            clusterMembers[cluster.firstMember + cluster.memberCount++] = i;
+        }
+
+        for (Cluster& cluster : clusters) {
+            fitCluster(cluster);
+        }
+
+        dirty = false;
+    }
+
+    // Bounds, color and errors of a cluster from where its members are now
+    void fitCluster(Cluster& cluster) {
+        const Mesh& first = *meshPointers[clusterMembers[cluster.firstMember]];
+        float totalVolume = 0.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            cluster.boxMin[axis] = first.location[axis];
+            cluster.boxMax[axis] = first.location[axis] + first.size[axis];
+            cluster.color[axis] = 0.0f;
+        }
+        cluster.proxyError = 0.0f;
+
+        for (uint32_t i = 0; i < cluster.memberCount; i++) {
+            const Mesh& mesh = *meshPointers[clusterMembers[cluster.firstMember + i]];
+            float volume = std::max(mesh.size[0] * mesh.size[1] * mesh.size[2], 1e-6f);
+            for (int axis = 0; axis < 3; axis++) {
+                cluster.boxMin[axis] = std::min(cluster.boxMin[axis], mesh.location[axis]);
+                cluster.boxMax[axis] = std::max(cluster.boxMax[axis], mesh.location[axis] + mesh.size[axis]);
+                cluster.color[axis] += mesh.color[axis] * volume;
+            }
+            totalVolume += volume;
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            cluster.color[axis] /= totalVolume;
+        }
+
+        // Each face of the proxy looks along its axis at the members behind it
+        // over a grid of points. Where it covers a member it stands off that
+        // member's nearest side, where it covers nothing it fills a hole all
+        // the way through. So boxes packed tightly cost nothing and one
+        // spanning a gap or a notch costs its depth
+        for (int axis = 0; axis < 3; axis++) {
+            int axisU = (axis + 1) % 3;
+            int axisV = (axis + 2) % 3;
+            frontMax.assign(faceSamples * faceSamples, cluster.boxMin[axis]);
+            frontMin.assign(faceSamples * faceSamples, cluster.boxMax[axis]);
+
+            for (uint32_t i = 0; i < cluster.memberCount; i++) {
+                const Mesh& mesh = *meshPointers[clusterMembers[cluster.firstMember + i]];
+                int firstU, lastU, firstV, lastV;
+                coveredSamples(cluster, axisU, mesh.location[axisU], mesh.location[axisU] + mesh.size[axisU], firstU, lastU);
+                coveredSamples(cluster, axisV, mesh.location[axisV], mesh.location[axisV] + mesh.size[axisV], firstV, lastV);
+                for (int v = firstV; v <= lastV; v++) {
+                    for (int u = firstU; u <= lastU; u++) {
+                        float& high = frontMax[v * faceSamples + u];
+                        float& low = frontMin[v * faceSamples + u];
+                        high = std::max(high, mesh.location[axis] + mesh.size[axis]);
+                        low = std::min(low, mesh.location[axis]);
+                    }
+                }
+            }
+
+            for (int sample = 0; sample < faceSamples * faceSamples; sample++) {
+                cluster.proxyError = std::max(cluster.proxyError, cluster.boxMax[axis] - frontMax[sample]);
+                cluster.proxyError = std::max(cluster.proxyError, frontMin[sample] - cluster.boxMin[axis]);
+            }
+        }
+
+        // A proxy has one color, a member far from it shows as a patch of the
+        // wrong color as big as the member, all of it for opposite colors
+        for (uint32_t i = 0; i < cluster.memberCount; i++) {
+            const Mesh& mesh = *meshPointers[clusterMembers[cluster.firstMember + i]];
+            float difference = 0.0f;
+            for (int axis = 0; axis < 3; axis++) {
+                difference = std::max(difference, std::fabs(mesh.color[axis] - cluster.color[axis]) / 255.0f);
+            }
+            float largest = std::max(mesh.size[0], std::max(mesh.size[1], mesh.size[2]));
+            cluster.proxyError = std::max(cluster.proxyError, difference * largest);
+        }
+
+        // A billboard flattens the whole cluster
+        float dx = cluster.boxMax[0] - cluster.boxMin[0];
+        float dy = cluster.boxMax[1] - cluster.boxMin[1];
+        float dz = cluster.boxMax[2] - cluster.boxMin[2];
+        cluster.impostorError = std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    void addProxy(const Cluster& cluster) {
+        GLuint base = static_cast<GLuint>(proxyVertices.size());
+        proxyVertices.resize(proxyVertices.size() + boxVertexCount);
+        writeBoxVertices(cluster.boxMin, cluster.boxMax, cluster.color, &proxyVertices[base]);
+
+        GLuint indices[boxIndexCount];
+        writeBoxIndices(indices);
+        for (int i = 0; i < boxIndexCount; i++) {
+            proxyIndices.push_back(base + indices[i]);
+        }
+        proxyCount++;
+    }
+
+    // Grid points across the proxy's side along axis that [low, high] covers, none if first > last
+    static void coveredSamples(const Cluster& cluster, int axis, float low, float high, int& first, int& last) {
+        float extent = cluster.boxMax[axis] - cluster.boxMin[axis];
+        if (extent <= 0.0f) {
+            first = 0;
+            last = faceSamples - 1;
+            return;
+        }
+        float scale = faceSamples / extent;
+        first = std::max(0, static_cast<int>(std::ceil((low - cluster.boxMin[axis]) * scale - 0.5f)));
+        last = std::min(faceSamples - 1, static_cast<int>(std::floor((high - cluster.boxMin[axis]) * scale - 0.5f)));
+    }
+
+    // Upright square turned towards the eye, sized to the cluster's average extent
+    void addImpostor(const Cluster& cluster, const float* eye) {
+        float center[3];
+        float halfSize = 0.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            center[axis] = (cluster.boxMin[axis] + cluster.boxMax[axis]) * 0.5f;
+            halfSize += (cluster.boxMax[axis] - cluster.boxMin[axis]) / 6.0f;
+        }
+
+        float toEye[3] = { eye[0] - center[0], eye[1] - center[1], eye[2] - center[2] };
+        float right[3] = { toEye[2], 0.0f, -toEye[0] };
+        float rightLength = std::sqrt(right[0] * right[0] + right[2] * right[2]);
+        if (rightLength < 1e-6f) {
+            right[0] = 1.0f;
+            right[2] = 0.0f;
+            rightLength = 1.0f;
+        }
+        right[0] *= halfSize / rightLength;
+        right[2] *= halfSize / rightLength;
+
+        GLuint base = static_cast<GLuint>(proxyVertices.size());
+        const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+        for (int i = 0; i < 4; i++) {
+            BoxVertex vertex;
+            vertex.position[0] = center[0] + right[0] * corners[i][0];
+            vertex.position[1] = center[1] + halfSize * corners[i][1];
+            vertex.position[2] = center[2] + right[2] * corners[i][0];
+            vertex.color[0] = static_cast<uint8_t>(cluster.color[0]);
+            vertex.color[1] = static_cast<uint8_t>(cluster.color[1]);
+            vertex.color[2] = static_cast<uint8_t>(cluster.color[2]);
+            vertex.color[3] = 255;
+            proxyVertices.push_back(vertex);
+        }
+
+        const GLuint quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int i = 0; i < 6; i++) {
+            proxyIndices.push_back(base + quad[i]);
+        }
+        impostorCount++;
+    }
+};
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// Asynchronous logging
+//
+// A log line is formatted into a buffer on the calling thread's stack and
+// pushed into a fixed ring of entries without taking a lock, then a
+// background thread writes the lines out to the console and the log file in
+// batches, one write and flush per batch. The writer sleeps on a condition
+// variable while the ring is empty, and a push only wakes it when it's
+// asleep, so the thread that logs makes a system call at most once per
+// burst of lines and logging from the frame loop doesn't stall it. When the
+// ring is full the line is dropped and counted instead of waiting, and the
+// count is logged once there's room again
+//
+// LOG_DEBUG compiles to nothing unless LOG_DEBUG_ENABLED is 1, which it is
+// by default only in builds without NDEBUG
+
+#ifndef LOG_DEBUG_ENABLED
+#ifdef NDEBUG
+#define LOG_DEBUG_ENABLED 0
+#else
+#define LOG_DEBUG_ENABLED 1
+#endif
+#endif
+
+enum class LogLevel {
+    Debug,
+    Info,
+    Warning,
+    Error,
+};
+
+inline const char* getLogLevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug:
+        return "debug";
+    case LogLevel::Info:
+        return "info";
+    case LogLevel::Warning:
+        return "warning";
+    case LogLevel::Error:
+        return "error";
+    }
+    return "";
+}
+
+class Logger {
+public:
+    // Longer lines are cut off
+    static constexpr size_t maxLineLength = 256 - 32;
+
+    Logger() : startTime(std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < capacity; i++) {
+            entries[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        writer = std::thread([this] { writeLoop(); });
+    }
+
+    // Writes out everything still queued
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        writer.join();
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Also writes the lines to a file from now on, false if it can't be opened
+    bool openFile(const char* path) {
+        FILE* opened = nullptr;
+#ifdef _MSC_VER
+        // fopen is a C4996 error under /sdl
+        if (fopen_s(&opened, path, "w") != 0) {
+            opened = nullptr;
+        }
+#else
+        opened = std::fopen(path, "w");
+#endif
+        if (!opened) {
+            return false;
+        }
+        FILE* previous = file.exchange(opened);
+        if (previous) {
+            std::fclose(previous);
+        }
+        return true;
+    }
+
+    // Lines below the level are skipped before they're formatted
+    void setLevel(LogLevel level) {
+        minimumLevel.store(level, std::memory_order_relaxed);
+    }
+
+    bool isEnabled(LogLevel level) const {
+        return level >= minimumLevel.load(std::memory_order_relaxed);
+    }
+
+    // From any thread, false if the ring was full and the line was dropped
+    bool push(LogLevel level, const char* text, size_t length) {
+        size_t position = pushPosition.load(std::memory_order_relaxed);
+        Entry* entry;
+        for (;;) {
+            entry = &entries[position & (capacity - 1)];
+            size_t sequence = entry->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (difference == 0) {
+                // The slot is free, claim it unless another thread got there first
+                if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                // The writer hasn't got to this slot since it was last used
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else {
+                position = pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        entry->level = level;
+        entry->seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+        entry->length = static_cast<uint16_t>(std::min(length, maxLineLength));
+        std::memcpy(entry->text, text, entry->length);
+        entry->sequence.store(position + 1, std::memory_order_release);
+
+        // Pairs with the fence in writeLoop, either the writer sees this line or this sees it asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writerAsleep.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+        return true;
+    }
+
+    uint64_t getDroppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const size_t capacity = 1024; // a power of two
+    static const size_t batchBytes = 64 * 1024;
+    const std::chrono::milliseconds wakeFallback{ 100 }; // a missed wake only delays lines by this much
+
+    struct Entry {
+        std::atomic<size_t> sequence; // position + 1 once written, position + capacity once read
+        LogLevel level;
+        float seconds;
+        uint16_t length;
+        char text[maxLineLength];
+    };
+
+    Entry entries[capacity];
+    alignas(64) std::atomic<size_t> pushPosition{ 0 };
+    alignas(64) size_t readPosition = 0; // only the writer thread touches it
+    std::atomic<uint64_t> dropped{ 0 };
+    uint64_t droppedReported = 0;
+
+    std::atomic<LogLevel> minimumLevel{ LOG_DEBUG_ENABLED ? LogLevel::Debug : LogLevel::Info };
+    std::atomic<FILE*> file{ nullptr };
+    std::atomic<bool> running{ true };
+    std::atomic<bool> writerAsleep{ false };
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::chrono::steady_clock::time_point startTime;
+    std::thread writer;
+
+    // The console gets the plain text, the file gets when and how bad too
+    char consoleBatch[batchBytes];
+    char fileBatch[batchBytes];
+    size_t consoleUsed = 0;
+    size_t fileUsed = 0;
+
+    void writeLoop() {
+        for (;;) {
+            // Read running first, so nothing pushed before stopping is missed by the last pass
+            bool stopping = !running.load(std::memory_order_acquire);
+            if (drain()) {
+                continue;
+            }
+            if (stopping) {
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            writerAsleep.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!hasPending() && running.load(std::memory_order_acquire)) {
+                wake.wait_for(lock, wakeFallback);
+            }
+            writerAsleep.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    bool hasPending() const {
+        const Entry& entry = entries[readPosition & (capacity - 1)];
+        return entry.sequence.load(std::memory_order_acquire) == readPosition + 1 || dropped.load(std::memory_order_relaxed) != droppedReported;
+    }
+
+    // Writes out what's in the ring, false if it was empty
+    bool drain() {
+        bool any = false;
+        for (;;) {
+            Entry& entry = entries[readPosition & (capacity - 1)];
+            if (entry.sequence.load(std::memory_order_acquire) != readPosition + 1) {
+                break;
+            }
+            append(entry.level, entry.seconds, entry.text, entry.length);
+            entry.sequence.store(readPosition + capacity, std::memory_order_release);
+            readPosition++;
+            any = true;
+        }
+
+        uint64_t droppedNow = dropped.load(std::memory_order_relaxed);
+        if (droppedNow != droppedReported) {
+            char text[64];
+            int length = std::snprintf(text, sizeof(text), "%llu log lines dropped, the queue was full", static_cast<unsigned long long>(droppedNow - droppedReported));
+            append(LogLevel::Warning, std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count(), text, static_cast<size_t>(length));
+            droppedReported = droppedNow;
+            any = true;
+        }
+
+        if (any) {
+            flush();
+        }
+        return any;
+    }
+
+    void append(LogLevel level, float seconds, const char* text, size_t length) {
+        // Room for the longest prefix and the newline
+        if (consoleUsed + length + 16 > batchBytes || fileUsed + length + 32 > batchBytes) {
+            flush();
+        }
+
+        if (level != LogLevel::Info) {
+            consoleUsed += std::snprintf(consoleBatch + consoleUsed, batchBytes - consoleUsed, "%s: ", getLogLevelName(level));
+        }
+        std::memcpy(consoleBatch + consoleUsed, text, length);
+        consoleUsed += length;
+        consoleBatch[consoleUsed++] = '\n';
+
+        fileUsed += std::snprintf(fileBatch + fileUsed, batchBytes - fileUsed, "[%10.3f] %-7s ", seconds, getLogLevelName(level));
+        std::memcpy(fileBatch + fileUsed, text, length);
+        fileUsed += length;
+        fileBatch[fileUsed++] = '\n';
+    }
+
+    void flush() {
+        std::fwrite(consoleBatch, 1, consoleUsed, stdout);
+        std::fflush(stdout);
+        consoleUsed = 0;
+
+        if (FILE* target = file.load()) {
+            std::fwrite(fileBatch, 1, fileUsed, target);
+            std::fflush(target);
+        }
+        fileUsed = 0;
+    }
+};
+
+// The one logger, made on first use
+inline Logger& getLogger() {
+    static Logger logger;
+    return logger;
+}
+
+// Formats one line on the stack and hands it to the logger when it goes out of scope
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level(level) {}
+
+    ~LogLine() {
+        getLogger().push(level, text, length);
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(const char* value) {
+        append(value, std::strlen(value));
+        return *this;
+    }
+
+    LogLine& operator<<(char value) {
+        append(&value, 1);
+        return *this;
+    }
+
+    LogLine& operator<<(bool value) {
+        return *this << (value ? "1" : "0");
+    }
+
+    // Numbers print the way std::cout would by default
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, LogLine&>::type operator<<(T value) {
+        char number[32];
+        int written;
+        if (std::is_floating_point<T>::value) {
+            written = std::snprintf(number, sizeof(number), "%g", static_cast<double>(value));
+        }
+        else if (std::is_signed<T>::value) {
+            written = std::snprintf(number, sizeof(number), "%lld", static_cast<long long>(value));
+        }
+        else {
+            written = std::snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(value));
+        }
+        append(number, static_cast<size_t>(std::max(written, 0)));
+        return *this;
+    }
+
+private:
+    LogLevel level;
+    char text[Logger::maxLineLength];
+    size_t length = 0;
+
+    void append(const char* value, size_t count) {
+        count = std::min(count, Logger::maxLineLength - length);
+        std::memcpy(text + length, value, count);
+        length += count;
+    }
+};
+
+// LOG_INFO("Loaded " << count << " boxes"), the message isn't even formatted when the level is off
+#define LOG_AT(level, message)                     \
+    do {                                           \
+        if (getLogger().isEnabled(level)) {        \
+            LogLine(level) << message;             \
+        }                                          \
+    } while (0)
+
+#if LOG_DEBUG_ENABLED
+#define LOG_DEBUG(message) LOG_AT(LogLevel::Debug, message)
+#else
+#define LOG_DEBUG(message) ((void)0)
+#endif
+#define LOG_INFO(message) LOG_AT(LogLevel::Info, message)
+#define LOG_WARNING(message) LOG_AT(LogLevel::Warning, message)
+#define LOG_ERROR(message) LOG_AT(LogLevel::Error, message)
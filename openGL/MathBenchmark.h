@@ -0,0 +1,220 @@
+#pragma once
+
+#include "MathLib.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Times the MathLib versions of the camera math against the scalar code they
+// replaced, run with --bench-math
+
+namespace mathbench {
+
+    // Keeps the optimizer from throwing the results away
+    inline volatile float sink = 0.0f;
+
+    template <typename Function>
+    inline double nanosecondsPerOp(int iterations, Function function) {
+        // Warm up the caches and branch predictors first
+        for (int i = 0; i < iterations / 10; i++) {
+            function(i);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            function(i);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    }
+
+    // The scalar setPerspective without the GL call
+    inline void perspectiveScalar(float fov, float aspect, float zNear, float zFar, float* projection) {
+        float f = 1.0f / tan(fov * 3.14159265358979323846f / 360.0f);
+        float zDiff = zNear - zFar;
+
+        float values[16] = {
+            f / aspect, 0, 0, 0,
+            0, f, 0, 0,
+            0, 0, (zFar + zNear) / zDiff, -1,
+            0, 0, (2 * zFar * zNear) / zDiff, 0
+        };
+        for (int i = 0; i < 16; i++) {
+            projection[i] = values[i];
+        }
+    }
+
+    // The scalar lookAt without the GL call
+    inline void lookAtScalar(float eyeX, float eyeY, float eyeZ, float rotX, float rotY, float* matrix) {
+        float pitch = rotX * 3.14159265358979323846f / 180.0f;
+        float yaw = rotY * 3.14159265358979323846f / 180.0f;
+
+        float forwardX = cos(yaw) * cos(pitch);
+        float forwardY = sin(pitch);
+        float forwardZ = sin(yaw) * cos(pitch);
+
+        float forwardLength = sqrt(forwardX * forwardX + forwardY * forwardY + forwardZ * forwardZ);
+        forwardX /= forwardLength;
+        forwardY /= forwardLength;
+        forwardZ /= forwardLength;
+
+        float upX = 0.0f;
+        float upY = 1.0f;
+        float upZ = 0.0f;
+
+        float sideX = forwardY * upZ - forwardZ * upY;
+        float sideY = forwardZ * upX - forwardX * upZ;
+        float sideZ = forwardX * upY - forwardY * upX;
+
+        float sideLength = sqrt(sideX * sideX + sideY * sideY + sideZ * sideZ);
+        sideX /= sideLength;
+        sideY /= sideLength;
+        sideZ /= sideLength;
+
+        upX = sideY * forwardZ - sideZ * forwardY;
+        upY = sideZ * forwardX - sideX * forwardZ;
+        upZ = sideX * forwardY - sideY * forwardX;
+
+        for (int i = 0; i < 16; i++) {
+            matrix[i] = 0.0f;
+        }
+        matrix[0] = sideX;
+        matrix[4] = sideY;
+        matrix[8] = sideZ;
+        matrix[1] = upX;
+        matrix[5] = upY;
+        matrix[9] = upZ;
+        matrix[2] = -forwardX;
+        matrix[6] = -forwardY;
+        matrix[10] = -forwardZ;
+        matrix[12] = -(sideX * eyeX + sideY * eyeY + sideZ * eyeZ);
+        matrix[13] = -(upX * eyeX + upY * eyeY + upZ * eyeZ);
+        matrix[14] = forwardX * eyeX + forwardY * eyeY + forwardZ * eyeZ;
+        matrix[15] = 1.0f;
+    }
+
+    inline void report(const char* name, double scalar, double simd) {
+        std::printf("%-22s scalar %8.2f ns/op   simd %8.2f ns/op   %5.2fx\n", name, scalar, simd, scalar / simd);
+    }
+
+}
+
+inline void runMathBenchmark() {
+    using namespace mathbench;
+    const int iterations = 2000000;
+
+    std::printf("Math benchmark, %d iterations each\n", iterations);
+
+    // setPerspective
+    {
+        float scalarMatrix[16];
+        double scalar = nanosecondsPerOp(iterations, [&](int i) {
+            perspectiveScalar(45.0f + (i & 7), 1.0f, 0.1f, 1000.0f, scalarMatrix);
+            sink = sink + scalarMatrix[0];
+        });
+        double simd = nanosecondsPerOp(iterations, [&](int i) {
+            Mat4 m = perspective(45.0f + (i & 7), 1.0f, 0.1f, 1000.0f);
+            sink = sink + m.columns[0].x;
+        });
+        report("perspective", scalar, simd);
+    }
+
+    // lookAt
+    {
+        float scalarMatrix[16];
+        double scalar = nanosecondsPerOp(iterations, [&](int i) {
+            lookAtScalar(1.0f, 2.0f, 3.0f, static_cast<float>(i & 63), static_cast<float>(i & 255), scalarMatrix);
+            sink = sink + scalarMatrix[12];
+        });
+        double simd = nanosecondsPerOp(iterations, [&](int i) {
+            Vec4 forward = forwardFromAngles(toRadians(static_cast<float>(i & 63)), toRadians(static_cast<float>(i & 255)));
+            Mat4 m = lookAlong(makePoint(1.0f, 2.0f, 3.0f), forward);
+            sink = sink + m.columns[3].x;
+        });
+        report("lookAt", scalar, simd);
+    }
+
+    // One step of the picking ray march, the old code redid the trig every step
+    {
+        float cameraRot[2] = { 10.0f, 30.0f };
+        double scalar = nanosecondsPerOp(iterations, [&](int i) {
+            float distance = 5.0f + i * 0.005f;
+            float radianRotY = cameraRot[1] * (3.14159265358979323846f / 180.0f);
+            float radianRotX = cameraRot[0] * (3.14159265358979323846f / 180.0f);
+            float rayX = 1.0f + (distance * std::cos(radianRotX) * std::cos(radianRotY));
+            float rayY = 2.0f + (distance * std::sin(radianRotX));
+            float rayZ = 3.0f + (distance * std::cos(radianRotX) * std::sin(radianRotY));
+            sink = sink + rayX + rayY + rayZ;
+        });
+        Vec4 origin = makePoint(1.0f, 2.0f, 3.0f);
+        Vec4 direction = forwardFromAngles(toRadians(cameraRot[0]), toRadians(cameraRot[1]));
+        double simd = nanosecondsPerOp(iterations, [&](int i) {
+            Vec4 ray = origin + direction * (5.0f + i * 0.005f);
+            sink = sink + ray.x + ray.y + ray.z;
+        });
+        report("picking ray step", scalar, simd);
+    }
+
+    // Matrix multiply and inverse
+    {
+        Mat4 a = perspective(45.0f, 1.0f, 0.1f, 1000.0f);
+        Mat4 b = lookAlong(makePoint(1.0f, 2.0f, 3.0f), forwardFromAngles(0.3f, 1.2f));
+        double scalar = nanosecondsPerOp(iterations, [&](int i) {
+            float out[16];
+            for (int column = 0; column < 4; column++) {
+                for (int row = 0; row < 4; row++) {
+                    out[column * 4 + row] = a.data()[row] * b.data()[column * 4] + a.data()[4 + row] * b.data()[column * 4 + 1] +
+                        a.data()[8 + row] * b.data()[column * 4 + 2] + a.data()[12 + row] * b.data()[column * 4 + 3];
+                }
+            }
+            sink = sink + out[i & 15];
+        });
+        double simd = nanosecondsPerOp(iterations, [&](int i) {
+            Mat4 m = a * b;
+            sink = sink + m.data()[i & 15];
+        });
+        report("mat4 multiply", scalar, simd);
+
+        Mat4 viewProjection = a * b;
+        scalar = nanosecondsPerOp(iterations, [&](int i) {
+            Mat4 m = inverseScalar(viewProjection);
+            sink = sink + m.data()[i & 15];
+        });
+        simd = nanosecondsPerOp(iterations, [&](int i) {
+            Mat4 m = inverse(viewProjection);
+            sink = sink + m.data()[i & 15];
+        });
+        report("mat4 inverse", scalar, simd);
+    }
+
+    // Batch transform of a point array
+    {
+        const size_t count = 4096;
+        std::vector<Vec4> points(count);
+        std::vector<Vec4> transformed(count);
+        for (size_t i = 0; i < count; i++) {
+            points[i] = makePoint(static_cast<float>(i), static_cast<float>(i % 7), static_cast<float>(i % 13));
+        }
+        Mat4 m = perspective(45.0f, 1.0f, 0.1f, 1000.0f) * lookAlong(makePoint(1.0f, 2.0f, 3.0f), forwardFromAngles(0.3f, 1.2f));
+        const float* values = m.data();
+
+        int batches = iterations / static_cast<int>(count) * 16;
+        double scalar = nanosecondsPerOp(batches, [&](int i) {
+            for (size_t p = 0; p < count; p++) {
+                const Vec4& in = points[p];
+                Vec4& out = transformed[p];
+                for (int row = 0; row < 4; row++) {
+                    out[row] = values[row] * in.x + values[4 + row] * in.y + values[8 + row] * in.z + values[12 + row] * in.w;
+                }
+            }
+            sink = sink + transformed[i & 1023].x;
+        }) / count;
+        double simd = nanosecondsPerOp(batches, [&](int i) {
+            transformPoints(m, points.data(), transformed.data(), count);
+            sink = sink + transformed[i & 1023].x;
+        }) / count;
+        report("transform per point", scalar, simd);
+    }
+}
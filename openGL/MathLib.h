@@ -0,0 +1,436 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+// Small vector, matrix and quaternion library
+//
+// Vec4 and Mat4 are 16 byte aligned so they load straight into SSE or NEON
+// registers, builds without either fall back to plain floats. Matrices are
+// column major like OpenGL, so data() can go straight to glLoadMatrixf
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATHLIB_SSE 1
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MATHLIB_NEON 1
+#include <arm_neon.h>
+#endif
+
+const float mathPi = 3.14159265358979323846f;
+
+inline float toRadians(float degrees) {
+    return degrees * (mathPi / 180.0f);
+}
+
+struct alignas(16) Vec4 {
+    float x, y, z, w;
+
+    Vec4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+    Vec4(float x, float y, float z, float w = 0.0f) : x(x), y(y), z(z), w(w) {}
+
+    float& operator[](int i) { return (&x)[i]; }
+    float operator[](int i) const { return (&x)[i]; }
+};
+
+// Points have w = 1 so translations apply to them
+inline Vec4 makePoint(float x, float y, float z) {
+    return Vec4(x, y, z, 1.0f);
+}
+
+#if MATHLIB_SSE
+inline __m128 load(const Vec4& v) { return _mm_load_ps(&v.x); }
+inline Vec4 store(__m128 m) { Vec4 v; _mm_store_ps(&v.x, m); return v; }
+#elif MATHLIB_NEON
+inline float32x4_t load(const Vec4& v) { return vld1q_f32(&v.x); }
+inline Vec4 store(float32x4_t m) { Vec4 v; vst1q_f32(&v.x, m); return v; }
+#endif
+
+inline Vec4 operator+(const Vec4& a, const Vec4& b) {
+#if MATHLIB_SSE
+    return store(_mm_add_ps(load(a), load(b)));
+#elif MATHLIB_NEON
+    return store(vaddq_f32(load(a), load(b)));
+#else
+    return Vec4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+#endif
+}
+
+inline Vec4 operator-(const Vec4& a, const Vec4& b) {
+#if MATHLIB_SSE
+    return store(_mm_sub_ps(load(a), load(b)));
+#elif MATHLIB_NEON
+    return store(vsubq_f32(load(a), load(b)));
+#else
+    return Vec4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w);
+#endif
+}
+
+inline Vec4 operator*(const Vec4& a, const Vec4& b) {
+#if MATHLIB_SSE
+    return store(_mm_mul_ps(load(a), load(b)));
+#elif MATHLIB_NEON
+    return store(vmulq_f32(load(a), load(b)));
+#else
+    return Vec4(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w);
+#endif
+}
+
+inline Vec4 operator*(const Vec4& a, float s) {
+#if MATHLIB_SSE
+    return store(_mm_mul_ps(load(a), _mm_set1_ps(s)));
+#elif MATHLIB_NEON
+    return store(vmulq_n_f32(load(a), s));
+#else
+    return Vec4(a.x * s, a.y * s, a.z * s, a.w * s);
+#endif
+}
+
+inline Vec4& operator+=(Vec4& a, const Vec4& b) { return a = a + b; }
+inline Vec4& operator-=(Vec4& a, const Vec4& b) { return a = a - b; }
+inline Vec4& operator*=(Vec4& a, float s) { return a = a * s; }
+inline Vec4 operator-(const Vec4& a) { return a * -1.0f; }
+
+inline float dot3(const Vec4& a, const Vec4& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline float dot4(const Vec4& a, const Vec4& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+inline Vec4 cross3(const Vec4& a, const Vec4& b) {
+#if MATHLIB_SSE
+    __m128 va = load(a);
+    __m128 vb = load(b);
+    __m128 aYzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(va, bYzx), _mm_mul_ps(aYzx, vb));
+    return store(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+#else
+    return Vec4(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x, 0.0f);
+#endif
+}
+
+inline float length3(const Vec4& a) {
+    return std::sqrt(dot3(a, a));
+}
+
+// Reciprocal square root estimate refined with one Newton step, about 22 bits
+inline float fastInverseSqrt(float value) {
+#if MATHLIB_SSE
+    __m128 v = _mm_set_ss(value);
+    __m128 estimate = _mm_rsqrt_ss(v);
+    __m128 half = _mm_mul_ss(_mm_set_ss(0.5f), v);
+    __m128 refined = _mm_mul_ss(estimate, _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(half, _mm_mul_ss(estimate, estimate))));
+    return _mm_cvtss_f32(refined);
+#elif MATHLIB_NEON
+    float32x2_t v = vdup_n_f32(value);
+    float32x2_t estimate = vrsqrte_f32(v);
+    estimate = vmul_f32(estimate, vrsqrts_f32(vmul_f32(v, estimate), estimate));
+    return vget_lane_f32(estimate, 0);
+#else
+    return 1.0f / std::sqrt(value);
+#endif
+}
+
+// xyz scaled to length 1, w is kept
+inline Vec4 normalize3(const Vec4& a) {
+    float lengthSquared = dot3(a, a);
+    if (lengthSquared <= 0.0f) {
+        return a;
+    }
+    float scale = fastInverseSqrt(lengthSquared);
+    return Vec4(a.x * scale, a.y * scale, a.z * scale, a.w);
+}
+
+struct alignas(16) Mat4 {
+    Vec4 columns[4];
+
+    float* data() { return &columns[0].x; }
+    const float* data() const { return &columns[0].x; }
+
+    static Mat4 identity() {
+        Mat4 m;
+        m.columns[0] = Vec4(1.0f, 0.0f, 0.0f, 0.0f);
+        m.columns[1] = Vec4(0.0f, 1.0f, 0.0f, 0.0f);
+        m.columns[2] = Vec4(0.0f, 0.0f, 1.0f, 0.0f);
+        m.columns[3] = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return m;
+    }
+
+    static Mat4 fromArray(const float* values) {
+        Mat4 m;
+        for (int i = 0; i < 16; i++) {
+            m.data()[i] = values[i];
+        }
+        return m;
+    }
+};
+
+inline Vec4 operator*(const Mat4& m, const Vec4& v) {
+#if MATHLIB_SSE
+    __m128 r = _mm_mul_ps(load(m.columns[0]), _mm_set1_ps(v.x));
+    r = _mm_add_ps(r, _mm_mul_ps(load(m.columns[1]), _mm_set1_ps(v.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(load(m.columns[2]), _mm_set1_ps(v.z)));
+    r = _mm_add_ps(r, _mm_mul_ps(load(m.columns[3]), _mm_set1_ps(v.w)));
+    return store(r);
+#elif MATHLIB_NEON
+    float32x4_t r = vmulq_n_f32(load(m.columns[0]), v.x);
+    r = vmlaq_n_f32(r, load(m.columns[1]), v.y);
+    r = vmlaq_n_f32(r, load(m.columns[2]), v.z);
+    r = vmlaq_n_f32(r, load(m.columns[3]), v.w);
+    return store(r);
+#else
+    return m.columns[0] * v.x + m.columns[1] * v.y + m.columns[2] * v.z + m.columns[3] * v.w;
+#endif
+}
+
+inline Mat4 operator*(const Mat4& a, const Mat4& b) {
+    Mat4 r;
+    for (int i = 0; i < 4; i++) {
+        r.columns[i] = a * b.columns[i];
+    }
+    return r;
+}
+
+inline Mat4 transpose(const Mat4& m) {
+#if MATHLIB_SSE
+    __m128 c0 = load(m.columns[0]);
+    __m128 c1 = load(m.columns[1]);
+    __m128 c2 = load(m.columns[2]);
+    __m128 c3 = load(m.columns[3]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    Mat4 r;
+    r.columns[0] = store(c0);
+    r.columns[1] = store(c1);
+    r.columns[2] = store(c2);
+    r.columns[3] = store(c3);
+    return r;
+#else
+    Mat4 r;
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            r.columns[column][row] = m.columns[row][column];
+        }
+    }
+    return r;
+#endif
+}
+
+// Inverse of a rotation plus translation, like a view matrix, much cheaper than the general one
+inline Mat4 affineInverse(const Mat4& m) {
+    Mat4 r = m;
+    r.columns[3] = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    r = transpose(r);
+    Vec4 translation = r * Vec4(m.columns[3].x, m.columns[3].y, m.columns[3].z, 0.0f);
+    r.columns[3] = Vec4(-translation.x, -translation.y, -translation.z, 1.0f);
+    return r;
+}
+
+// Plain cofactor inverse, the reference for the SIMD version
+inline Mat4 inverseScalar(const Mat4& matrix) {
+    const float* m = matrix.data();
+    float inv[16];
+
+    inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    float determinant = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+    float scale = determinant != 0.0f ? 1.0f / determinant : 0.0f;
+
+    Mat4 r;
+    for (int i = 0; i < 16; i++) {
+        r.data()[i] = inv[i] * scale;
+    }
+    return r;
+}
+
+// General inverse, singular matrices give garbage
+inline Mat4 inverse(const Mat4& m) {
+#if MATHLIB_SSE
+    // Block inverse on the four 2x2 sub matrices
+    //     | A B |             1     | X Y |
+    // M = | C D |   inv(M) = ---  * | Z W |
+    //                        |M|
+    // each 2x2 block is held in one register as (m00, m01, m10, m11)
+    __m128 c0 = load(m.columns[0]);
+    __m128 c1 = load(m.columns[1]);
+    __m128 c2 = load(m.columns[2]);
+    __m128 c3 = load(m.columns[3]);
+
+    __m128 a = _mm_movelh_ps(c0, c1);
+    __m128 b = _mm_movehl_ps(c1, c0);
+    __m128 c = _mm_movelh_ps(c2, c3);
+    __m128 d = _mm_movehl_ps(c3, c2);
+
+    // Determinants of A, B, C and D
+    __m128 detSub = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(c0, c2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(c1, c3, _MM_SHUFFLE(3, 1, 3, 1))),
+        _mm_mul_ps(_mm_shuffle_ps(c0, c2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(c1, c3, _MM_SHUFFLE(2, 0, 2, 0))));
+    __m128 detA = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 detB = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 detC = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 detD = _mm_shuffle_ps(detSub, detSub, _MM_SHUFFLE(3, 3, 3, 3));
+
+    // 2x2 helpers, # is the adjugate
+    auto mul2 = [](__m128 x, __m128 y) {
+        return _mm_add_ps(_mm_mul_ps(x, _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 0, 3, 0))),
+            _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 2, 1, 2))));
+    };
+    auto adjMul2 = [](__m128 x, __m128 y) { // x# * y
+        return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 3, 3)), y),
+            _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 1, 1)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 0, 3, 2))));
+    };
+    auto mulAdj2 = [](__m128 x, __m128 y) { // x * y#
+        return _mm_sub_ps(_mm_mul_ps(x, _mm_shuffle_ps(y, y, _MM_SHUFFLE(0, 3, 0, 3))),
+            _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 2, 1, 2))));
+    };
+
+    __m128 dC = adjMul2(d, c);
+    __m128 aB = adjMul2(a, b);
+    __m128 x = _mm_sub_ps(_mm_mul_ps(detD, a), mul2(b, dC));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(detA, d), mul2(c, aB));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(detB, c), mulAdj2(d, aB));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(detC, b), mulAdj2(a, dC));
+
+    // |M| = |A||D| + |B||C| - tr(A#B D#C)
+    __m128 trace = _mm_mul_ps(aB, _mm_shuffle_ps(dC, dC, _MM_SHUFFLE(3, 1, 2, 0)));
+    trace = _mm_add_ps(trace, _mm_movehl_ps(trace, trace));
+    trace = _mm_add_ss(trace, _mm_shuffle_ps(trace, trace, _MM_SHUFFLE(1, 1, 1, 1)));
+    trace = _mm_shuffle_ps(trace, trace, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 determinant = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), trace);
+
+    __m128 scale = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), determinant);
+    x = _mm_mul_ps(x, scale);
+    y = _mm_mul_ps(y, scale);
+    z = _mm_mul_ps(z, scale);
+    w = _mm_mul_ps(w, scale);
+
+    // Adjugate of each block while writing the columns back
+    Mat4 r;
+    r.columns[0] = store(_mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)));
+    r.columns[1] = store(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)));
+    r.columns[2] = store(_mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)));
+    r.columns[3] = store(_mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2)));
+    return r;
+#else
+    return inverseScalar(m);
+#endif
+}
+
+// Transforms count points in one go, in and out may be the same array
+inline void transformPoints(const Mat4& m, const Vec4* in, Vec4* out, size_t count) {
+#if MATHLIB_SSE
+    __m128 c0 = load(m.columns[0]);
+    __m128 c1 = load(m.columns[1]);
+    __m128 c2 = load(m.columns[2]);
+    __m128 c3 = load(m.columns[3]);
+    for (size_t i = 0; i < count; i++) {
+        __m128 p = load(in[i]);
+        __m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm_store_ps(&out[i].x, r);
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        out[i] = m * in[i];
+    }
+#endif
+}
+
+// OpenGL style perspective projection, fov is vertical and in degrees
+inline Mat4 perspective(float fov, float aspect, float zNear, float zFar) {
+    float f = 1.0f / std::tan(toRadians(fov) * 0.5f);
+    float zDiff = zNear - zFar;
+
+    Mat4 m;
+    m.columns[0] = Vec4(f / aspect, 0.0f, 0.0f, 0.0f);
+    m.columns[1] = Vec4(0.0f, f, 0.0f, 0.0f);
+    m.columns[2] = Vec4(0.0f, 0.0f, (zFar + zNear) / zDiff, -1.0f);
+    m.columns[3] = Vec4(0.0f, 0.0f, (2.0f * zFar * zNear) / zDiff, 0.0f);
+    return m;
+}
+
+// View matrix from an eye position and a unit forward vector, up is world Y
+inline Mat4 lookAlong(const Vec4& eye, const Vec4& forward) {
+    Vec4 side = normalize3(cross3(forward, Vec4(0.0f, 1.0f, 0.0f)));
+    Vec4 up = cross3(side, forward);
+
+    Mat4 m;
+    m.columns[0] = Vec4(side.x, up.x, -forward.x, 0.0f);
+    m.columns[1] = Vec4(side.y, up.y, -forward.y, 0.0f);
+    m.columns[2] = Vec4(side.z, up.z, -forward.z, 0.0f);
+    m.columns[3] = Vec4(-dot3(side, eye), -dot3(up, eye), dot3(forward, eye), 1.0f);
+    return m;
+}
+
+// Forward vector for the engine's angles, yaw 0 looks down +X, pitch is up and down
+inline Vec4 forwardFromAngles(float pitch, float yaw) {
+    float cosPitch = std::cos(pitch);
+    return Vec4(std::cos(yaw) * cosPitch, std::sin(pitch), std::sin(yaw) * cosPitch, 0.0f);
+}
+
+struct alignas(16) Quat {
+    float x, y, z, w;
+
+    Quat() : x(0.0f), y(0.0f), z(0.0f), w(1.0f) {}
+    Quat(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+    // angle in radians around a unit axis
+    static Quat fromAxisAngle(const Vec4& axis, float angle) {
+        float s = std::sin(angle * 0.5f);
+        return Quat(axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f));
+    }
+};
+
+inline Quat operator*(const Quat& a, const Quat& b) {
+    return Quat(
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+inline Quat normalize(const Quat& q) {
+    float scale = fastInverseSqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    return Quat(q.x * scale, q.y * scale, q.z * scale, q.w * scale);
+}
+
+// Rotates the xyz of v, w is kept
+inline Vec4 rotate(const Quat& q, const Vec4& v) {
+    Vec4 axis(q.x, q.y, q.z, 0.0f);
+    Vec4 t = cross3(axis, v) * 2.0f;
+    Vec4 r = v + t * q.w + cross3(axis, t);
+    r.w = v.w;
+    return r;
+}
+
+inline Mat4 toMatrix(const Quat& q) {
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    Mat4 m;
+    m.columns[0] = Vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f);
+    m.columns[1] = Vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f);
+    m.columns[2] = Vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f);
+    m.columns[3] = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    return m;
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+// Heap allocation counts, main.cpp replaces operator new to bump them
+namespace memory {
+
+    inline std::atomic<uint64_t> heapAllocations{ 0 };
+    inline std::atomic<uint64_t> heapBytes{ 0 };
+    inline std::atomic<int64_t> liveBytes{ 0 };
+
+    inline void countAllocation(size_t size) {
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+        heapBytes.fetch_add(size, std::memory_order_relaxed);
+        liveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    }
+
+    inline void countFree(size_t size) {
+        liveBytes.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+    }
+
+    // What malloc really set aside for a block, at least what was asked for
+    inline size_t getBlockSize(void* block) {
+#if defined(_WIN32)
+        return _msize(block);
+#elif defined(__APPLE__)
+        return malloc_size(block);
+#else
+        return malloc_usable_size(block);
+#endif
+    }
+
+    inline uint64_t getAllocationCount() {
+        return heapAllocations.load(std::memory_order_relaxed);
+    }
+
+    // Bytes allocated through operator new and not freed yet
+    inline int64_t getLiveBytes() {
+        return liveBytes.load(std::memory_order_relaxed);
+    }
+
+}
+
+// Bump allocator for data that only lives for one frame
+//
+// Allocating moves a pointer along a block and reset at the start of the
+// next frame takes it back to the start, nothing is freed one by one. A
+// frame that needs more than the block gets overflow blocks, and the next
+// reset replaces them with one block big enough for that frame, so after
+// the first few frames it stops touching the heap at all. Blocks come from
+// operator new, so a frame that grows the arena shows in the allocation
+// counts like any other. Destructors aren't run, only trivially
+// destructible things belong in it. The lists rebuilt every frame, like the
+// render queue's items, the visible draws and the collision candidates,
+// don't come from here, they keep their capacity from frame to frame
+// instead and stop allocating just the same
+class FrameArena {
+public:
+    explicit FrameArena(size_t blockSize = 256 * 1024) {
+        grow(blockSize);
+    }
+
+    ~FrameArena() {
+        for (Block& block : blocks) {
+            ::operator delete(block.memory);
+        }
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        Block* block = &blocks.back();
+        size_t start = (block->used + alignment - 1) & ~(alignment - 1);
+        if (start + size > block->size) {
+            grow(std::max(size + alignment, block->size * 2));
+            block = &blocks.back();
+            start = (block->used + alignment - 1) & ~(alignment - 1);
+        }
+        block->used = start + size;
+        used += size;
+        return block->memory + start;
+    }
+
+    // Uninitialized room for count values
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    template <typename T, typename... Arguments>
+    T* create(Arguments&&... arguments) {
+        return new (allocate(sizeof(T), alignof(T))) T{ std::forward<Arguments>(arguments)... };
+    }
+
+    // Everything allocated since the last reset is gone
+    void reset() {
+        peak = std::max(peak, used);
+        if (blocks.size() > 1) {
+            size_t total = 0;
+            for (Block& block : blocks) {
+                total += block.size;
+                ::operator delete(block.memory);
+            }
+            blocks.clear();
+            grow(total);
+        }
+        blocks.back().used = 0;
+        used = 0;
+    }
+
+    size_t getUsed() const {
+        return used;
+    }
+
+    // Most used in one frame so far
+    size_t getPeak() const {
+        return std::max(peak, used);
+    }
+
+    size_t getCapacity() const {
+        size_t total = 0;
+        for (const Block& block : blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        char* memory;
+        size_t size;
+        size_t used;
+    };
+
+    std::vector<Block> blocks;
+    size_t used = 0;
+    size_t peak = 0;
+
+    void grow(size_t size) {
+        char* memory = static_cast<char*>(::operator new(size));
+        blocks.push_back({ memory, size, 0 });
+    }
+};
+
+// Free list of same sized slots carved from big blocks, shared by every
+// PoolAllocator of the same type. Slots go back on the list and blocks are
+// kept, so a container that grows and shrinks stops allocating once it's
+// been at its biggest. Not thread safe, meant for the main thread's lists
+template <size_t SlotSize, size_t SlotAlignment>
+class SlotPool {
+public:
+    // Never destroyed, global containers hand their nodes back after statics are torn down
+    static SlotPool& get() {
+        static SlotPool* pool = new SlotPool();
+        return *pool;
+    }
+
+    void* allocate() {
+        if (!freeSlots) {
+            grow();
+        }
+        Slot* slot = freeSlots;
+        freeSlots = slot->next;
+        return slot;
+    }
+
+    void deallocate(void* pointer) {
+        Slot* slot = static_cast<Slot*>(pointer);
+        slot->next = freeSlots;
+        freeSlots = slot;
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(SlotAlignment) unsigned char storage[SlotSize];
+    };
+
+    static const size_t slotsPerBlock = 256;
+    Slot* freeSlots = nullptr;
+    std::vector<Slot*> blocks;
+
+    SlotPool() = default;
+
+    void grow() {
+        Slot* block = new Slot[slotsPerBlock];
+        blocks.push_back(block);
+        for (size_t i = 0; i < slotsPerBlock; i++) {
+            block[i].next = freeSlots;
+            freeSlots = &block[i];
+        }
+    }
+};
+
+// Allocator for node containers like std::list, single nodes come from a
+// SlotPool and anything bigger goes to the heap as usual
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        if (count != 1) {
+            return static_cast<T*>(::operator new(sizeof(T) * count));
+        }
+        return static_cast<T*>(SlotPool<sizeof(T), alignof(T)>::get().allocate());
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        if (count != 1) {
+            ::operator delete(pointer);
+            return;
+        }
+        SlotPool<sizeof(T), alignof(T)>::get().deallocate(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const {
+        return false;
+    }
+};
+
+// Heap allocations made during each frame, from the counts operator new keeps
+class FrameAllocationStats {
+public:
+    void beginFrame() {
+        frameStart = memory::getAllocationCount();
+    }
+
+    void endFrame() {
+        lastFrame = memory::getAllocationCount() - frameStart;
+        frames++;
+        total += lastFrame;
+        maxFrame = std::max(maxFrame, lastFrame);
+        if (lastFrame > 0) {
+            allocatingFrames++;
+        }
+    }
+
+    uint64_t getLastFrame() const {
+        return lastFrame;
+    }
+
+    uint64_t getMaxFrame() const {
+        return maxFrame;
+    }
+
+    uint64_t getFrameCount() const {
+        return frames;
+    }
+
+    // Frames that allocated anything at all, the goal is to stay at the warm up frames
+    uint64_t getAllocatingFrameCount() const {
+        return allocatingFrames;
+    }
+
+    double getAverage() const {
+        return frames ? static_cast<double>(total) / frames : 0.0;
+    }
+
+private:
+    uint64_t frameStart = 0;
+    uint64_t lastFrame = 0;
+    uint64_t maxFrame = 0;
+    uint64_t total = 0;
+    uint64_t frames = 0;
+    uint64_t allocatingFrames = 0;
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <array>
+#include <cstdint>
+
+class SoftwareRasterizer;
+
+// Id a mesh keeps for its whole life, 0 is no mesh
+using MeshHandle = uint32_t;
+const MeshHandle noMeshHandle = 0;
+
+// Mesh class
+class Mesh {
+public:
+    std::array<float, 3> location;
+    std::array<float, 3> size;
+    std::array<float, 3> color; // Add color attribute (RGB format)
+    MeshHandle handle;
+    bool dynamic; // Moved by the physics, static meshes only get pushed against
+
+    Mesh(std::array<float, 3> loc, std::array<float, 3> sz, std::array<float, 3> col, bool isDynamic = false) : location(loc), size(sz), color(col), handle(nextHandle()), dynamic(isDynamic) {}
+
+    void draw() const {
+        float x = location[0];
+        float y = location[1];
+        float z = location[2];
+        float width = size[0];
+        float height = size[1];
+        float depth = size[2];
+        float r = color[0] / 255;
+        float g = color[1] / 255;
+        float b = color[2] / 255;
+
+        glColor3f(r, g, b); // Set the color for the mesh
+
+        glBegin(GL_QUADS);
+
+        // Front face
+        glVertex3f(x, y, z);
+        glVertex3f(x + width, y, z);
+        glVertex3f(x + width, y + height, z);
+        glVertex3f(x, y + height, z);
+
+        // Back face
+        glVertex3f(x, y, z + depth);
+        glVertex3f(x + width, y, z + depth);
+        glVertex3f(x + width, y + height, z + depth);
+        glVertex3f(x, y + height, z + depth);
+
+        // Top face
+        glVertex3f(x, y + height, z);
+        glVertex3f(x + width, y + height, z);
+        glVertex3f(x + width, y + height, z + depth);
+        glVertex3f(x, y + height, z + depth);
+
+        // Bottom face
+        glVertex3f(x, y, z);
+        glVertex3f(x + width, y, z);
+        glVertex3f(x + width, y, z + depth);
+        glVertex3f(x, y, z + depth);
+
+        // Right face
+        glVertex3f(x + width, y, z);
+        glVertex3f(x + width, y + height, z);
+        glVertex3f(x + width, y + height, z + depth);
+        glVertex3f(x + width, y, z + depth);
+
+        // Left face
+        glVertex3f(x, y, z);
+        glVertex3f(x, y + height, z);
+        glVertex3f(x, y + height, z + depth);
+        glVertex3f(x, y, z + depth);
+
+        glEnd();
+    }
+
+    // Draws into the CPU renderer instead of GL, defined in SoftwareRasterizer.h
+    void draw(SoftwareRasterizer& target) const;
+
+private:
+    static MeshHandle nextHandle() {
+        static MeshHandle lastHandle = noMeshHandle;
+        return ++lastHandle;
+    }
+};
@@ -0,0 +1,359 @@
+#pragma once
+
+#include "Camera.h"
+#include "Collision.h"
+#include "FrustumCulling.h"
+#include "MathLib.h"
+#include "Memory.h"
+#include "Mesh.h"
+#include "OverlayRenderer.h"
+#include "Picking.h"
+#include "RenderQueue.h"
+#include "SceneGenerator.h"
+#include "SpatialGrid.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+// Small repeatable timings of the engine's per frame hot paths, run with
+// --bench-micro [results.json] [baseline.json]
+//
+// Each benchmark is a batch of ops. The batch size is grown until a batch
+// takes a few tens of milliseconds, then the batch is run several times and
+// the median is reported, which shrugs off the odd preemption. Inputs come
+// from fixed tables and a seeded scene, so two runs do exactly the same work.
+// Allocations are counted by the replaced operator new in main.cpp. Given a
+// baseline file from an earlier run, anything whose fastest run is more than
+// 10% slower is flagged and the exit code is 1, so a script can catch
+// regressions. The fastest run moves far less between runs than the median
+
+namespace microbench {
+
+    // Keeps the optimizer from throwing the results away
+    inline volatile uint64_t sink = 0;
+
+    struct Result {
+        std::string name;
+        double nanosecondsPerOp;        // median of the runs
+        double fastestNanosecondsPerOp;
+        double allocationsPerOp;
+        uint64_t opsPerRun;
+    };
+
+    const int runCount = 7;
+    const double batchSeconds = 0.05;
+    const double regressionThreshold = 0.10;
+
+    inline double secondsSince(std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // batch(count) does count ops, the op index is the batch's to keep track of
+    template <typename Batch>
+    inline Result measure(const char* name, Batch batch) {
+        // Double the count until a batch is long enough for the clock, which also warms everything up
+        uint64_t count = 1;
+        double seconds = 0.0;
+        while (count < (uint64_t(1) << 32)) {
+            auto start = std::chrono::high_resolution_clock::now();
+            batch(count);
+            seconds = secondsSince(start);
+            if (seconds >= batchSeconds * 0.25) {
+                break;
+            }
+            count *= 2;
+        }
+        count = std::max<uint64_t>(1, static_cast<uint64_t>(count * (batchSeconds / std::max(seconds, 1e-9))));
+
+        double perOp[runCount];
+        uint64_t allocations = 0;
+        for (int run = 0; run < runCount; run++) {
+            uint64_t allocationsBefore = memory::getAllocationCount();
+            auto start = std::chrono::high_resolution_clock::now();
+            batch(count);
+            perOp[run] = secondsSince(start) * 1e9 / count;
+            allocations += memory::getAllocationCount() - allocationsBefore;
+        }
+        std::sort(perOp, perOp + runCount);
+
+        Result result = { name, perOp[runCount / 2], perOp[0], static_cast<double>(allocations) / (static_cast<double>(count) * runCount), count };
+        std::printf("%-24s %12.2f %12.2f %12.3f %12llu\n", name, result.nanosecondsPerOp, result.fastestNanosecondsPerOp, result.allocationsPerOp,
+            static_cast<unsigned long long>(count));
+        return result;
+    }
+
+    // fopen is a C4996 error under /sdl, so MSVC gets fopen_s
+    inline FILE* openFile(const char* path, const char* mode) {
+        FILE* file = nullptr;
+#ifdef _MSC_VER
+        if (fopen_s(&file, path, mode) != 0) {
+            file = nullptr;
+        }
+#else
+        file = std::fopen(path, mode);
+#endif
+        return file;
+    }
+
+    inline bool writeJson(const char* path, const std::vector<Result>& results, size_t boxCount) {
+        FILE* file = openFile(path, "w");
+        if (!file) {
+            std::printf("Couldn't write %s\n", path);
+            return false;
+        }
+        std::fprintf(file, "{\n  \"benchmark\": \"micro\",\n  \"scene\": { \"type\": \"city\", \"boxes\": %zu, \"seed\": 1 },\n", boxCount);
+        std::fprintf(file, "  \"simd\": %s,\n  \"results\": [\n", MATHLIB_SSE ? "true" : "false");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            std::fprintf(file, "    { \"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"allocs_per_op\": %.4f, \"ops\": %llu }%s\n",
+                result.name.c_str(), result.nanosecondsPerOp, result.fastestNanosecondsPerOp, result.allocationsPerOp,
+                static_cast<unsigned long long>(result.opsPerRun), i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(file, "  ]\n}\n");
+        std::fclose(file);
+        return true;
+    }
+
+    // Reads min_ns_per_op for a benchmark out of a file writeJson made, false if it isn't there
+    inline bool findBaseline(const std::string& json, const std::string& name, double& nanosecondsPerOp) {
+        const char* field = "\"min_ns_per_op\":";
+        size_t at = json.find("\"name\": \"" + name + "\"");
+        if (at == std::string::npos) {
+            return false;
+        }
+        at = json.find(field, at);
+        if (at == std::string::npos) {
+            return false;
+        }
+        nanosecondsPerOp = std::strtod(json.c_str() + at + std::strlen(field), nullptr);
+        return nanosecondsPerOp > 0.0;
+    }
+
+    // False if anything got slower than the baseline by more than the threshold
+    inline bool compareBaseline(const char* path, const std::vector<Result>& results) {
+        FILE* file = openFile(path, "rb");
+        if (!file) {
+            std::printf("Couldn't read baseline %s\n", path);
+            return false;
+        }
+        std::string json;
+        char buffer[4096];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            json.append(buffer, read);
+        }
+        std::fclose(file);
+
+        std::printf("\nAgainst %s\n", path);
+        bool passed = true;
+        for (const Result& result : results) {
+            double baseline;
+            if (!findBaseline(json, result.name, baseline)) {
+                std::printf("%-24s %12s\n", result.name.c_str(), "new");
+                continue;
+            }
+            double change = result.fastestNanosecondsPerOp / baseline - 1.0;
+            bool regressed = change > regressionThreshold;
+            passed = passed && !regressed;
+            std::printf("%-24s %+11.1f%% %s\n", result.name.c_str(), change * 100.0, regressed ? "REGRESSION" : "");
+        }
+        return passed;
+    }
+
+}
+
+// Returns false only when a baseline was given and something regressed
+inline bool runMicroBenchmark(const char* jsonPath, const char* baselinePath) {
+    using namespace microbench;
+    const size_t boxCount = 10000;
+    const int viewportSide = 1080;
+
+    std::list<Mesh> meshes;
+    SceneBounds bounds = generateScene(SceneType::City, boxCount, 1, meshes);
+    SpatialGrid grid;
+    grid.build(meshes);
+    Camera camera;
+    placeCamera(camera, bounds, 45.0f, 1.0f);
+
+    // Cursor rays and camera angles the ops cycle through
+    const size_t tableSize = 1024;
+    std::vector<Ray> cursorRays;
+    std::vector<float> angles;
+    scenegen::Random random(1);
+    for (size_t i = 0; i < tableSize; i++) {
+        float x = random.uniform(0.0f, static_cast<float>(viewportSide));
+        float y = random.uniform(0.0f, static_cast<float>(viewportSide));
+        cursorRays.push_back(screenRay(camera.getInverseViewProjection(), x, y, static_cast<float>(viewportSide), static_cast<float>(viewportSide)));
+        angles.push_back(random.uniform(-60.0f, 60.0f));
+    }
+
+    std::printf("Micro benchmarks, %zu box city scene, median of %d runs\n", meshes.size(), runCount);
+    std::printf("%-24s %12s %12s %12s %12s\n", "benchmark", "ns/op", "fastest", "allocs/op", "ops/run");
+    std::vector<Result> results;
+
+    // Mesh::draw needs a context, an invisible window gives one where there's a GPU
+    GLFWwindow* window = nullptr;
+    if (glfwInit()) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(64, 64, "bench", NULL, NULL);
+    }
+    if (window) {
+        glfwMakeContextCurrent(window);
+        glMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(camera.getProjection().data());
+        glMatrixMode(GL_MODELVIEW);
+        glLoadMatrixf(camera.getView().data());
+
+        // The driver finishing the batch is in the time, so queued up work can't pile into the next run
+        results.push_back(measure("mesh_draw", [&](uint64_t count) {
+            auto it = meshes.begin();
+            for (uint64_t i = 0; i < count; i++) {
+                it->draw();
+                if (++it == meshes.end()) {
+                    it = meshes.begin();
+                }
+            }
+            glFinish();
+        }));
+        glfwDestroyWindow(window);
+    }
+    else {
+        std::printf("%-24s %12s\n", "mesh_draw", "skipped, no GL context");
+    }
+    glfwTerminate();
+
+    // What the one by one draw path queues per mesh, sorted once per scene's worth
+    RenderQueue queue;
+    const Vec4& eye = camera.getPosition();
+    results.push_back(measure("render_queue_submit", [&](uint64_t count) {
+        auto it = meshes.begin();
+        for (uint64_t i = 0; i < count; i++) {
+            float dx = it->location[0] + it->size[0] * 0.5f - eye.x;
+            float dy = it->location[1] + it->size[1] * 0.5f - eye.y;
+            float dz = it->location[2] + it->size[2] * 0.5f - eye.z;
+            queue.submit(PassOpaque, 0, 0, dx * dx + dy * dy + dz * dz, nullptr, &*it);
+            if (++it == meshes.end()) {
+                queue.sort();
+                queue.clear();
+                it = meshes.begin();
+            }
+        }
+        queue.clear();
+    }));
+
+    // The left click pick in mouseButtonCallback: cursor ray through the grid, then the handle lookup
+    const float pickMinDistance = 5.0f;
+    const float pickMaxDistance = 505.0f;
+    results.push_back(measure("pick_click", [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            MeshHandle handle = grid.intersect(cursorRays[i % tableSize], pickMinDistance, pickMaxDistance).handle;
+            sink = sink + (grid.find(handle) ? 1 : 0);
+        }
+    }));
+
+    // lookAt, setPerspective and the frustum, each with an input that changes so the caches miss
+    Camera benchCamera = camera;
+    results.push_back(measure("camera_look_at", [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            benchCamera.setRotation(angles[i % tableSize] * 0.5f, angles[(i + 1) % tableSize] * 3.0f);
+            sink = sink + static_cast<uint64_t>(benchCamera.getView().columns[0].x != 0.0f);
+        }
+    }));
+    results.push_back(measure("camera_set_perspective", [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            benchCamera.setPerspective(45.0f + angles[i % tableSize] * 0.1f, 1.0f, 0.1f, 1000.0f);
+            sink = sink + static_cast<uint64_t>(benchCamera.getProjection().columns[0].x != 0.0f);
+        }
+    }));
+    results.push_back(measure("camera_frustum", [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            benchCamera.setRotation(angles[i % tableSize] * 0.5f, angles[(i + 1) % tableSize] * 3.0f);
+            sink = sink + static_cast<uint64_t>(benchCamera.getFrustum().intersectsBox(bounds.boundsMin, bounds.boundsMax));
+        }
+    }));
+
+    // The WASD step from the frame loop, every key combination in turn, swept against the boxes
+    std::vector<Mesh*> candidates;
+    const Vec4 halfSize(0.5f, 0.5f, 0.5f);
+    const float stepLength = 100.0f / 60.0f;
+    Vec4 start = camera.getPosition();
+    results.push_back(measure("wasd_move", [&](uint64_t count) {
+        Vec4 position = start;
+        for (uint64_t i = 0; i < count; i++) {
+            unsigned keys = static_cast<unsigned>(i % 15) + 1;
+            Vec4 movement;
+            if (keys & 1) {
+                movement += camera.getRight();
+            }
+            if (keys & 2) {
+                movement -= camera.getRight();
+            }
+            if (keys & 4) {
+                movement -= camera.getForward();
+            }
+            if (keys & 8) {
+                movement += camera.getForward();
+            }
+            if (dot3(movement, movement) > 0.0f) {
+                position = sweepBox(grid, position, halfSize, movement * stepLength, candidates);
+            }
+        }
+        sink = sink + static_cast<uint64_t>(position.x != 0.0f);
+    }));
+
+    // The overlay vertices of a frame: crosshair, the stats panel and four lines of stats text
+    OverlayRenderer overlay;
+    const OverlayColor white = makeOverlayColor(1.0f, 1.0f, 1.0f, 1.0f);
+    const char* const hudText = "8.33 ms  120 fps\n10000 boxes\nocclusion on  lod on\ngpu picking off  idle on";
+    results.push_back(measure("overlay_build", [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            overlay.beginFrame(1080, 1080);
+            overlay.addLine(530.0f, 540.0f, 550.0f, 540.0f, 2.0f, white);
+            overlay.addLine(540.0f, 530.0f, 540.0f, 550.0f, 2.0f, white);
+            overlay.addQuad(8.0f, 8.0f, 200.0f, 90.0f, white);
+            overlay.addText(14.0f, 14.0f, hudText, 2, white);
+        }
+        sink = sink + overlay.getVertexCount();
+    }));
+
+    // Walking the mesh list with the frustum test from the draw loop, then the same boxes in an array
+    const Frustum& frustum = camera.getFrustum();
+    auto visitMesh = [&](const Mesh& mesh) {
+        float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+        return frustum.intersectsBox(mesh.location.data(), boxMax) ? 1u : 0u;
+    };
+    results.push_back(measure("iterate_mesh_list", [&](uint64_t count) {
+        uint64_t visible = 0;
+        auto it = meshes.begin();
+        for (uint64_t i = 0; i < count; i++) {
+            visible += visitMesh(*it);
+            if (++it == meshes.end()) {
+                it = meshes.begin();
+            }
+        }
+        sink = sink + visible;
+    }));
+    std::vector<Mesh> meshArray(meshes.begin(), meshes.end());
+    results.push_back(measure("iterate_mesh_vector", [&](uint64_t count) {
+        uint64_t visible = 0;
+        size_t index = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            visible += visitMesh(meshArray[index]);
+            if (++index == meshArray.size()) {
+                index = 0;
+            }
+        }
+        sink = sink + visible;
+    }));
+
+    if (jsonPath && writeJson(jsonPath, results, meshes.size())) {
+        std::printf("Saved %s\n", jsonPath);
+    }
+    return baselinePath ? compareBaseline(baselinePath, results) : true;
+}
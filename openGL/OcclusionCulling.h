@@ -0,0 +1,430 @@
+#pragma once
+
+#include "FrustumCulling.h"
+#include "Mesh.h"
+#include "SpatialGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <vector>
+
+// Hierarchical-Z occlusion culling on the CPU
+//
+// The biggest boxes on screen are rasterized in software into a small depth
+// buffer, which is reduced into a pyramid where each texel holds the farthest
+// depth of the four below it. A box is hidden if its nearest depth is behind
+// the farthest depth of the pyramid texels covering its screen rectangle.
+// Nothing here touches GL, so it can be checked without a window
+class OcclusionCuller {
+public:
+    static constexpr int bufferSize = 256; // level 0 is bufferSize x bufferSize
+
+    int maxOccluders = 32;
+    float minOccluderArea = 0.01f; // fraction of the screen a box must cover to be an occluder
+
+    OcclusionCuller() {
+        int size = bufferSize;
+        while (size >= 1) {
+            levels.push_back(std::vector<float>(size * size, 1.0f));
+            size /= 2;
+        }
+    }
+
+    // Clears the depth buffer, viewProjection is column major
+    void beginFrame(const float* viewProjection) {
+        std::copy(viewProjection, viewProjection + 16, matrix);
+        std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+        occluderCount = 0;
+    }
+
+    // Picks the largest visible boxes, rasterizes them and builds the pyramid
+    //
+    // Only the boxes in front of the camera and near it are looked at, so the
+    // cost follows what's in view rather than the size of the scene. A ball
+    // of radius r at distance d covers at most sx * sy * r^2 / (d^2 - r^2) of
+    // the screen, sx and sy being the projection's scales, twice that for
+    // boxes off to the side that the perspective stretches. The grid is
+    // searched over the bounds of the frustum cut off at a reach that doubles
+    // until nothing past it, up to the longest box in a cell, could beat the
+    // smallest occluder kept. Boxes bigger than a cell are few and each is
+    // checked
+    void renderOccluders(const SpatialGrid& grid, const float* eye, const Frustum& frustum) {
+        candidates.clear();
+        grid.getLargeMeshes(regionMeshes);
+        for (const Mesh* mesh : regionMeshes) {
+            addCandidate(*mesh, frustum);
+        }
+
+        const float* m = matrix;
+        float scaleX = std::sqrt(m[0] * m[0] + m[4] * m[4] + m[8] * m[8]);
+        float scaleY = std::sqrt(m[1] * m[1] + m[5] * m[5] + m[9] * m[9]);
+        float radius = grid.getSmallExtent() * 0.8660254f; // half the diagonal of a cube that long
+
+        // Directions to the frustum's corners, each one unit deep. The last row
+        // of the matrix is the view direction and the first two are the
+        // camera's right and up scaled by the projection
+        float corners[4][3];
+        for (int i = 0; i < 4; i++) {
+            float signX = (i & 1) ? 1.0f : -1.0f;
+            float signY = (i & 2) ? 1.0f : -1.0f;
+            for (int axis = 0; axis < 3; axis++) {
+                corners[i][axis] = m[axis * 4 + 3] + signX * m[axis * 4] / (scaleX * scaleX) + signY * m[axis * 4 + 1] / (scaleY * scaleY);
+            }
+        }
+
+        float reach = radius * 4.0f;
+        float searchedMin[3] = { 0.0f, 0.0f, 0.0f };
+        float searchedMax[3] = { -1.0f, -1.0f, -1.0f }; // nothing searched yet
+        size_t kept = 0;
+        while (true) {
+            float regionMin[3] = { eye[0], eye[1], eye[2] };
+            float regionMax[3] = { eye[0], eye[1], eye[2] };
+            for (int i = 0; i < 4; i++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    regionMin[axis] = std::min(regionMin[axis], eye[axis] + corners[i][axis] * reach);
+                    regionMax[axis] = std::max(regionMax[axis], eye[axis] + corners[i][axis] * reach);
+                }
+            }
+
+            grid.querySmall(regionMin, regionMax, regionMeshes);
+            for (const Mesh* mesh : regionMeshes) {
+                bool seen = true;
+                for (int axis = 0; axis < 3; axis++) {
+                    seen = seen && mesh->location[axis] <= searchedMax[axis] && mesh->location[axis] + mesh->size[axis] >= searchedMin[axis];
+                }
+                if (!seen) {
+                    addCandidate(*mesh, frustum);
+                }
+            }
+            std::copy(regionMin, regionMin + 3, searchedMin);
+            std::copy(regionMax, regionMax + 3, searchedMax);
+
+            // Largest first, the rest don't get rasterized
+            kept = std::min(candidates.size(), static_cast<size_t>(maxOccluders));
+            std::partial_sort(candidates.begin(), candidates.begin() + kept, candidates.end(), [](const Candidate& a, const Candidate& b) {
+                return a.area > b.area;
+            });
+
+            float smallest = kept == static_cast<size_t>(maxOccluders) ? candidates[kept - 1].area : minOccluderArea;
+            float outside = 2.0f * scaleX * scaleY * radius * radius / std::max(reach * reach - radius * radius, 1e-6f);
+            if (outside < smallest) {
+                break;
+            }
+            reach *= 2.0f;
+        }
+
+        for (size_t i = 0; i < kept; i++) {
+            const Mesh& mesh = *candidates[i].mesh;
+            float boxMin[3] = { mesh.location[0], mesh.location[1], mesh.location[2] };
+            float boxMax[3] = { boxMin[0] + mesh.size[0], boxMin[1] + mesh.size[1], boxMin[2] + mesh.size[2] };
+            rasterizeBox(boxMin, boxMax);
+        }
+
+        buildPyramid();
+    }
+
+    // Rasterizes one box into level 0, boxes crossing the near plane are skipped
+    //
+    // Only texels the box covers completely are written, or a box peeking out
+    // less than a texel past the edge would be culled. Each gets the farthest
+    // depth of the box's front over it. After the divide the box is still
+    // convex and its front is the farthest of its front faces' planes, a
+    // convex function whose farthest point over a texel is at a corner. So
+    // everything is worked out once per texel corner and shared by the four
+    // texels around it
+    void rasterizeBox(const float* boxMin, const float* boxMax) {
+        float screen[8][3];
+        float center[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 8; i++) {
+            float corner[3] = {
+                (i & 1) ? boxMax[0] : boxMin[0],
+                (i & 2) ? boxMax[1] : boxMin[1],
+                (i & 4) ? boxMax[2] : boxMin[2],
+            };
+            if (!projectPoint(corner, screen[i])) {
+                return;
+            }
+        }
+        float middle[3] = { (boxMin[0] + boxMax[0]) * 0.5f, (boxMin[1] + boxMax[1]) * 0.5f, (boxMin[2] + boxMax[2]) * 0.5f };
+        projectPoint(middle, center);
+
+        // Corners indexed by the bits x=1, y=2, z=4, each face in order around it
+        static const int faces[6][4] = {
+            { 0, 1, 3, 2 }, { 4, 5, 7, 6 }, // z min, z max
+            { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, // y min, y max
+            { 0, 2, 6, 4 }, { 1, 3, 7, 5 }, // x min, x max
+        };
+
+        // Depth over a face is a plane in screen space, it faces the camera if the box's center is behind it
+        FrontFace front[3];
+        int frontCount = 0;
+        for (int face = 0; face < 6 && frontCount < 3; face++) {
+            const float* a = screen[faces[face][0]];
+            const float* b = screen[faces[face][1]];
+            const float* c = screen[faces[face][2]];
+            float determinant = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+            if (std::fabs(determinant) < 1e-6f) {
+                continue; // edge on, covers nothing
+            }
+            FrontFace& plane = front[frontCount];
+            plane.slopeX = ((b[2] - a[2]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[2] - a[2])) / determinant;
+            plane.slopeY = ((b[0] - a[0]) * (c[2] - a[2]) - (b[2] - a[2]) * (c[0] - a[0])) / determinant;
+            plane.offset = a[2] - plane.slopeX * a[0] - plane.slopeY * a[1];
+            if (center[2] <= plane.slopeX * center[0] + plane.slopeY * center[1] + plane.offset) {
+                continue;
+            }
+            for (int i = 0; i < 4; i++) {
+                plane.corners[i][0] = screen[faces[face][i]][0];
+                plane.corners[i][1] = screen[faces[face][i]][1];
+            }
+            frontCount++;
+        }
+        if (frontCount == 0) {
+            return;
+        }
+
+        float minX = screen[0][0];
+        float minY = screen[0][1];
+        float maxX = screen[0][0];
+        float maxY = screen[0][1];
+        for (int i = 1; i < 8; i++) {
+            minX = std::min(minX, screen[i][0]);
+            minY = std::min(minY, screen[i][1]);
+            maxX = std::max(maxX, screen[i][0]);
+            maxY = std::max(maxY, screen[i][1]);
+        }
+        int x0 = std::max(0, static_cast<int>(std::ceil(minX)));
+        int y0 = std::max(0, static_cast<int>(std::ceil(minY)));
+        int x1 = std::min(bufferSize, static_cast<int>(std::floor(maxX)));
+        int y1 = std::min(bufferSize, static_cast<int>(std::floor(maxY)));
+        if (x1 <= x0 || y1 <= y0) {
+            return; // smaller than a texel
+        }
+
+        // Depth of the front at each texel corner in the box's outline, or past the far plane outside it
+        int cornersAcross = x1 - x0 + 1;
+        cornerDepths.assign(static_cast<size_t>(cornersAcross) * (y1 - y0 + 1), 2.0f);
+        for (int y = y0; y <= y1; y++) {
+            // The front faces make up the outline, which is convex, so each row crosses it once
+            float left = 1e30f;
+            float right = -1e30f;
+            for (int face = 0; face < frontCount; face++) {
+                crossQuad(front[face].corners, static_cast<float>(y), left, right);
+            }
+            int spanStart = std::max(x0, static_cast<int>(std::ceil(left)));
+            int spanEnd = std::min(x1, static_cast<int>(std::floor(right)));
+
+            float* row = &cornerDepths[(y - y0) * cornersAcross];
+            for (int x = spanStart; x <= spanEnd; x++) {
+                float depth = 0.0f;
+                for (int face = 0; face < frontCount; face++) {
+                    const FrontFace& plane = front[face];
+                    depth = std::max(depth, plane.slopeX * x + plane.slopeY * y + plane.offset);
+                }
+                row[x - x0] = depth;
+            }
+        }
+
+        std::vector<float>& depth = levels[0];
+        for (int y = y0; y < y1; y++) {
+            const float* above = &cornerDepths[(y - y0) * cornersAcross];
+            const float* below = above + cornersAcross;
+            for (int x = 0; x < x1 - x0; x++) {
+                float z = std::max(std::max(above[x], above[x + 1]), std::max(below[x], below[x + 1]));
+                float& stored = depth[y * bufferSize + x0 + x];
+                if (z < stored) {
+                    stored = z;
+                }
+            }
+        }
+
+        occluderCount++;
+    }
+
+    // Reduces level 0 into the coarser levels, keeping the farthest depth
+    void buildPyramid() {
+        int size = bufferSize / 2;
+        for (size_t level = 1; level < levels.size(); level++, size /= 2) {
+            const std::vector<float>& below = levels[level - 1];
+            std::vector<float>& current = levels[level];
+            int belowSize = size * 2;
+
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    const float* row0 = &below[(y * 2) * belowSize + x * 2];
+                    const float* row1 = row0 + belowSize;
+                    current[y * size + x] = std::max(std::max(row0[0], row0[1]), std::max(row1[0], row1[1]));
+                }
+            }
+        }
+    }
+
+    // False if the box is hidden behind the occluders
+    bool isVisible(const float* boxMin, const float* boxMax) const {
+        if (occluderCount == 0) {
+            return true;
+        }
+
+        ScreenRect rect;
+        if (!projectBox(boxMin, boxMax, rect)) {
+            return true; // crosses the near plane, can't be behind anything
+        }
+
+        // Clamp to the buffer, boxes outside the screen are the frustum's job
+        float minX = std::max(rect.minX, 0.0f);
+        float minY = std::max(rect.minY, 0.0f);
+        float maxX = std::min(rect.maxX, static_cast<float>(bufferSize - 1));
+        float maxY = std::min(rect.maxY, static_cast<float>(bufferSize - 1));
+        if (minX > maxX || minY > maxY) {
+            return true;
+        }
+
+        // Pick the level where the rectangle spans at most two texels each way
+        float extent = std::max(maxX - minX, maxY - minY);
+        int level = 0;
+        while (extent > 2.0f && level < static_cast<int>(levels.size()) - 1) {
+            extent *= 0.5f;
+            level++;
+        }
+
+        int size = bufferSize >> level;
+        int x0 = static_cast<int>(minX) >> level;
+        int y0 = static_cast<int>(minY) >> level;
+        int x1 = std::min(static_cast<int>(maxX) >> level, size - 1);
+        int y1 = std::min(static_cast<int>(maxY) >> level, size - 1);
+
+        const std::vector<float>& depth = levels[level];
+        float farthest = 0.0f;
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                farthest = std::max(farthest, depth[y * size + x]);
+            }
+        }
+
+        return rect.nearestDepth <= farthest;
+    }
+
+    int getOccluderCount() const {
+        return occluderCount;
+    }
+
+    // Depth of level 0, row by row, 0 is the near plane and 1 the far plane
+    const std::vector<float>& getDepthBuffer() const {
+        return levels[0];
+    }
+
+    // The pyramid for culling elsewhere, level l is bufferSize >> l texels across
+    const std::vector<std::vector<float>>& getLevels() const {
+        return levels;
+    }
+
+    // Column major view projection the occluders were rasterized with
+    const float* getMatrix() const {
+        return matrix;
+    }
+
+private:
+    struct ScreenRect {
+        float minX, minY, maxX, maxY;
+        float nearestDepth;
+    };
+
+    struct Candidate {
+        float area;
+        const Mesh* mesh;
+    };
+
+    // Screen space plane of a face towards the camera, depth = slopeX * x + slopeY * y + offset
+    struct FrontFace {
+        float slopeX, slopeY, offset;
+        float corners[4][2];
+    };
+
+    float matrix[16] = { 0 };
+    std::vector<std::vector<float>> levels;
+    std::vector<Candidate> candidates;
+    std::vector<Mesh*> regionMeshes;
+    std::vector<float> cornerDepths;
+    int occluderCount = 0;
+
+    void addCandidate(const Mesh& mesh, const Frustum& frustum) {
+        float boxMin[3] = { mesh.location[0], mesh.location[1], mesh.location[2] };
+        float boxMax[3] = { boxMin[0] + mesh.size[0], boxMin[1] + mesh.size[1], boxMin[2] + mesh.size[2] };
+
+        if (!frustum.intersectsBox(boxMin, boxMax)) {
+            return;
+        }
+
+        ScreenRect rect;
+        if (!projectBox(boxMin, boxMax, rect)) {
+            return; // crosses the near plane
+        }
+
+        float area = (rect.maxX - rect.minX) * (rect.maxY - rect.minY) / (bufferSize * bufferSize);
+        if (area >= minOccluderArea) {
+            candidates.push_back({ area, &mesh });
+        }
+    }
+
+    // World position to buffer pixels and [0, 1] depth, false if behind the near plane
+    bool projectPoint(const float* point, float* out) const {
+        const float* m = matrix;
+        float x = m[0] * point[0] + m[4] * point[1] + m[8] * point[2] + m[12];
+        float y = m[1] * point[0] + m[5] * point[1] + m[9] * point[2] + m[13];
+        float z = m[2] * point[0] + m[6] * point[1] + m[10] * point[2] + m[14];
+        float w = m[3] * point[0] + m[7] * point[1] + m[11] * point[2] + m[15];
+
+        if (w <= 1e-5f || z < -w) {
+            return false;
+        }
+
+        float inverseW = 1.0f / w;
+        out[0] = (x * inverseW * 0.5f + 0.5f) * bufferSize;
+        out[1] = (0.5f - y * inverseW * 0.5f) * bufferSize; // row 0 at the top
+        out[2] = z * inverseW * 0.5f + 0.5f;
+        return true;
+    }
+
+    bool projectBox(const float* boxMin, const float* boxMax, ScreenRect& rect) const {
+        rect = { 1e30f, 1e30f, -1e30f, -1e30f, 1.0f };
+
+        for (int i = 0; i < 8; i++) {
+            float corner[3] = {
+                (i & 1) ? boxMax[0] : boxMin[0],
+                (i & 2) ? boxMax[1] : boxMin[1],
+                (i & 4) ? boxMax[2] : boxMin[2],
+            };
+
+            float screen[3];
+            if (!projectPoint(corner, screen)) {
+                return false;
+            }
+
+            rect.minX = std::min(rect.minX, screen[0]);
+            rect.minY = std::min(rect.minY, screen[1]);
+            rect.maxX = std::max(rect.maxX, screen[0]);
+            rect.maxY = std::max(rect.maxY, screen[1]);
+            rect.nearestDepth = std::min(rect.nearestDepth, screen[2]);
+        }
+        return true;
+    }
+
+    // Widens [left, right] to where the row at y crosses the quad, points on an edge count as inside
+    static void crossQuad(const float (*corners)[2], float y, float& left, float& right) {
+        for (int i = 0; i < 4; i++) {
+            const float* a = corners[i];
+            const float* b = corners[(i + 1) % 4];
+            if ((a[1] < y && b[1] < y) || (a[1] > y && b[1] > y)) {
+                continue;
+            }
+            if (a[1] == b[1]) {
+                left = std::min(left, std::min(a[0], b[0]));
+                right = std::max(right, std::max(a[0], b[0]));
+                continue;
+            }
+            float x = a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+            left = std::min(left, x);
+            right = std::max(right, x);
+        }
+    }
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "GLExtensions.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 5x8 pixel glyphs for the printable ASCII characters, space to tilde. Each
+// glyph is 8 rows from the top, the last one for descenders, and bit 4 of a
+// row is its leftmost pixel
+inline const uint8_t overlayFontRows[95 * 8] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04, 0x00, 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A, 0x00, // space ! " #
+    0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04, 0x00, 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03, 0x00, 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D, 0x00, 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, // $ % & '
+    0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02, 0x00, 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08, 0x00, 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00, 0x00, 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00, 0x00, // ( ) * +
+    0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x00, // , - . /
+    0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E, 0x00, 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F, 0x00, 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E, 0x00, // 0 1 2 3
+    0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02, 0x00, 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E, 0x00, 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E, 0x00, 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08, 0x00, // 4 5 6 7
+    0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E, 0x00, 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08, 0x00, // 8 9 : ;
+    0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08, 0x00, 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04, 0x00, // < = > ?
+    0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E, 0x00, 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00, 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E, 0x00, 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E, 0x00, // @ A B C
+    0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C, 0x00, 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F, 0x00, 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10, 0x00, 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F, 0x00, // D E F G
+    0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00, 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C, 0x00, 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11, 0x00, // H I J K
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F, 0x00, 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11, 0x00, 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00, // L M N O
+    0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D, 0x00, 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11, 0x00, 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E, 0x00, // P Q R S
+    0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00, 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A, 0x00, // T U V W
+    0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x00, 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F, 0x00, 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E, 0x00, // X Y Z [
+    0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00, 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E, 0x00, 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x00, // \ ] ^ _
+    0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F, 0x00, 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E, 0x00, 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E, 0x00, // ` a b c
+    0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F, 0x00, 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E, 0x00, 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08, 0x00, 0x00, 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E, // d e f g
+    0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x02, 0x00, 0x06, 0x02, 0x02, 0x02, 0x12, 0x0C, 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12, 0x00, // h i j k
+    0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00, 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11, 0x00, 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00, 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E, 0x00, // l m n o
+    0x00, 0x00, 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x00, 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x01, 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E, 0x00, // p q r s
+    0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06, 0x00, 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D, 0x00, 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00, 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A, 0x00, // t u v w
+    0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x11, 0x11, 0x11, 0x0F, 0x01, 0x0E, 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F, 0x00, 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02, 0x00, // x y z {
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00, 0x00, // | } ~
+};
+
+// RGBA, 255 is fully on
+struct OverlayColor {
+    uint8_t r, g, b, a;
+};
+
+inline OverlayColor makeOverlayColor(float r, float g, float b, float a) {
+    auto channel = [](float value) {
+        return static_cast<uint8_t>(value <= 0.0f ? 0 : value >= 1.0f ? 255 : value * 255.0f + 0.5f);
+    };
+    return { channel(r), channel(g), channel(b), channel(a) };
+}
+
+// Screen space lines, quads and text drawn in one call
+//
+// Everything added during a frame goes into one vertex stream of textured
+// triangles, lines become thin quads. The texture holds the font's glyphs
+// and a solid white cell, quads and lines sample the white cell so they can
+// share the draw with the text. Vertex colors are multiplied by the texture,
+// the default fixed function texture mode. Coordinates are in pixels from
+// the top left corner of the window
+//
+// The stream is uploaded into a buffer whose storage is orphaned every
+// frame, or drawn from client memory when the context has no buffer objects.
+// The vertex array keeps its capacity, so after the first frames a frame
+// doesn't allocate
+class OverlayRenderer {
+public:
+    static const int glyphWidth = 5;
+    static const int glyphHeight = 8;
+    static const int glyphAdvance = glyphWidth + 1;
+    static const int lineAdvance = glyphHeight + 2;
+
+    // Creates the font texture and the vertex buffer, needs a current context
+    void init() {
+        uint8_t pixels[atlasWidth * atlasHeight] = {};
+        for (int glyph = 0; glyph < glyphCount; glyph++) {
+            int cellX = (glyph % atlasColumns) * cellSize;
+            int cellY = (glyph / atlasColumns) * cellSize;
+            for (int row = 0; row < glyphHeight; row++) {
+                uint8_t bits = overlayFontRows[glyph * glyphHeight + row];
+                for (int column = 0; column < glyphWidth; column++) {
+                    if (bits & (0x10 >> column)) {
+                        pixels[(cellY + row) * atlasWidth + cellX + column] = 255;
+                    }
+                }
+            }
+        }
+        int whiteX = (whiteCell % atlasColumns) * cellSize;
+        int whiteY = (whiteCell / atlasColumns) * cellSize;
+        for (int y = 0; y < cellSize; y++) {
+            for (int x = 0; x < cellSize; x++) {
+                pixels[(whiteY + y) * atlasWidth + whiteX + x] = 255;
+            }
+        }
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlasWidth, atlasHeight, 0, GL_ALPHA, GL_UNSIGNED_BYTE, pixels);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if (glext::hasBufferObjects) {
+            glext::GenBuffers(1, &vertexBuffer);
+        }
+    }
+
+    // Has to run while the context is still alive, so before glfwTerminate
+    void release() {
+        if (texture) {
+            glDeleteTextures(1, &texture);
+            texture = 0;
+        }
+        if (vertexBuffer) {
+            glext::DeleteBuffers(1, &vertexBuffer);
+            vertexBuffer = 0;
+        }
+    }
+
+    // Bound by whoever runs the draw, the render queue binds it from the item's texture
+    GLuint getTexture() const {
+        return texture;
+    }
+
+    // Drops last frame's vertices
+    void beginFrame(int width, int height) {
+        screenWidth = width;
+        screenHeight = height;
+        vertices.clear();
+    }
+
+    void addQuad(float x, float y, float width, float height, OverlayColor color) {
+        float u = (whiteCell % atlasColumns * cellSize + cellSize * 0.5f) / atlasWidth;
+        float v = (whiteCell / atlasColumns * cellSize + cellSize * 0.5f) / atlasHeight;
+        addRectangle(x, y, x + width, y + height, u, v, u, v, color);
+    }
+
+    void addLine(float x0, float y0, float x1, float y1, float thickness, OverlayColor color) {
+        float dx = x1 - x0;
+        float dy = y1 - y0;
+        float length = std::sqrt(dx * dx + dy * dy);
+        if (length <= 0.0f) {
+            return;
+        }
+        // Half the thickness to each side of the line
+        float nx = -dy / length * thickness * 0.5f;
+        float ny = dx / length * thickness * 0.5f;
+        float u = (whiteCell % atlasColumns * cellSize + cellSize * 0.5f) / atlasWidth;
+        float v = (whiteCell / atlasColumns * cellSize + cellSize * 0.5f) / atlasHeight;
+        addTriangle({ x0 + nx, y0 + ny, u, v, color }, { x1 + nx, y1 + ny, u, v, color }, { x1 - nx, y1 - ny, u, v, color });
+        addTriangle({ x0 + nx, y0 + ny, u, v, color }, { x1 - nx, y1 - ny, u, v, color }, { x0 - nx, y0 - ny, u, v, color });
+    }
+
+    // Top left of the first glyph at x, y, each font pixel scale screen pixels wide. Newlines start
+    // a new line, characters the font doesn't have draw as spaces. Returns the width of the longest line
+    float addText(float x, float y, const char* text, int scale, OverlayColor color) {
+        float penX = x;
+        float penY = y;
+        float widest = 0.0f;
+        for (const char* c = text; *c; c++) {
+            if (*c == '\n') {
+                widest = std::max(widest, penX - x);
+                penX = x;
+                penY += lineAdvance * scale;
+                continue;
+            }
+            int glyph = static_cast<unsigned char>(*c) - firstCharacter;
+            if (glyph > 0 && glyph < glyphCount) {
+                float u0 = static_cast<float>(glyph % atlasColumns * cellSize) / atlasWidth;
+                float v0 = static_cast<float>(glyph / atlasColumns * cellSize) / atlasHeight;
+                float u1 = u0 + static_cast<float>(glyphWidth) / atlasWidth;
+                float v1 = v0 + static_cast<float>(glyphHeight) / atlasHeight;
+                addRectangle(penX, penY, penX + glyphWidth * scale, penY + glyphHeight * scale, u0, v0, u1, v1, color);
+            }
+            penX += glyphAdvance * scale;
+        }
+        return std::max(widest, penX - x);
+    }
+
+    // Width and height addText would cover, for placing text and the panel behind it
+    static void measureText(const char* text, int scale, float& width, float& height) {
+        int longest = 0;
+        int current = 0;
+        int lines = 1;
+        for (const char* c = text; *c; c++) {
+            if (*c == '\n') {
+                lines++;
+                current = 0;
+                continue;
+            }
+            current++;
+            longest = std::max(longest, current);
+        }
+        width = static_cast<float>(longest * glyphAdvance * scale);
+        height = static_cast<float>(((lines - 1) * lineAdvance + glyphHeight) * scale);
+    }
+
+    // One draw for everything added since beginFrame, the overlay's texture has to be bound
+    void draw() const {
+        if (vertices.empty()) {
+            return;
+        }
+
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0, screenWidth, screenHeight, 0, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+
+        const uint8_t* base = nullptr;
+        if (vertexBuffer) {
+            // Orphan the old storage so the driver doesn't wait on last frame's draw
+            GLsizeiptr size = vertices.size() * sizeof(OverlayVertex);
+            glext::BindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glext::BufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            glext::BufferSubData(GL_ARRAY_BUFFER, 0, size, vertices.data());
+        }
+        else {
+            base = reinterpret_cast<const uint8_t*>(vertices.data());
+        }
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(OverlayVertex), base + offsetof(OverlayVertex, x));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(OverlayVertex), base + offsetof(OverlayVertex, u));
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(OverlayVertex), base + offsetof(OverlayVertex, color));
+
+        glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(vertices.size()));
+
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        if (vertexBuffer) {
+            glext::BindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+    }
+
+    size_t getVertexCount() const {
+        return vertices.size();
+    }
+
+private:
+    struct OverlayVertex {
+        float x, y;
+        float u, v;
+        OverlayColor color;
+    };
+
+    static const int firstCharacter = ' ';
+    static const int glyphCount = 95;
+    static const int whiteCell = glyphCount; // the cell after the last glyph
+    static const int cellSize = 8;
+    static const int atlasColumns = 16;
+    static const int atlasWidth = atlasColumns * cellSize;
+    static const int atlasHeight = 8 * cellSize;
+
+    GLuint texture = 0;
+    GLuint vertexBuffer = 0;
+    int screenWidth = 1;
+    int screenHeight = 1;
+    std::vector<OverlayVertex> vertices;
+
+    void addTriangle(const OverlayVertex& a, const OverlayVertex& b, const OverlayVertex& c) {
+        vertices.push_back(a);
+        vertices.push_back(b);
+        vertices.push_back(c);
+    }
+
+    void addRectangle(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, OverlayColor color) {
+        addTriangle({ x0, y0, u0, v0, color }, { x1, y0, u1, v0, color }, { x1, y1, u1, v1, color });
+        addTriangle({ x0, y0, u0, v0, color }, { x1, y1, u1, v1, color }, { x0, y1, u0, v1, color });
+    }
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "Camera.h"
+#include "Image.h"
+#include "MathLib.h"
+#include "Mesh.h"
+#include "Picking.h"
+#include "RayQuery.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Offline path tracer for the box scene, for rendering shots without a GPU
+//
+// Paths are traced a bounce at a time for a chunk of pixels together: every
+// live path's next ray goes to the BVH as one batch, so the rays run through
+// the packet traversal and its SSE slab tests on the thread pool, and then
+// every hit is shaded in parallel. Camera rays and the sun shadow rays they
+// spawn are coherent and go in packets, bounce rays scatter and go one by
+// one. Surfaces are diffuse in the mesh color, lit by a sun and a sky. Each
+// call to addSample adds one sample per pixel to the running average, so the
+// image can be saved at any point and just gets less noisy
+class PathTracer {
+public:
+    int maxBounces = 4;
+    float sunStrength = 2.5f;
+    Vec4 sunDirection = normalize3(Vec4(0.4f, 0.8f, 0.3f)); // towards the sun
+
+    // Has to be called again after meshes change
+    void build(const std::list<Mesh>& meshes) {
+        query.build(meshes);
+        surfaces.clear();
+        surfaceOf.clear();
+        for (const Mesh& mesh : meshes) {
+            Surface surface;
+            for (int axis = 0; axis < 3; axis++) {
+                surface.boundsMin[axis] = mesh.location[axis];
+                surface.boundsMax[axis] = mesh.location[axis] + mesh.size[axis];
+                surface.albedo[axis] = mesh.color[axis] / 255.0f;
+            }
+            surfaceOf[mesh.handle] = static_cast<uint32_t>(surfaces.size());
+            surfaces.push_back(surface);
+        }
+    }
+
+    // Starts a new image of what the camera sees, dropping the samples so far
+    void beginImage(const Camera& camera, int newWidth, int newHeight) {
+        inverseViewProjection = camera.getInverseViewProjection();
+        width = newWidth;
+        height = newHeight;
+        accumulation.assign(static_cast<size_t>(width) * height, Vec4());
+        sampleCount = 0;
+        rayCount = 0;
+        traceSeconds = 0.0;
+    }
+
+    // One more sample for every pixel
+    void addSample(ThreadPool& pool) {
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        for (size_t first = 0; first < pixelCount; first += chunkSize) {
+            traceChunk(first, std::min(chunkSize, pixelCount - first), pool);
+        }
+        sampleCount++;
+        auto end = std::chrono::high_resolution_clock::now();
+        traceSeconds += std::chrono::duration<double>(end - start).count();
+    }
+
+    // Saves the average so far as a PPM image
+    bool writeImage(const char* path) const {
+        std::vector<uint8_t> rgb(accumulation.size() * 3);
+        float scale = sampleCount > 0 ? 1.0f / sampleCount : 0.0f;
+        for (size_t i = 0; i < accumulation.size(); i++) {
+            for (int channel = 0; channel < 3; channel++) {
+                // Exposure curve so bright sunlit faces roll off instead of clipping, then gamma
+                float value = 1.0f - std::exp(-accumulation[i][channel] * scale);
+                rgb[i * 3 + channel] = static_cast<uint8_t>(std::pow(value, 1.0f / 2.2f) * 255.0f + 0.5f);
+            }
+        }
+        return writePpm(path, width, height, rgb.data());
+    }
+
+    int getSampleCount() const {
+        return sampleCount;
+    }
+
+    // Camera, bounce and shadow rays traced since beginImage
+    uint64_t getRayCount() const {
+        return rayCount;
+    }
+
+    double getTraceSeconds() const {
+        return traceSeconds;
+    }
+
+private:
+    struct Surface {
+        float boundsMin[3];
+        float boundsMax[3];
+        float albedo[3];
+    };
+
+    struct Path {
+        uint32_t pixel;
+        uint32_t random;
+        Vec4 throughput; // what's left of the light after the bounces so far
+        bool alive;
+    };
+
+    static constexpr size_t chunkSize = 64 * 1024; // paths in flight, bounds the buffers
+    const float maxDistance = 1e5f;
+    const float surfaceOffset = 1e-3f;
+
+    RayQuery query;
+    std::vector<Surface> surfaces;
+    std::unordered_map<MeshHandle, uint32_t> surfaceOf;
+
+    Mat4 inverseViewProjection;
+    int width = 0;
+    int height = 0;
+    std::vector<Vec4> accumulation; // summed radiance per pixel
+    int sampleCount = 0;
+    uint64_t rayCount = 0;
+    double traceSeconds = 0.0;
+
+    // Wavefront buffers, kept between chunks
+    std::vector<Path> paths;
+    std::vector<Vec4> origins;
+    std::vector<Vec4> directions;
+    std::vector<RayHit> hits;
+    std::vector<Vec4> shadowOrigins;
+    std::vector<Vec4> shadowDirections;
+    std::vector<RayHit> shadowHits;
+    std::vector<Vec4> shadowLight;  // what the sun adds if the shadow ray gets out
+    std::vector<uint32_t> shadowPath;
+
+    // PCG hash, the same pixel and sample always get the same numbers whatever thread runs them
+    static uint32_t hashBits(uint32_t value) {
+        uint32_t state = value * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    static float nextRandom(uint32_t& state) {
+        state = hashBits(state);
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Light from the sky straight along a direction
+    static Vec4 skyRadiance(const Vec4& direction) {
+        float t = std::max(direction.y, 0.0f);
+        Vec4 horizon(0.75f, 0.8f, 0.85f);
+        Vec4 zenith(0.25f, 0.45f, 0.85f);
+        return horizon + (zenith - horizon) * t;
+    }
+
+    void traceChunk(size_t firstPixel, size_t count, ThreadPool& pool) {
+        paths.resize(count);
+        origins.resize(count);
+        directions.resize(count);
+        hits.resize(count);
+        shadowOrigins.resize(count);
+        shadowDirections.resize(count);
+        shadowHits.resize(count);
+        shadowLight.resize(count);
+        shadowPath.resize(count);
+
+        // Camera rays through a random point in each pixel, which also smooths the edges
+        pool.parallelFor(count, 1024, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                Path& path = paths[i];
+                path.pixel = static_cast<uint32_t>(firstPixel + i);
+                path.random = hashBits(path.pixel ^ hashBits(static_cast<uint32_t>(sampleCount) * 0x9E3779B9u));
+                path.throughput = Vec4(1.0f, 1.0f, 1.0f);
+                path.alive = true;
+
+                float x = (path.pixel % width) + nextRandom(path.random);
+                float y = (path.pixel / width) + nextRandom(path.random);
+                Ray ray = screenRay(inverseViewProjection, x, y, static_cast<float>(width), static_cast<float>(height));
+                origins[i] = ray.origin;
+                directions[i] = ray.direction;
+            }
+        });
+
+        size_t active = count;
+        for (int bounce = 0; bounce < maxBounces && active > 0; bounce++) {
+            bool coherent = bounce == 0;
+            query.intersect(origins.data(), directions.data(), active, maxDistance, hits.data(), pool, coherent);
+            rayCount += active;
+
+            pool.parallelFor(active, 1024, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    shade(i, bounce);
+                }
+            });
+
+            // Only the hits lit from the sun side need a shadow ray
+            size_t shadowCount = 0;
+            for (size_t i = 0; i < active; i++) {
+                if (shadowLight[i].w > 0.0f) {
+                    shadowOrigins[shadowCount] = shadowOrigins[i];
+                    shadowDirections[shadowCount] = shadowDirections[i];
+                    shadowLight[shadowCount] = shadowLight[i];
+                    shadowPath[shadowCount] = paths[i].pixel;
+                    shadowCount++;
+                }
+            }
+            query.intersect(shadowOrigins.data(), shadowDirections.data(), shadowCount, maxDistance, shadowHits.data(), pool, coherent);
+            rayCount += shadowCount;
+            pool.parallelFor(shadowCount, 1024, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (shadowHits[i].handle == noMeshHandle) {
+                        accumulation[shadowPath[i]] += shadowLight[i];
+                    }
+                }
+            });
+
+            // Live paths to the front for the next bounce
+            size_t alive = 0;
+            for (size_t i = 0; i < active; i++) {
+                if (paths[i].alive) {
+                    paths[alive] = paths[i];
+                    origins[alive] = origins[i];
+                    directions[alive] = directions[i];
+                    alive++;
+                }
+            }
+            active = alive;
+        }
+    }
+
+    // Adds the sky for a miss, or sets up the sun's shadow ray and the next bounce for a hit
+    void shade(size_t i, int bounce) {
+        Path& path = paths[i];
+        shadowLight[i].w = 0.0f;
+
+        const RayHit& hit = hits[i];
+        if (hit.handle == noMeshHandle) {
+            accumulation[path.pixel] += path.throughput * skyRadiance(directions[i]);
+            path.alive = false;
+            return;
+        }
+
+        const Surface& surface = surfaces[surfaceOf.find(hit.handle)->second];
+        Vec4 point = origins[i] + directions[i] * hit.distance;
+
+        // The face whose plane the hit is closest to
+        int normalAxis = 0;
+        float normalSign = -1.0f;
+        float closest = 3.4e38f;
+        for (int axis = 0; axis < 3; axis++) {
+            float toMin = std::fabs(point[axis] - surface.boundsMin[axis]);
+            float toMax = std::fabs(point[axis] - surface.boundsMax[axis]);
+            if (toMin < closest) {
+                closest = toMin;
+                normalAxis = axis;
+                normalSign = -1.0f;
+            }
+            if (toMax < closest) {
+                closest = toMax;
+                normalAxis = axis;
+                normalSign = 1.0f;
+            }
+        }
+        Vec4 normal;
+        normal[normalAxis] = normalSign;
+        Vec4 albedo(surface.albedo[0], surface.albedo[1], surface.albedo[2]);
+        Vec4 leaving = point + normal * surfaceOffset;
+
+        float sunCosine = dot3(normal, sunDirection);
+        if (sunCosine > 0.0f) {
+            shadowOrigins[i] = leaving;
+            shadowDirections[i] = sunDirection;
+            shadowLight[i] = path.throughput * albedo * (sunStrength * sunCosine);
+            shadowLight[i].w = 1.0f;
+        }
+
+        if (bounce + 1 >= maxBounces) {
+            path.alive = false;
+            return;
+        }
+
+        // Cosine weighted direction around the normal, the diffuse falloff cancels out of the weight
+        float angle = 2.0f * mathPi * nextRandom(path.random);
+        float radiusSquared = nextRandom(path.random);
+        float radius = std::sqrt(radiusSquared);
+        Vec4 direction;
+        direction[normalAxis] = normalSign * std::sqrt(1.0f - radiusSquared);
+        direction[(normalAxis + 1) % 3] = radius * std::cos(angle);
+        direction[(normalAxis + 2) % 3] = radius * std::sin(angle);
+        path.throughput = path.throughput * albedo;
+
+        // Paths carrying little light end at random, the survivors carry more to keep the average right
+        if (bounce >= 1) {
+            float keep = std::min(std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z)), 0.95f);
+            if (nextRandom(path.random) >= keep) {
+                path.alive = false;
+                return;
+            }
+            path.throughput *= 1.0f / keep;
+        }
+
+        origins[i] = leaving;
+        directions[i] = direction;
+    }
+};
@@ -0,0 +1,434 @@
+#pragma once
+
+#include "MathLib.h"
+#include "Mesh.h"
+#include "SweepAndPrune.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Boxes that fall, stack and get pushed around, for meshes with the dynamic flag
+//
+// Bodies never rotate, so two boxes always touch along one axis, the one
+// they overlap least on. Each step adds gravity to the awake bodies, finds
+// what they touch through the sweep and prune broadphase and groups bodies
+// that touch into islands. Islands share no bodies, so they're solved side
+// by side on the thread pool with sequential impulses. Contacts are made
+// before boxes meet and only let them close the gap, so falling boxes stop
+// on the surface instead of sinking in and bouncing back out. An island
+// that stays still for a while goes to sleep and costs nothing until
+// something awake touches it
+class PhysicsWorld {
+public:
+    void build(std::list<Mesh>& meshes) {
+        bodies.clear();
+        bodyIndices.clear();
+        bodyOfProxy.clear();
+        disturbed.clear();
+        broadphase = SweepAndPrune(upAxis);
+        for (Mesh& mesh : meshes) {
+            add(mesh);
+        }
+    }
+
+    // Static meshes are added too so bodies can land on them, the mesh has to stay where it is in memory
+    void add(Mesh& mesh) {
+        uint32_t index = static_cast<uint32_t>(bodies.size());
+        bodies.push_back(Body());
+        Body& body = bodies.back();
+        body.mesh = &mesh;
+        body.inverseMass = mesh.dynamic ? 1.0f / std::max(mesh.size[0] * mesh.size[1] * mesh.size[2], 1e-6f) : 0.0f;
+        bodyIndices[mesh.handle] = index;
+
+        float boxMin[3];
+        float boxMax[3];
+        bounds(mesh, boxMin, boxMax);
+        body.proxy = broadphase.addProxy(boxMin, boxMax);
+        if (bodyOfProxy.size() <= body.proxy) {
+            bodyOfProxy.resize(body.proxy + 1);
+        }
+        bodyOfProxy[body.proxy] = index;
+    }
+
+    // Call after something other than the physics moved a mesh, the next step wakes the bodies around it
+    void update(Mesh& mesh) {
+        auto found = bodyIndices.find(mesh.handle);
+        if (found == bodyIndices.end()) {
+            return;
+        }
+        Body& body = bodies[found->second];
+        float boxMin[3];
+        float boxMax[3];
+        bounds(mesh, boxMin, boxMax);
+        for (int axis = 0; axis < 3; axis++) {
+            boxMin[axis] -= contactSkin;
+            boxMax[axis] += contactSkin;
+        }
+        broadphase.moveProxy(body.proxy, boxMin, boxMax);
+        wake(body);
+        disturbed.push_back(found->second);
+    }
+
+    void addVelocity(MeshHandle handle, const Vec4& change) {
+        auto found = bodyIndices.find(handle);
+        if (found == bodyIndices.end() || bodies[found->second].inverseMass == 0.0f) {
+            return;
+        }
+        Body& body = bodies[found->second];
+        body.velocity += change;
+        wake(body);
+    }
+
+    void step(float deltaTime, ThreadPool& pool) {
+        movedMeshes.clear();
+        contactCount = 0;
+        islandCount = 0;
+
+        awake.clear();
+        for (uint32_t index = 0; index < bodies.size(); index++) {
+            if (isAwake(bodies[index])) {
+                awake.push_back(index);
+            }
+        }
+        if (awake.empty() && disturbed.empty()) {
+            return;
+        }
+
+        // Gravity, and each box grown by how far it can move this step so the broadphase sees it coming
+        pool.parallelFor(awake.size(), 1024, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                Body& body = bodies[awake[i]];
+                body.velocity += gravity * deltaTime;
+
+                float boxMin[3];
+                float boxMax[3];
+                bounds(*body.mesh, boxMin, boxMax);
+                for (int axis = 0; axis < 3; axis++) {
+                    float move = body.velocity[axis] * deltaTime;
+                    boxMin[axis] += std::min(move, 0.0f) - contactSkin;
+                    boxMax[axis] += std::max(move, 0.0f) + contactSkin;
+                }
+                broadphase.moveProxy(body.proxy, boxMin, boxMax);
+            }
+        });
+        broadphase.updatePairs();
+
+        // Sleeping bodies aren't checked against anything, so the ones a moved mesh now touches are woken here
+        for (uint32_t index : disturbed) {
+            SweepAndPrune::ProxyId proxy = bodies[index].proxy;
+            for (SweepAndPrune::ProxyId partner : broadphase.getPartners(proxy)) {
+                uint32_t other = bodyOfProxy[partner];
+                if (bodies[other].sleeping && broadphase.overlapsOnAxis(proxy, partner, upAxis)) {
+                    wake(bodies[other]);
+                    awake.push_back(other);
+                }
+            }
+        }
+        disturbed.clear();
+
+        // A sleeping body touched by an awake one wakes up, its own contacts join from the next step
+        contacts.clear();
+        for (const SweepAndPrune::Pair& pair : broadphase.getPairs()) {
+            uint32_t first = bodyOfProxy[pair.first];
+            uint32_t second = bodyOfProxy[pair.second];
+            if (!isAwake(bodies[first]) && !isAwake(bodies[second])) {
+                continue;
+            }
+            if (!broadphase.overlapsOnAxis(pair.first, pair.second, upAxis)) {
+                continue;
+            }
+            for (uint32_t index : { first, second }) {
+                if (bodies[index].sleeping) {
+                    wake(bodies[index]);
+                    awake.push_back(index);
+                }
+            }
+            contacts.push_back(makeContact(first, second));
+        }
+        contactCount = contacts.size();
+
+        buildIslands();
+
+        pool.parallelFor(islandCount, 16, [&](size_t begin, size_t end) {
+            for (size_t island = begin; island < end; island++) {
+                solveIsland(island, deltaTime);
+            }
+        });
+
+        for (uint32_t index : awake) {
+            movedMeshes.push_back(bodies[index].mesh);
+        }
+    }
+
+    // Meshes the last step moved, for updating whatever else tracks them
+    const std::vector<Mesh*>& getMovedMeshes() const {
+        return movedMeshes;
+    }
+
+    size_t getBodyCount() const {
+        return bodies.size();
+    }
+
+    // Awake bodies in the last step, sleeping and static ones aren't counted
+    size_t getAwakeCount() const {
+        return awake.size();
+    }
+
+    // True when every body is asleep, so stepping wouldn't move anything
+    bool isSettled() const {
+        for (const Body& body : bodies) {
+            if (isAwake(body)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t getIslandCount() const {
+        return islandCount;
+    }
+
+    size_t getContactCount() const {
+        return contactCount;
+    }
+
+private:
+    struct Body {
+        Vec4 velocity;
+        Mesh* mesh = nullptr;
+        float inverseMass = 0.0f; // 0 for static meshes
+        float stillTime = 0.0f;   // How long the body has been nearly still
+        bool sleeping = false;
+        SweepAndPrune::ProxyId proxy = 0;
+    };
+
+    // The normal points along one axis from the first body to the second
+    struct Contact {
+        uint32_t first;
+        uint32_t second;
+        int axis;
+        float sign;
+        float separation; // Gap between the boxes, negative when they overlap
+        float normalImpulse;
+        float frictionImpulse[2];
+    };
+
+    // Scene units are large, this makes boxes tens of units tall fall at a believable pace
+    const Vec4 gravity = Vec4(0.0f, -20.0f, 0.0f);
+    const int iterations = 10;
+    const float friction = 0.6f;
+    // Overlap left alone so resting boxes don't jitter, and how much of the rest is pushed out per step
+    const float allowedOverlap = 0.01f;
+    const float correctionRate = 0.2f;
+    // Boxes start being checked against each other this far apart
+    const float contactSkin = 0.05f;
+    const float sleepSpeed = 0.2f;
+    const float sleepDelay = 0.5f;
+
+    std::vector<Body> bodies;
+    std::unordered_map<MeshHandle, uint32_t> bodyIndices;
+    std::vector<uint32_t> bodyOfProxy;
+    // Bodies pile up on floors, so the broadphase leaves out the up axis and contacts check it
+    static const int upAxis = 1;
+    SweepAndPrune broadphase{ upAxis };
+
+    std::vector<uint32_t> awake;
+    std::vector<Contact> contacts;
+    std::vector<Mesh*> movedMeshes;
+    std::vector<uint32_t> disturbed; // Bodies moved from outside since the last step
+    size_t contactCount = 0;
+
+    // Islands as ranges of islandBodies and islandContacts
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> islandOf;
+    std::vector<uint32_t> islandBodies;
+    std::vector<uint32_t> islandBodyStarts;
+    std::vector<Contact> islandContacts;
+    std::vector<uint32_t> islandContactStarts;
+    std::vector<uint32_t> fillCursors;
+    size_t islandCount = 0;
+
+    static void bounds(const Mesh& mesh, float* boxMin, float* boxMax) {
+        for (int axis = 0; axis < 3; axis++) {
+            boxMin[axis] = mesh.location[axis];
+            boxMax[axis] = mesh.location[axis] + mesh.size[axis];
+        }
+    }
+
+    static bool isAwake(const Body& body) {
+        return body.inverseMass > 0.0f && !body.sleeping;
+    }
+
+    static void wake(Body& body) {
+        body.sleeping = false;
+        body.stillTime = 0.0f;
+    }
+
+    // Along the axis where the boxes are furthest apart, or overlap least
+    Contact makeContact(uint32_t first, uint32_t second) const {
+        const Mesh& a = *bodies[first].mesh;
+        const Mesh& b = *bodies[second].mesh;
+
+        Contact contact = { first, second, 0, 1.0f, -INFINITY, 0.0f, { 0.0f, 0.0f } };
+        for (int axis = 0; axis < 3; axis++) {
+            float gapAbove = b.location[axis] - (a.location[axis] + a.size[axis]);
+            float gapBelow = a.location[axis] - (b.location[axis] + b.size[axis]);
+            float gap = std::max(gapAbove, gapBelow);
+            if (gap > contact.separation) {
+                contact.separation = gap;
+                contact.axis = axis;
+                contact.sign = gapAbove >= gapBelow ? 1.0f : -1.0f;
+            }
+        }
+        return contact;
+    }
+
+    uint32_t findRoot(uint32_t index) {
+        while (parents[index] != index) {
+            parents[index] = parents[parents[index]];
+            index = parents[index];
+        }
+        return index;
+    }
+
+    // Awake bodies joined by contacts, static bodies don't join islands since they never move
+    void buildIslands() {
+        const uint32_t noIsland = UINT32_MAX;
+        parents.resize(bodies.size());
+        islandOf.resize(bodies.size());
+        for (uint32_t index : awake) {
+            parents[index] = index;
+        }
+        for (const Contact& contact : contacts) {
+            if (bodies[contact.first].inverseMass > 0.0f && bodies[contact.second].inverseMass > 0.0f) {
+                uint32_t first = findRoot(contact.first);
+                uint32_t second = findRoot(contact.second);
+                if (first != second) {
+                    parents[first] = second;
+                }
+            }
+        }
+
+        for (uint32_t index : awake) {
+            islandOf[index] = noIsland;
+        }
+        islandCount = 0;
+        islandBodyStarts.assign(1, 0);
+        for (uint32_t index : awake) {
+            uint32_t root = findRoot(index);
+            if (islandOf[root] == noIsland) {
+                islandOf[root] = static_cast<uint32_t>(islandCount++);
+                islandBodyStarts.push_back(0);
+            }
+            islandOf[index] = islandOf[root];
+            islandBodyStarts[islandOf[index] + 1]++;
+        }
+
+        // Counts to start offsets, then each body and contact goes in its island's range
+        islandContactStarts.assign(islandCount + 1, 0);
+        for (const Contact& contact : contacts) {
+            islandContactStarts[contactIsland(contact) + 1]++;
+        }
+        for (size_t island = 0; island < islandCount; island++) {
+            islandBodyStarts[island + 1] += islandBodyStarts[island];
+            islandContactStarts[island + 1] += islandContactStarts[island];
+        }
+
+        islandBodies.resize(awake.size());
+        fillCursors.assign(islandBodyStarts.begin(), islandBodyStarts.end() - 1);
+        for (uint32_t index : awake) {
+            islandBodies[fillCursors[islandOf[index]]++] = index;
+        }
+
+        islandContacts.resize(contacts.size());
+        fillCursors.assign(islandContactStarts.begin(), islandContactStarts.end() - 1);
+        for (const Contact& contact : contacts) {
+            islandContacts[fillCursors[contactIsland(contact)]++] = contact;
+        }
+    }
+
+    uint32_t contactIsland(const Contact& contact) const {
+        return islandOf[bodies[contact.first].inverseMass > 0.0f ? contact.first : contact.second];
+    }
+
+    void solveIsland(size_t island, float deltaTime) {
+        Contact* first = islandContacts.data() + islandContactStarts[island];
+        Contact* last = islandContacts.data() + islandContactStarts[island + 1];
+
+        // Bottom up, so the weight of a stack reaches the ground in fewer iterations
+        std::sort(first, last, [this](const Contact& a, const Contact& b) {
+            return lowestPoint(a) < lowestPoint(b);
+        });
+
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            for (Contact* contact = first; contact != last; contact++) {
+                solveContact(*contact, deltaTime);
+            }
+        }
+
+        // Moves the bodies, and the island sleeps once all of it has been still long enough
+        float stillest = INFINITY;
+        for (uint32_t i = islandBodyStarts[island]; i < islandBodyStarts[island + 1]; i++) {
+            Body& body = bodies[islandBodies[i]];
+            for (int axis = 0; axis < 3; axis++) {
+                body.mesh->location[axis] += body.velocity[axis] * deltaTime;
+            }
+            body.stillTime = dot3(body.velocity, body.velocity) < sleepSpeed * sleepSpeed ? body.stillTime + deltaTime : 0.0f;
+            stillest = std::min(stillest, body.stillTime);
+        }
+        if (stillest >= sleepDelay) {
+            for (uint32_t i = islandBodyStarts[island]; i < islandBodyStarts[island + 1]; i++) {
+                Body& body = bodies[islandBodies[i]];
+                body.sleeping = true;
+                body.velocity = Vec4();
+            }
+        }
+    }
+
+    float lowestPoint(const Contact& contact) const {
+        return std::min(bodies[contact.first].mesh->location[1], bodies[contact.second].mesh->location[1]);
+    }
+
+    // Static bodies are shared between islands, so only dynamic ones are written
+    void solveContact(Contact& contact, float deltaTime) {
+        Body& a = bodies[contact.first];
+        Body& b = bodies[contact.second];
+        float massSum = a.inverseMass + b.inverseMass;
+        int axis = contact.axis;
+
+        // Apart, the boxes may close the gap this step but no more. Overlapping, they're pushed out a little at a time
+        float targetSpeed = contact.separation > 0.0f ? -contact.separation / deltaTime :
+            correctionRate * std::max(-contact.separation - allowedOverlap, 0.0f) / deltaTime;
+        float normalSpeed = contact.sign * (b.velocity[axis] - a.velocity[axis]);
+        float impulse = (targetSpeed - normalSpeed) / massSum;
+        float total = std::max(contact.normalImpulse + impulse, 0.0f);
+        impulse = total - contact.normalImpulse;
+        contact.normalImpulse = total;
+        applyImpulse(a, b, axis, contact.sign * impulse);
+
+        // Friction along the other two axes, only as strong as the boxes are pressed together
+        float limit = friction * contact.normalImpulse;
+        for (int tangent = 0; tangent < 2; tangent++) {
+            int tangentAxis = (axis + 1 + tangent) % 3;
+            float slideSpeed = b.velocity[tangentAxis] - a.velocity[tangentAxis];
+            float frictionImpulse = -slideSpeed / massSum;
+            float frictionTotal = std::max(-limit, std::min(contact.frictionImpulse[tangent] + frictionImpulse, limit));
+            frictionImpulse = frictionTotal - contact.frictionImpulse[tangent];
+            contact.frictionImpulse[tangent] = frictionTotal;
+            applyImpulse(a, b, tangentAxis, frictionImpulse);
+        }
+    }
+
+    static void applyImpulse(Body& a, Body& b, int axis, float impulse) {
+        if (a.inverseMass > 0.0f) {
+            a.velocity[axis] -= impulse * a.inverseMass;
+        }
+        if (b.inverseMass > 0.0f) {
+            b.velocity[axis] += impulse * b.inverseMass;
+        }
+    }
+};
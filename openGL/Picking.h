@@ -0,0 +1,103 @@
+#pragma once
+
+#include "MathLib.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <list>
+
+// Ray with its direction inverted ahead of time for the slab tests
+struct Ray {
+    Vec4 origin;
+    Vec4 direction;
+    Vec4 inverseDirection;
+};
+
+inline Ray makeRay(const Vec4& origin, const Vec4& direction) {
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.inverseDirection = Vec4(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z, 0.0f);
+    return ray;
+}
+
+// Nearest box a ray hit, handle is noMeshHandle on a miss
+struct RayHit {
+    MeshHandle handle;
+    float distance;
+};
+
+// Ray through a window pixel, starting on the near plane
+//
+// inverseViewProjection takes clip space back to the world, so the pixel is
+// unprojected at the near and far planes and the ray joins the two points
+inline Ray screenRay(const Mat4& inverseViewProjection, float pixelX, float pixelY, float width, float height) {
+    float x = 2.0f * pixelX / width - 1.0f;
+    float y = 1.0f - 2.0f * pixelY / height;
+
+    Vec4 nearPoint = inverseViewProjection * Vec4(x, y, -1.0f, 1.0f);
+    Vec4 farPoint = inverseViewProjection * Vec4(x, y, 1.0f, 1.0f);
+    nearPoint = nearPoint * (1.0f / nearPoint.w);
+    farPoint = farPoint * (1.0f / farPoint.w);
+
+    return makeRay(nearPoint, normalize3(farPoint - nearPoint));
+}
+
+// Slab test, distance is where the ray enters the box clamped to minDistance
+inline bool intersectRayBox(const Ray& ray, const float* boxMin, const float* boxMax, float minDistance, float maxDistance, float& distance) {
+    float enter = minDistance;
+    float exit = maxDistance;
+
+    for (int axis = 0; axis < 3; axis++) {
+        // Parallel to the slab, it's either always inside it or never
+        if (ray.direction[axis] == 0.0f) {
+            if (ray.origin[axis] < boxMin[axis] || ray.origin[axis] > boxMax[axis]) {
+                return false;
+            }
+            continue;
+        }
+
+        float slabNear = (boxMin[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+        float slabFar = (boxMax[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+        enter = std::max(enter, std::min(slabNear, slabFar));
+        exit = std::min(exit, std::max(slabNear, slabFar));
+        if (enter > exit) {
+            return false;
+        }
+    }
+
+    distance = enter;
+    return true;
+}
+
+// Nearest mesh the ray hits between the two distances, nullptr if none
+inline Mesh* pickMesh(std::list<Mesh>& meshes, const Ray& ray, float minDistance, float maxDistance, float* hitDistance = nullptr) {
+    Mesh* nearest = nullptr;
+    float nearestDistance = maxDistance;
+
+    for (Mesh& mesh : meshes) {
+        float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+        float distance;
+        if (intersectRayBox(ray, mesh.location.data(), boxMax, minDistance, nearestDistance, distance)) {
+            nearest = &mesh;
+            nearestDistance = distance;
+        }
+    }
+
+    if (nearest && hitDistance) {
+        *hitDistance = nearestDistance;
+    }
+    return nearest;
+}
+
+// Mesh with the given handle, nullptr if it's gone
+inline Mesh* findMesh(std::list<Mesh>& meshes, MeshHandle handle) {
+    if (handle == noMeshHandle) {
+        return nullptr;
+    }
+    for (Mesh& mesh : meshes) {
+        if (mesh.handle == handle) {
+            return &mesh;
+        }
+    }
+    return nullptr;
+}
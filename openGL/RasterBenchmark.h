@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Camera.h"
+#include "FrustumCulling.h"
+#include "RayBenchmark.h"
+#include "SoftwareRasterizer.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <cstdio>
+#include <list>
+
+// Frame time of the software rasterizer on the random box scenes, run with --bench-raster
+
+namespace rasterbench {
+
+    // Best of a few frames, the first one warms up the bins
+    inline void runScene(const std::list<Mesh>& meshes, ThreadPool& pool, bool hierarchicalDepth) {
+        const int side = 1024;
+        Camera camera;
+        camera.setPosition(0.0f, 50.0f, 600.0f);
+        camera.setRotation(-5.0f, -90.0f);
+        camera.setPerspective(60.0f, 1.0f, 0.1f, 2000.0f);
+        const Frustum& frustum = camera.getFrustum();
+
+        SoftwareRasterizer rasterizer(side, side);
+        rasterizer.hierarchicalDepth = hierarchicalDepth;
+        const float clearColor[3] = { 0.0f, 0.0f, 0.0f };
+
+        double bestSetup = 1e30;
+        double bestRaster = 1e30;
+        for (int frame = 0; frame < 4; frame++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            rasterizer.beginFrame(camera.getViewProjection(), clearColor);
+            for (const Mesh& mesh : meshes) {
+                float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+                if (frustum.intersectsBox(mesh.location.data(), boxMax)) {
+                    mesh.draw(rasterizer);
+                }
+            }
+            auto binned = std::chrono::high_resolution_clock::now();
+            rasterizer.endFrame(pool);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            if (frame > 0) {
+                bestSetup = std::min(bestSetup, std::chrono::duration<double, std::milli>(binned - start).count());
+                bestRaster = std::min(bestRaster, std::chrono::duration<double, std::milli>(end - binned).count());
+            }
+        }
+
+        std::printf("%-8zu %8u %6s %10.2f %10.2f %10.2f %12zu %12zu %12zu\n", meshes.size(), pool.getThreadCount(), hierarchicalDepth ? "on" : "off",
+            bestSetup, bestRaster, bestSetup + bestRaster, rasterizer.getTriangleCount(), rasterizer.getBinnedCount(), rasterizer.getHiddenCount());
+    }
+
+}
+
+inline void runRasterBenchmark() {
+    std::printf("Software rasterizer benchmark, 1024 x 1024, random boxes\n");
+    std::printf("%-8s %8s %6s %10s %10s %10s %12s %12s %12s\n", "boxes", "threads", "hi-z", "setup ms", "raster ms", "frame ms", "triangles", "binned", "hidden");
+
+    ThreadPool single(1);
+    ThreadPool all;
+    const size_t boxCounts[] = { 10000, 100000 };
+    for (size_t boxCount : boxCounts) {
+        std::list<Mesh> meshes = raybench::makeScene(boxCount, 1);
+        rasterbench::runScene(meshes, single, false);
+        rasterbench::runScene(meshes, single, true);
+        rasterbench::runScene(meshes, all, true);
+    }
+}
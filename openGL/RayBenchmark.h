@@ -0,0 +1,245 @@
+#pragma once
+
+#include "Camera.h"
+#include "Picking.h"
+#include "RayQuery.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <vector>
+
+// Ray throughput of the batch query in Mrays/s, run with --bench-rays, and
+// the spatial grid against the linear pick scan, run with --bench-grid
+
+namespace raybench {
+
+    // Keeps the optimizer from throwing the results away
+    inline volatile size_t sink = 0;
+
+    // Random boxes over a 1000 x 100 x 1000 area, the same seed gives the same scene
+    inline std::list<Mesh> makeScene(size_t boxCount, unsigned seed) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> height(0.0f, 100.0f);
+        std::uniform_real_distribution<float> size(1.0f, 10.0f);
+
+        std::list<Mesh> meshes;
+        for (size_t i = 0; i < boxCount; i++) {
+            meshes.push_back({ { position(random), height(random), position(random) }, { size(random), size(random), size(random) }, { 255, 255, 255 } });
+        }
+        return meshes;
+    }
+
+    // Camera rays through every pixel of a square view, neighbours go nearly the same way
+    inline void makeCoherentRays(size_t side, std::vector<Vec4>& origins, std::vector<Vec4>& directions) {
+        Camera camera;
+        camera.setPosition(0.0f, 50.0f, 600.0f);
+        camera.setRotation(-5.0f, -90.0f);
+        camera.setPerspective(60.0f, 1.0f, 0.1f, 2000.0f);
+
+        origins.clear();
+        directions.clear();
+        for (size_t y = 0; y < side; y++) {
+            for (size_t x = 0; x < side; x++) {
+                Ray ray = screenRay(camera.getInverseViewProjection(), x + 0.5f, y + 0.5f, static_cast<float>(side), static_cast<float>(side));
+                origins.push_back(ray.origin);
+                directions.push_back(ray.direction);
+            }
+        }
+    }
+
+    // Sight lines between random points, every ray goes its own way
+    inline void makeIncoherentRays(size_t count, unsigned seed, std::vector<Vec4>& origins, std::vector<Vec4>& directions) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> height(0.0f, 100.0f);
+
+        origins.clear();
+        directions.clear();
+        for (size_t i = 0; i < count; i++) {
+            Vec4 from = makePoint(position(random), height(random), position(random));
+            Vec4 to = makePoint(position(random), height(random), position(random));
+            origins.push_back(from);
+            directions.push_back(normalize3(to - from));
+        }
+    }
+
+    template <typename Function>
+    inline double megaRaysPerSecond(size_t rayCount, Function function) {
+        // Once to warm up, then the best of three
+        function();
+        double best = 0.0;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            function();
+            auto end = std::chrono::high_resolution_clock::now();
+            double seconds = std::chrono::duration<double>(end - start).count();
+            best = std::max(best, rayCount / seconds / 1e6);
+        }
+        return best;
+    }
+
+}
+
+inline void runRayBenchmark() {
+    using namespace raybench;
+    const float maxDistance = 2000.0f;
+
+    ThreadPool pool;
+    std::printf("Ray benchmark, %u threads, Mrays/s\n", pool.getThreadCount());
+    std::printf("%-8s %-11s %10s %10s %10s %10s %10s\n", "boxes", "rays", "linear", "bvh", "packet", "threaded", "mismatch");
+
+    const size_t boxCounts[] = { 1000, 10000, 100000 };
+    for (size_t boxCount : boxCounts) {
+        std::list<Mesh> meshes = makeScene(boxCount, 1);
+
+        RayQuery query;
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        query.build(meshes);
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+        std::printf("%zu boxes, BVH of %zu nodes built in %.2f ms\n", boxCount, query.getBvh().getNodes().size(),
+            std::chrono::duration<double, std::milli>(buildEnd - buildStart).count());
+
+        for (int coherent = 1; coherent >= 0; coherent--) {
+            std::vector<Vec4> origins;
+            std::vector<Vec4> directions;
+            if (coherent) {
+                makeCoherentRays(256, origins, directions);
+            }
+            else {
+                makeIncoherentRays(65536, 2, origins, directions);
+            }
+            size_t rayCount = origins.size();
+
+            std::vector<Ray> rays(rayCount);
+            for (size_t i = 0; i < rayCount; i++) {
+                rays[i] = makeRay(origins[i], directions[i]);
+            }
+
+            // The linear scan is too slow to run over every ray, a slice of them is enough
+            size_t linearCount = std::min<size_t>(rayCount, 2000000 / boxCount);
+            size_t linearHits = 0;
+            double linear = megaRaysPerSecond(linearCount, [&] {
+                for (size_t i = 0; i < linearCount; i++) {
+                    linearHits += pickMesh(meshes, rays[i], 0.0f, maxDistance) != nullptr;
+                }
+            });
+            sink = sink + linearHits;
+
+            std::vector<RayHit> single(rayCount);
+            double bvh = megaRaysPerSecond(rayCount, [&] {
+                for (size_t i = 0; i < rayCount; i++) {
+                    single[i] = query.intersect(rays[i], maxDistance);
+                }
+            });
+
+            std::vector<RayHit> packet(rayCount);
+            double packetRate = megaRaysPerSecond(rayCount, [&] {
+                query.intersect(origins.data(), directions.data(), rayCount, maxDistance, packet.data());
+            });
+
+            // Threads use packets for the camera rays and single rays for the sight lines
+            std::vector<RayHit> threaded(rayCount);
+            double threadedRate = megaRaysPerSecond(rayCount, [&] {
+                query.intersect(origins.data(), directions.data(), rayCount, maxDistance, threaded.data(), pool, coherent != 0);
+            });
+
+            // Boxes that touch can be entered at the same distance, so only the distances have to agree
+            size_t mismatches = 0;
+            for (size_t i = 0; i < rayCount; i++) {
+                for (const std::vector<RayHit>* hits : { &packet, &threaded }) {
+                    const RayHit& hit = (*hits)[i];
+                    bool agrees = (single[i].handle == noMeshHandle) == (hit.handle == noMeshHandle) &&
+                        std::fabs(single[i].distance - hit.distance) <= 1e-3f * (1.0f + single[i].distance);
+                    if (!agrees) {
+                        mismatches++;
+                    }
+                }
+            }
+
+            std::printf("%-8zu %-11s %10.2f %10.2f %10.2f %10.2f %10zu\n", boxCount, coherent ? "coherent" : "incoherent",
+                linear, bvh, packetRate, threadedRate, mismatches);
+        }
+    }
+}
+
+inline void runGridBenchmark() {
+    using namespace raybench;
+    const float maxDistance = 2000.0f;
+
+    std::printf("Grid benchmark, camera rays over boxes 1 to 10 units across, 16 unit cells\n");
+    std::printf("%-8s %12s %12s %12s %12s %12s %10s\n", "boxes", "linear us", "grid us", "speedup", "build ms", "move ns", "mismatch");
+
+    std::vector<Vec4> origins;
+    std::vector<Vec4> directions;
+    makeCoherentRays(64, origins, directions);
+    size_t rayCount = origins.size();
+
+    const size_t boxCounts[] = { 100, 1000, 10000, 100000, 1000000 };
+    for (size_t boxCount : boxCounts) {
+        std::list<Mesh> meshes = makeScene(boxCount, 1);
+
+        // Around two buckets per box keeps collisions rare
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        SpatialGrid grid(16.0f, boxCount * 2);
+        grid.build(meshes);
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+        double buildMilliseconds = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+        // Same slice of rays for both, the linear scan gets fewer as the scene grows
+        size_t sliceCount = std::max<size_t>(16, std::min<size_t>(rayCount, 20000000 / boxCount));
+        std::vector<Ray> rays(sliceCount);
+        for (size_t i = 0; i < sliceCount; i++) {
+            size_t ray = i * rayCount / sliceCount;
+            rays[i] = makeRay(origins[ray], directions[ray]);
+        }
+
+        std::vector<float> linearDistances(sliceCount);
+        double linear = megaRaysPerSecond(sliceCount, [&] {
+            for (size_t i = 0; i < sliceCount; i++) {
+                float distance = maxDistance;
+                pickMesh(meshes, rays[i], 0.0f, maxDistance, &distance);
+                linearDistances[i] = distance;
+            }
+        });
+
+        std::vector<float> gridDistances(sliceCount);
+        double gridRate = megaRaysPerSecond(sliceCount, [&] {
+            for (size_t i = 0; i < sliceCount; i++) {
+                gridDistances[i] = grid.intersect(rays[i], 0.0f, maxDistance).distance;
+            }
+        });
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < sliceCount; i++) {
+            if (std::fabs(linearDistances[i] - gridDistances[i]) > 1e-3f * (1.0f + linearDistances[i])) {
+                mismatches++;
+            }
+        }
+
+        // Nudging boxes around, most stay in their cells and some cross into the next
+        std::mt19937 random(3);
+        std::uniform_real_distribution<float> nudge(-2.0f, 2.0f);
+        size_t moveCount = std::min<size_t>(boxCount, 100000);
+        auto moveStart = std::chrono::high_resolution_clock::now();
+        size_t moved = 0;
+        for (Mesh& mesh : meshes) {
+            if (moved++ == moveCount) {
+                break;
+            }
+            mesh.location[0] += nudge(random);
+            mesh.location[2] += nudge(random);
+            grid.update(mesh);
+        }
+        auto moveEnd = std::chrono::high_resolution_clock::now();
+        double moveNanoseconds = std::chrono::duration<double, std::nano>(moveEnd - moveStart).count() / moveCount;
+
+        std::printf("%-8zu %12.2f %12.2f %11.1fx %12.2f %12.1f %10zu\n", boxCount, 1.0 / linear, 1.0 / gridRate, gridRate / linear,
+            buildMilliseconds, moveNanoseconds, mismatches);
+    }
+}
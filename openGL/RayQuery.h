@@ -0,0 +1,472 @@
+#pragma once
+
+#include "MathLib.h"
+#include "Mesh.h"
+#include "Picking.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <vector>
+
+// Bounding volume hierarchy over the mesh boxes
+//
+// Nodes are 32 bytes, the two children of a node are next to each other so
+// one index finds both. Boxes are split at the middle of the longest axis of
+// their centers, falling back to a median split when that leaves a side empty
+// or the tree gets deep, which keeps it under the traversal stack size
+class BoxBvh {
+public:
+    struct Node {
+        float boundsMin[3];
+        uint32_t leftOrFirst; // First child for inner nodes, first box for leaves
+        float boundsMax[3];
+        uint32_t count;       // Boxes in a leaf, 0 for inner nodes
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    struct Box {
+        float boundsMin[3];
+        float boundsMax[3];
+        MeshHandle handle;
+    };
+
+    void build(const std::list<Mesh>& meshes) {
+        boxes.clear();
+        for (const Mesh& mesh : meshes) {
+            Box box;
+            for (int axis = 0; axis < 3; axis++) {
+                box.boundsMin[axis] = mesh.location[axis];
+                box.boundsMax[axis] = mesh.location[axis] + mesh.size[axis];
+            }
+            box.handle = mesh.handle;
+            boxes.push_back(box);
+        }
+
+        nodes.clear();
+        if (boxes.empty()) {
+            return;
+        }
+        nodes.reserve(boxes.size() * 2);
+        nodes.push_back(Node());
+        subdivide(0, 0, static_cast<uint32_t>(boxes.size()), 0);
+    }
+
+    const std::vector<Node>& getNodes() const {
+        return nodes;
+    }
+
+    const std::vector<Box>& getBoxes() const {
+        return boxes;
+    }
+
+    bool isEmpty() const {
+        return nodes.empty();
+    }
+
+private:
+    static const uint32_t maxLeafSize = 4;
+    static const int maxMidpointDepth = 32;
+
+    std::vector<Node> nodes;
+    std::vector<Box> boxes;
+
+    static float center(const Box& box, int axis) {
+        return box.boundsMin[axis] + box.boundsMax[axis];
+    }
+
+    void subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+        Node node;
+        float centerMin[3] = { center(boxes[first], 0), center(boxes[first], 1), center(boxes[first], 2) };
+        float centerMax[3] = { centerMin[0], centerMin[1], centerMin[2] };
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = boxes[first].boundsMin[axis];
+            node.boundsMax[axis] = boxes[first].boundsMax[axis];
+        }
+        for (uint32_t i = first + 1; i < first + count; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                node.boundsMin[axis] = std::min(node.boundsMin[axis], boxes[i].boundsMin[axis]);
+                node.boundsMax[axis] = std::max(node.boundsMax[axis], boxes[i].boundsMax[axis]);
+                centerMin[axis] = std::min(centerMin[axis], center(boxes[i], axis));
+                centerMax[axis] = std::max(centerMax[axis], center(boxes[i], axis));
+            }
+        }
+
+        if (count <= maxLeafSize) {
+            node.leftOrFirst = first;
+            node.count = count;
+            nodes[nodeIndex] = node;
+            return;
+        }
+
+        int axis = 0;
+        for (int candidate = 1; candidate < 3; candidate++) {
+            if (centerMax[candidate] - centerMin[candidate] > centerMax[axis] - centerMin[axis]) {
+                axis = candidate;
+            }
+        }
+
+        float split = (centerMin[axis] + centerMax[axis]) * 0.5f;
+        Box* begin = boxes.data() + first;
+        Box* end = begin + count;
+        Box* middle = begin;
+        if (depth < maxMidpointDepth) {
+            middle = std::partition(begin, end, [&](const Box& box) { return center(box, axis) < split; });
+        }
+        if (middle == begin || middle == end) {
+            middle = begin + count / 2;
+            std::nth_element(begin, middle, end, [&](const Box& a, const Box& b) { return center(a, axis) < center(b, axis); });
+        }
+        uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+
+        uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+
+        node.leftOrFirst = leftIndex;
+        node.count = 0;
+        nodes[nodeIndex] = node;
+
+        subdivide(leftIndex, first, leftCount, depth + 1);
+        subdivide(leftIndex + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+};
+
+// Answers many rays at once against a BVH over the meshes
+//
+// Rays go through the tree four at a time. Each node's slab test is done for
+// all four rays in one go with SSE, and a subtree is only skipped once every
+// ray in the packet has missed it. Packets are spread over the thread pool
+class RayQuery {
+public:
+    // Has to be called again after meshes change
+    void build(const std::list<Mesh>& meshes) {
+        bvh.build(meshes);
+    }
+
+    const BoxBvh& getBvh() const {
+        return bvh;
+    }
+
+    // Nearest hit of one ray, walking the tree on its own
+    RayHit intersect(const Ray& ray, float maxDistance) const {
+        RayHit hit = { noMeshHandle, maxDistance };
+        if (bvh.isEmpty()) {
+            return hit;
+        }
+
+        const std::vector<BoxBvh::Node>& nodes = bvh.getNodes();
+        const std::vector<BoxBvh::Box>& boxes = bvh.getBoxes();
+
+        float distance;
+        if (!intersectRayBox(ray, nodes[0].boundsMin, nodes[0].boundsMax, 0.0f, hit.distance, distance)) {
+            return hit;
+        }
+
+        uint32_t stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const BoxBvh::Node& node = nodes[stack[--stackSize]];
+
+            if (node.isLeaf()) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    if (intersectRayBox(ray, boxes[i].boundsMin, boxes[i].boundsMax, 0.0f, hit.distance, distance) &&
+                        (hit.handle == noMeshHandle || distance < hit.distance)) {
+                        hit.handle = boxes[i].handle;
+                        hit.distance = distance;
+                    }
+                }
+                continue;
+            }
+
+            // Children are tested before they are pushed, the nearer one is visited first
+            uint32_t left = node.leftOrFirst;
+            float leftDistance;
+            float rightDistance;
+            bool leftHit = intersectRayBox(ray, nodes[left].boundsMin, nodes[left].boundsMax, 0.0f, hit.distance, leftDistance);
+            bool rightHit = intersectRayBox(ray, nodes[left + 1].boundsMin, nodes[left + 1].boundsMax, 0.0f, hit.distance, rightDistance);
+            if (leftHit && rightHit) {
+                bool leftFirst = leftDistance <= rightDistance;
+                stack[stackSize++] = leftFirst ? left + 1 : left;
+                stack[stackSize++] = leftFirst ? left : left + 1;
+            }
+            else if (leftHit) {
+                stack[stackSize++] = left;
+            }
+            else if (rightHit) {
+                stack[stackSize++] = left + 1;
+            }
+        }
+        return hit;
+    }
+
+    // Nearest hit of every ray, directions don't need to be normalized but
+    // distances are then in units of their length. Packets only pay off when
+    // neighbouring rays go roughly the same way, like camera rays, scattered
+    // sight lines are faster one at a time
+    void intersect(const Vec4* origins, const Vec4* directions, size_t count, float maxDistance, RayHit* hits, ThreadPool& pool, bool coherent = true) const {
+        size_t packetCount = (count + packetSize - 1) / packetSize;
+        pool.parallelFor(packetCount, packetsPerBatch, [&](size_t begin, size_t end) {
+            size_t first = begin * packetSize;
+            size_t last = std::min(end * packetSize, count);
+            intersectRange(origins, directions, first, last, maxDistance, hits, coherent);
+        });
+    }
+
+    // Same as above on the calling thread only
+    void intersect(const Vec4* origins, const Vec4* directions, size_t count, float maxDistance, RayHit* hits, bool coherent = true) const {
+        intersectRange(origins, directions, 0, count, maxDistance, hits, coherent);
+    }
+
+private:
+    static const int packetSize = 4;
+    static const size_t packetsPerBatch = 64;
+
+    BoxBvh bvh;
+
+    // Four rays side by side, a lane per ray
+    struct alignas(16) Packet {
+        float originX[4], originY[4], originZ[4];
+        float inverseX[4], inverseY[4], inverseZ[4];
+        float nearest[4];
+    };
+
+    // Bit i is set if ray i enters the box before its nearest hit, entry distances go to enter
+    static int slabTest(const Packet& packet, const float* boundsMin, const float* boundsMax, float* enter) {
+#if MATHLIB_SSE
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMin[0]), _mm_load_ps(packet.originX)), _mm_load_ps(packet.inverseX));
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMax[0]), _mm_load_ps(packet.originX)), _mm_load_ps(packet.inverseX));
+        __m128 slabNear = _mm_min_ps(t0, t1);
+        __m128 slabFar = _mm_max_ps(t0, t1);
+
+        t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMin[1]), _mm_load_ps(packet.originY)), _mm_load_ps(packet.inverseY));
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMax[1]), _mm_load_ps(packet.originY)), _mm_load_ps(packet.inverseY));
+        slabNear = _mm_max_ps(slabNear, _mm_min_ps(t0, t1));
+        slabFar = _mm_min_ps(slabFar, _mm_max_ps(t0, t1));
+
+        t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMin[2]), _mm_load_ps(packet.originZ)), _mm_load_ps(packet.inverseZ));
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(boundsMax[2]), _mm_load_ps(packet.originZ)), _mm_load_ps(packet.inverseZ));
+        slabNear = _mm_max_ps(slabNear, _mm_min_ps(t0, t1));
+        slabFar = _mm_min_ps(slabFar, _mm_max_ps(t0, t1));
+
+        // Starting at the origin, so entry points behind it count as 0
+        slabNear = _mm_max_ps(slabNear, _mm_setzero_ps());
+        slabFar = _mm_min_ps(slabFar, _mm_load_ps(packet.nearest));
+        _mm_storeu_ps(enter, slabNear);
+        return _mm_movemask_ps(_mm_cmple_ps(slabNear, slabFar));
+#else
+        int mask = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            const float* origin[3] = { packet.originX, packet.originY, packet.originZ };
+            const float* inverse[3] = { packet.inverseX, packet.inverseY, packet.inverseZ };
+            float slabNear = 0.0f;
+            float slabFar = packet.nearest[lane];
+            for (int axis = 0; axis < 3; axis++) {
+                float t0 = (boundsMin[axis] - origin[axis][lane]) * inverse[axis][lane];
+                float t1 = (boundsMax[axis] - origin[axis][lane]) * inverse[axis][lane];
+                slabNear = std::max(slabNear, std::min(t0, t1));
+                slabFar = std::min(slabFar, std::max(t0, t1));
+            }
+            enter[lane] = slabNear;
+            if (slabNear <= slabFar) {
+                mask |= 1 << lane;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    void intersectRange(const Vec4* origins, const Vec4* directions, size_t first, size_t last, float maxDistance, RayHit* hits, bool coherent) const {
+        if (!coherent) {
+            for (size_t i = first; i < last; i++) {
+                hits[i] = intersectSingle(origins[i], directions[i], maxDistance);
+            }
+            return;
+        }
+        for (size_t i = first; i < last; i += packetSize) {
+            size_t rayCount = std::min<size_t>(packetSize, last - i);
+            intersectPacket(origins + i, directions + i, rayCount, maxDistance, hits + i);
+        }
+    }
+
+    // Same walk as intersect(ray) with each slab test done on the three axes at once
+    RayHit intersectSingle(const Vec4& origin, const Vec4& direction, float maxDistance) const {
+#if MATHLIB_SSE
+        RayHit hit = { noMeshHandle, maxDistance };
+        if (bvh.isEmpty()) {
+            return hit;
+        }
+
+        const std::vector<BoxBvh::Node>& nodes = bvh.getNodes();
+        const std::vector<BoxBvh::Box>& boxes = bvh.getBoxes();
+
+        // Directions along an axis get a huge finite inverse, so a point on a slab gives 0 and not NaN
+        float inverse[4];
+        for (int axis = 0; axis < 3; axis++) {
+            float component = direction[axis];
+            if (std::fabs(component) < 1e-20f) {
+                component = component < 0.0f ? -1e-20f : 1e-20f;
+            }
+            inverse[axis] = 1.0f / component;
+        }
+        inverse[3] = 0.0f;
+        __m128 rayOrigin = _mm_set_ps(0.0f, origin.z, origin.y, origin.x);
+        __m128 rayInverse = _mm_loadu_ps(inverse);
+
+        float enter;
+        if (!slabTestSingle(rayOrigin, rayInverse, nodes[0].boundsMin, nodes[0].boundsMax, hit.distance, enter)) {
+            return hit;
+        }
+
+        uint32_t stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const BoxBvh::Node& node = nodes[stack[--stackSize]];
+
+            if (node.isLeaf()) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    if (slabTestSingle(rayOrigin, rayInverse, boxes[i].boundsMin, boxes[i].boundsMax, hit.distance, enter) &&
+                        (hit.handle == noMeshHandle || enter < hit.distance)) {
+                        hit.handle = boxes[i].handle;
+                        hit.distance = enter;
+                    }
+                }
+                continue;
+            }
+
+            uint32_t left = node.leftOrFirst;
+            float leftEnter;
+            float rightEnter;
+            bool leftHit = slabTestSingle(rayOrigin, rayInverse, nodes[left].boundsMin, nodes[left].boundsMax, hit.distance, leftEnter);
+            bool rightHit = slabTestSingle(rayOrigin, rayInverse, nodes[left + 1].boundsMin, nodes[left + 1].boundsMax, hit.distance, rightEnter);
+            if (leftHit && rightHit) {
+                bool leftFirst = leftEnter <= rightEnter;
+                stack[stackSize++] = leftFirst ? left + 1 : left;
+                stack[stackSize++] = leftFirst ? left : left + 1;
+            }
+            else if (leftHit) {
+                stack[stackSize++] = left;
+            }
+            else if (rightHit) {
+                stack[stackSize++] = left + 1;
+            }
+        }
+        return hit;
+#else
+        return intersect(makeRay(origin, direction), maxDistance);
+#endif
+    }
+
+#if MATHLIB_SSE
+    // The fourth lane loads whatever follows the bounds in memory, so it's
+    // overwritten with the first before the lanes are combined
+    static bool slabTestSingle(__m128 origin, __m128 inverse, const float* boundsMin, const float* boundsMax, float nearest, float& enter) {
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boundsMin), origin), inverse);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(boundsMax), origin), inverse);
+        __m128 slabNear = _mm_min_ps(t0, t1);
+        __m128 slabFar = _mm_max_ps(t0, t1);
+        slabNear = _mm_shuffle_ps(slabNear, slabNear, _MM_SHUFFLE(0, 2, 1, 0));
+        slabFar = _mm_shuffle_ps(slabFar, slabFar, _MM_SHUFFLE(0, 2, 1, 0));
+
+        slabNear = _mm_max_ps(slabNear, _mm_shuffle_ps(slabNear, slabNear, _MM_SHUFFLE(2, 3, 0, 1)));
+        slabNear = _mm_max_ps(slabNear, _mm_shuffle_ps(slabNear, slabNear, _MM_SHUFFLE(1, 0, 3, 2)));
+        slabFar = _mm_min_ps(slabFar, _mm_shuffle_ps(slabFar, slabFar, _MM_SHUFFLE(2, 3, 0, 1)));
+        slabFar = _mm_min_ps(slabFar, _mm_shuffle_ps(slabFar, slabFar, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        // Starting at the origin, so entry points behind it count as 0
+        enter = std::max(_mm_cvtss_f32(slabNear), 0.0f);
+        return enter <= std::min(_mm_cvtss_f32(slabFar), nearest);
+    }
+#endif
+
+    void intersectPacket(const Vec4* origins, const Vec4* directions, size_t rayCount, float maxDistance, RayHit* hits) const {
+        Packet packet;
+        MeshHandle handles[4] = { noMeshHandle, noMeshHandle, noMeshHandle, noMeshHandle };
+
+        for (int lane = 0; lane < 4; lane++) {
+            // Missing lanes copy the first ray, a negative nearest hit keeps them out of every test
+            size_t ray = lane < static_cast<int>(rayCount) ? lane : 0;
+            packet.originX[lane] = origins[ray].x;
+            packet.originY[lane] = origins[ray].y;
+            packet.originZ[lane] = origins[ray].z;
+            packet.inverseX[lane] = 1.0f / directions[ray].x;
+            packet.inverseY[lane] = 1.0f / directions[ray].y;
+            packet.inverseZ[lane] = 1.0f / directions[ray].z;
+            packet.nearest[lane] = lane < static_cast<int>(rayCount) ? maxDistance : -1.0f;
+        }
+
+        if (!bvh.isEmpty()) {
+            traverse(packet, handles);
+        }
+
+        for (int lane = 0; lane < static_cast<int>(rayCount); lane++) {
+            hits[lane].handle = handles[lane];
+            hits[lane].distance = packet.nearest[lane];
+        }
+    }
+
+    void traverse(Packet& packet, MeshHandle* handles) const {
+        const std::vector<BoxBvh::Node>& nodes = bvh.getNodes();
+        const std::vector<BoxBvh::Box>& boxes = bvh.getBoxes();
+
+        uint32_t stack[64];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        float enter[4];
+        while (stackSize > 0) {
+            const BoxBvh::Node& node = nodes[stack[--stackSize]];
+            if (!slabTest(packet, node.boundsMin, node.boundsMax, enter)) {
+                continue;
+            }
+
+            if (node.isLeaf()) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    int mask = slabTest(packet, boxes[i].boundsMin, boxes[i].boundsMax, enter);
+                    for (int lane = 0; mask; lane++, mask >>= 1) {
+                        if ((mask & 1) && (handles[lane] == noMeshHandle || enter[lane] < packet.nearest[lane])) {
+                            handles[lane] = boxes[i].handle;
+                            packet.nearest[lane] = enter[lane];
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // Nearer child goes on top so it shrinks the nearest hits before the other is tested
+            uint32_t left = node.leftOrFirst;
+            float leftEnter[4];
+            float rightEnter[4];
+            int leftMask = slabTest(packet, nodes[left].boundsMin, nodes[left].boundsMax, leftEnter);
+            int rightMask = slabTest(packet, nodes[left + 1].boundsMin, nodes[left + 1].boundsMax, rightEnter);
+            bool leftFirst = firstEntry(leftMask, leftEnter) <= firstEntry(rightMask, rightEnter);
+
+            uint32_t first = leftFirst ? left : left + 1;
+            uint32_t second = leftFirst ? left + 1 : left;
+            int firstMask = leftFirst ? leftMask : rightMask;
+            int secondMask = leftFirst ? rightMask : leftMask;
+            if (secondMask) {
+                stack[stackSize++] = second;
+            }
+            if (firstMask) {
+                stack[stackSize++] = first;
+            }
+        }
+    }
+
+    static float firstEntry(int mask, const float* enter) {
+        float nearest = 3.4e38f;
+        for (int lane = 0; mask; lane++, mask >>= 1) {
+            if (mask & 1) {
+                nearest = std::min(nearest, enter[lane]);
+            }
+        }
+        return nearest;
+    }
+};
@@ -0,0 +1,268 @@
+#pragma once
+
+#include "GLExtensions.h"
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Shadow copy of the GL state the engine changes, calls that wouldn't change
+// anything are dropped before they reach the driver
+class GLStateCache {
+public:
+    // Forgets everything, the next call of each kind always goes through
+    void reset() {
+        depthTestKnown = false;
+        blendKnown = false;
+        blendFuncKnown = false;
+        textureKnown = false;
+        programKnown = false;
+        scissorTestKnown = false;
+    }
+
+    void setDepthTest(bool enabled) {
+        if (depthTestKnown && depthTest == enabled) {
+            avoided++;
+            return;
+        }
+        enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+        depthTest = enabled;
+        depthTestKnown = true;
+        issued++;
+    }
+
+    void setScissorTest(bool enabled) {
+        if (scissorTestKnown && scissorTest == enabled) {
+            avoided++;
+            return;
+        }
+        enabled ? glEnable(GL_SCISSOR_TEST) : glDisable(GL_SCISSOR_TEST);
+        scissorTest = enabled;
+        scissorTestKnown = true;
+        issued++;
+    }
+
+    void setBlend(bool enabled) {
+        if (blendKnown && blend == enabled) {
+            avoided++;
+            return;
+        }
+        enabled ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+        blend = enabled;
+        blendKnown = true;
+        issued++;
+    }
+
+    void setBlendFunc(GLenum source, GLenum destination) {
+        if (blendFuncKnown && blendSource == source && blendDestination == destination) {
+            avoided++;
+            return;
+        }
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+        blendFuncKnown = true;
+        issued++;
+    }
+
+    // 0 turns texturing off
+    void bindTexture(GLuint texture) {
+        if (textureKnown && boundTexture == texture) {
+            avoided++;
+            return;
+        }
+        if (texture) {
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, texture);
+        }
+        else {
+            glDisable(GL_TEXTURE_2D);
+        }
+        boundTexture = texture;
+        textureKnown = true;
+        issued++;
+    }
+
+    // 0 is the fixed function pipeline
+    void useProgram(GLuint program) {
+        if (programKnown && currentProgram == program) {
+            avoided++;
+            return;
+        }
+        if (glext::UseProgram) {
+            glext::UseProgram(program);
+        }
+        currentProgram = program;
+        programKnown = true;
+        issued++;
+    }
+
+    uint64_t getIssuedCount() const {
+        return issued;
+    }
+
+    uint64_t getAvoidedCount() const {
+        return avoided;
+    }
+
+private:
+    bool depthTest = false;
+    bool scissorTest = false;
+    bool blend = false;
+    GLenum blendSource = GL_ONE;
+    GLenum blendDestination = GL_ZERO;
+    GLuint boundTexture = 0;
+    GLuint currentProgram = 0;
+
+    bool depthTestKnown = false;
+    bool scissorTestKnown = false;
+    bool blendKnown = false;
+    bool blendFuncKnown = false;
+    bool textureKnown = false;
+    bool programKnown = false;
+
+    uint64_t issued = 0;
+    uint64_t avoided = 0;
+};
+
+// Passes in the order they are drawn, they make up the top bits of a sort key
+enum RenderPass : uint8_t {
+    PassOpaque,
+    PassTransparent,
+    PassOverlay,
+    PassCount,
+};
+
+// Fixed state of each pass
+struct PassState {
+    bool depthTest;
+    bool blend;
+    GLenum blendSource;
+    GLenum blendDestination;
+};
+
+// Builds the 64 bit key draws are sorted by
+//
+// | pass 4 | shader 12 | texture 16 | depth 32 |
+//
+// Opaque draws go front to back so the depth test rejects more, transparent
+// draws go back to front so they blend correctly
+inline uint64_t makeSortKey(RenderPass pass, GLuint program, GLuint texture, float depth) {
+    // Positive floats sort the same as their bits
+    if (!(depth > 0.0f)) {
+        depth = 0.0f;
+    }
+    uint32_t depthBits;
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+    if (pass == PassTransparent) {
+        depthBits = ~depthBits;
+    }
+
+    return (static_cast<uint64_t>(pass & 0xF) << 60) |
+        (static_cast<uint64_t>(program & 0xFFF) << 48) |
+        (static_cast<uint64_t>(texture & 0xFFFF) << 32) |
+        depthBits;
+}
+
+// Collects the draws of a frame, sorts them by key and runs them with as few
+// state changes as possible
+class RenderQueue {
+public:
+    using DrawFunction = void (*)(const void* data);
+
+    RenderQueue() {
+        passStates[PassOpaque] = { true, false, GL_ONE, GL_ZERO };
+        passStates[PassTransparent] = { true, true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA };
+        passStates[PassOverlay] = { false, true, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA };
+    }
+
+    void clear() {
+        items.clear();
+        order.clear();
+    }
+
+    // data has to stay alive until execute
+    void submit(RenderPass pass, GLuint program, GLuint texture, float depth, DrawFunction draw, const void* data) {
+        uint32_t index = static_cast<uint32_t>(items.size());
+        items.push_back({ pass, program, texture, draw, data });
+        order.push_back({ makeSortKey(pass, program, texture, depth), index });
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+
+    // LSD radix sort of the keys, one byte per pass, bytes every key shares are skipped
+    void sort() {
+        size_t count = order.size();
+        scratch.resize(count);
+
+        SortEntry* source = order.data();
+        SortEntry* destination = scratch.data();
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t histogram[256] = { 0 };
+            for (size_t i = 0; i < count; i++) {
+                histogram[(source[i].key >> shift) & 0xFF]++;
+            }
+
+            if (count == 0 || histogram[(source[0].key >> shift) & 0xFF] == count) {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; digit++) {
+                size_t digitCount = histogram[digit];
+                histogram[digit] = offset;
+                offset += digitCount;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                destination[histogram[(source[i].key >> shift) & 0xFF]++] = source[i];
+            }
+
+            std::swap(source, destination);
+        }
+
+        if (source != order.data()) {
+            order.swap(scratch);
+        }
+    }
+
+    // Runs the sorted draws, setting pass state through the cache
+    void execute(GLStateCache& cache) const {
+        for (const SortEntry& entry : order) {
+            const RenderItem& item = items[entry.index];
+            const PassState& state = passStates[item.pass];
+
+            cache.setDepthTest(state.depthTest);
+            cache.setBlend(state.blend);
+            if (state.blend) {
+                cache.setBlendFunc(state.blendSource, state.blendDestination);
+            }
+            cache.useProgram(item.program);
+            cache.bindTexture(item.texture);
+
+            item.draw(item.data);
+        }
+    }
+
+private:
+    struct RenderItem {
+        RenderPass pass;
+        GLuint program;
+        GLuint texture;
+        DrawFunction draw;
+        const void* data;
+    };
+
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    PassState passStates[PassCount];
+    std::vector<RenderItem> items;
+    std::vector<SortEntry> order;
+    std::vector<SortEntry> scratch;
+};
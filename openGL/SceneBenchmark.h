@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Camera.h"
+#include "FrustumCulling.h"
+#include "LevelOfDetail.h"
+#include "Memory.h"
+#include "Picking.h"
+#include "RayBenchmark.h"
+#include "SceneGenerator.h"
+#include "SoftwareRasterizer.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <list>
+
+// Frame time, pick latency and memory against scene size for every kind of
+// generated scene, run with --bench-scenes. Frames are drawn by the software
+// rasterizer so it runs without a GPU, the columns are meant for plotting
+
+namespace scenebench {
+
+    inline double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    inline void runScene(SceneType type, size_t boxCount, ThreadPool& pool) {
+        const int side = 512;
+        const int frameCount = 8;
+        const int pickCount = 1000;
+
+        // Everything the scene needs to be drawn and picked counts towards its memory
+        int64_t liveBefore = memory::getLiveBytes();
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        std::list<Mesh> meshes;
+        SceneBounds bounds = generateScene(type, boxCount, 1, meshes);
+        SpatialGrid grid(SpatialGrid::cellSizeFor(meshes), std::max<size_t>(size_t(1) << 16, boxCount));
+        grid.build(meshes);
+
+        Camera camera;
+        placeCamera(camera, bounds, 45.0f, 1.0f);
+        const Frustum& frustum = camera.getFrustum();
+        float eye[3] = { camera.getPosition().x, camera.getPosition().y, camera.getPosition().z };
+
+        LodSelector lod;
+        lod.select(meshes, eye, camera.getPixelsPerUnit(side), frustum);
+        double buildMilliseconds = millisecondsSince(buildStart);
+
+        SoftwareRasterizer rasterizer(side, side);
+        int64_t liveBytes = memory::getLiveBytes() - liveBefore;
+
+        // Culling, detail levels and drawing, the same steps as a frame in the window, drawn counts the boxes at full detail
+        const float clearColor[3] = { 0.0f, 0.0f, 0.0f };
+        size_t drawn = 0;
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        for (int frame = 0; frame < frameCount; frame++) {
+            lod.select(meshes, eye, camera.getPixelsPerUnit(side), frustum);
+            rasterizer.beginFrame(camera.getViewProjection(), clearColor);
+            drawn = 0;
+            size_t meshIndex = 0;
+            for (auto it = meshes.begin(); it != meshes.end(); ++it, ++meshIndex) {
+                float boxMax[3] = { it->location[0] + it->size[0], it->location[1] + it->size[1], it->location[2] + it->size[2] };
+                if (!lod.isFullDetail(meshIndex) || !frustum.intersectsBox(it->location.data(), boxMax)) {
+                    continue;
+                }
+                it->draw(rasterizer);
+                drawn++;
+            }
+            lod.draw(rasterizer);
+            rasterizer.endFrame(pool);
+        }
+        double frameMilliseconds = millisecondsSince(frameStart) / frameCount;
+
+        // Cursor rays at random pixels through the grid, like hovering
+        scenegen::Random random(7);
+        double pickTotal = 0.0;
+        double pickWorst = 0.0;
+        for (int pick = 0; pick < pickCount; pick++) {
+            Ray ray = screenRay(camera.getInverseViewProjection(), random.uniform(0.0f, side), random.uniform(0.0f, side), static_cast<float>(side), static_cast<float>(side));
+            auto pickStart = std::chrono::high_resolution_clock::now();
+            raybench::sink += grid.intersect(ray, 0.0f, 100000.0f).handle;
+            double microseconds = millisecondsSince(pickStart) * 1000.0;
+            pickTotal += microseconds;
+            pickWorst = std::max(pickWorst, microseconds);
+        }
+
+        // Vertices the proxies and impostors cost against what the boxes they stand in for would have
+        std::printf("%-8s %10zu %10.1f %10.2f %10zu %10zu %10zu %10zu %10zu %10.2f %10.2f %10.1f\n", getSceneName(type), boxCount, buildMilliseconds, frameMilliseconds, drawn,
+            lod.getProxyCount(), lod.getImpostorCount(), lod.getLodVertexCount(), lod.getReplacedVertexCount(), pickTotal / pickCount, pickWorst, liveBytes / (1024.0 * 1024.0));
+    }
+
+}
+
+// Sizes go up by ten from 1k to maxBoxes, 10M boxes need a few GB
+inline void runSceneBenchmark(size_t maxBoxes) {
+    std::printf("Scene scaling benchmark, %d x %d software frames, seed 1\n", 512, 512);
+    std::printf("%-8s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "scene", "boxes", "build ms", "frame ms", "drawn", "proxies", "impostors",
+        "lod verts", "replaced", "pick us", "worst us", "memory MB");
+
+    ThreadPool pool;
+    const SceneType types[] = { SceneType::City, SceneType::Terrain, SceneType::Clutter, SceneType::Towers };
+    for (SceneType type : types) {
+        for (size_t boxCount = 1000; boxCount <= maxBoxes; boxCount *= 10) {
+            scenebench::runScene(type, boxCount, pool);
+        }
+    }
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "Camera.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
+
+// Seeded scenes of any size for measuring how the engine scales
+//
+// Every scene has exactly the asked for number of boxes, ground included,
+// and the same type, count and seed always give the same boxes on every
+// compiler, so the random numbers come from a small hash generator and not
+// the standard distributions, whose output isn't pinned down by the standard
+enum class SceneType {
+    City,    // blocks of buildings stacked from floor boxes, split by streets
+    Terrain, // voxel height field, columns of unit cubes
+    Clutter, // boxes of all sizes scattered at a fixed density
+    Towers,  // stacks of equal crates in rows
+};
+
+// Space the generated boxes take up, for placing the camera
+struct SceneBounds {
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+namespace scenegen {
+
+    // SplitMix64, small and the same everywhere
+    class Random {
+    public:
+        explicit Random(uint64_t seed) : state(seed) {}
+
+        uint64_t next() {
+            uint64_t value = (state += 0x9E3779B97F4A7C15ull);
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+
+        // In [low, high)
+        float uniform(float low, float high) {
+            return low + (high - low) * ((next() >> 40) * (1.0f / 16777216.0f));
+        }
+
+        // In [low, high]
+        int range(int low, int high) {
+            return low + static_cast<int>(next() % static_cast<uint64_t>(high - low + 1));
+        }
+
+    private:
+        uint64_t state;
+    };
+
+    // Smooth noise in about [0, 1] from hashed lattice values, a few octaves summed
+    inline float valueNoise(float x, float z, uint32_t seed) {
+        auto lattice = [seed](int32_t ix, int32_t iz) {
+            uint32_t hash = static_cast<uint32_t>(ix) * 374761393u + static_cast<uint32_t>(iz) * 668265263u + seed * 2246822519u;
+            hash = (hash ^ (hash >> 13)) * 1274126177u;
+            return ((hash ^ (hash >> 16)) & 0xFFFF) / 65535.0f;
+        };
+
+        float total = 0.0f;
+        float amplitude = 0.5f;
+        float frequency = 1.0f;
+        for (int octave = 0; octave < 4; octave++) {
+            float fx = x * frequency;
+            float fz = z * frequency;
+            int32_t ix = static_cast<int32_t>(std::floor(fx));
+            int32_t iz = static_cast<int32_t>(std::floor(fz));
+            float tx = fx - ix;
+            float tz = fz - iz;
+            tx = tx * tx * (3.0f - 2.0f * tx);
+            tz = tz * tz * (3.0f - 2.0f * tz);
+
+            float top = lattice(ix, iz) + (lattice(ix + 1, iz) - lattice(ix, iz)) * tx;
+            float bottom = lattice(ix, iz + 1) + (lattice(ix + 1, iz + 1) - lattice(ix, iz + 1)) * tx;
+            total += (top + (bottom - top) * tz) * amplitude;
+
+            amplitude *= 0.5f;
+            frequency *= 2.0f;
+        }
+        return total / 0.9375f;
+    }
+
+    inline size_t gridSide(double cells) {
+        return std::max<size_t>(1, static_cast<size_t>(std::ceil(std::sqrt(cells))));
+    }
+
+    // Buildings on 30 unit lots, taller towards the middle, each floor its own box
+    inline void makeCity(size_t boxCount, Random& random, std::list<Mesh>& meshes, float extent) {
+        const float lot = 30.0f;
+        const float floorHeight = 3.5f;
+        size_t side = static_cast<size_t>(extent / lot);
+        float middle = extent * 0.5f;
+
+        for (size_t i = 0; meshes.size() < boxCount; i++) {
+            float lotX = (i % side) * lot;
+            float lotZ = (i / side % side) * lot;
+            float raised = lot * (i / (side * side)); // a second layer on top if the lots run out
+
+            float toMiddle = std::sqrt((lotX - middle) * (lotX - middle) + (lotZ - middle) * (lotZ - middle)) / middle;
+            int floors = random.range(2, 4 + static_cast<int>(26.0f * std::max(0.0f, 1.0f - toMiddle)));
+            float width = random.uniform(10.0f, 22.0f);
+            float depth = random.uniform(10.0f, 22.0f);
+            float x = lotX + (lot - width) * 0.5f;
+            float z = lotZ + (lot - depth) * 0.5f;
+            float shade = random.uniform(90.0f, 200.0f);
+
+            for (int level = 0; level < floors && meshes.size() < boxCount; level++) {
+                // Narrower every ten floors
+                float inset = static_cast<float>(level / 10) * 1.5f;
+                float y = raised + level * floorHeight;
+                meshes.push_back({ { x + inset, y, z + inset }, { width - 2.0f * inset, floorHeight, depth - 2.0f * inset }, { shade, shade, shade * 1.05f } });
+            }
+        }
+    }
+
+    // Columns of unit cubes up to the noise height, colored by height like sand, grass, rock and snow
+    inline void makeTerrain(size_t boxCount, uint32_t seed, std::list<Mesh>& meshes, size_t side) {
+        const int maxHeight = 16;
+        for (size_t i = 0; meshes.size() < boxCount; i++) {
+            size_t column = i % (side * side);
+            float x = static_cast<float>(column % side);
+            float z = static_cast<float>(column / side);
+            float raised = static_cast<float>(maxHeight * (i / (side * side)));
+
+            int height = 1 + static_cast<int>(valueNoise(x / 48.0f, z / 48.0f, seed) * maxHeight);
+            for (int y = 0; y < height && meshes.size() < boxCount; y++) {
+                float level = static_cast<float>(y) / maxHeight;
+                std::array<float, 3> color = level < 0.25f ? std::array<float, 3>{ 194, 178, 128 } :
+                    level < 0.55f ? std::array<float, 3>{ 70, 150, 60 } :
+                    level < 0.8f ? std::array<float, 3>{ 120, 115, 110 } : std::array<float, 3>{ 240, 240, 245 };
+                meshes.push_back({ { x, raised + y, z }, { 1.0f, 1.0f, 1.0f }, color });
+            }
+        }
+    }
+
+    inline void makeClutter(size_t boxCount, Random& random, std::list<Mesh>& meshes, float extent) {
+        while (meshes.size() < boxCount) {
+            float sizeX = random.uniform(0.5f, 6.0f);
+            float sizeY = random.uniform(0.5f, 6.0f);
+            float sizeZ = random.uniform(0.5f, 6.0f);
+            float x = random.uniform(0.0f, extent - sizeX);
+            float y = random.uniform(0.0f, 50.0f);
+            float z = random.uniform(0.0f, extent - sizeZ);
+            meshes.push_back({ { x, y, z }, { sizeX, sizeY, sizeZ }, { random.uniform(40.0f, 255.0f), random.uniform(40.0f, 255.0f), random.uniform(40.0f, 255.0f) } });
+        }
+    }
+
+    // Crates stacked exactly on each other, so they rest when the physics runs
+    inline void makeTowers(size_t boxCount, Random& random, std::list<Mesh>& meshes, float extent) {
+        const float spacing = 6.0f;
+        const float crate = 2.0f;
+        size_t side = static_cast<size_t>(extent / spacing);
+
+        for (size_t i = 0; meshes.size() < boxCount; i++) {
+            float x = (i % side) * spacing;
+            float z = (i / side % side) * spacing;
+            float raised = 40.0f * crate * (i / (side * side));
+            int height = random.range(5, 40);
+            std::array<float, 3> color = { random.uniform(120.0f, 220.0f), random.uniform(80.0f, 160.0f), random.uniform(40.0f, 100.0f) };
+            for (int level = 0; level < height && meshes.size() < boxCount; level++) {
+                meshes.push_back({ { x, raised + level * crate, z }, { crate, crate, crate }, color, true });
+            }
+        }
+    }
+
+}
+
+inline const char* getSceneName(SceneType type) {
+    switch (type) {
+    case SceneType::City:
+        return "city";
+    case SceneType::Terrain:
+        return "terrain";
+    case SceneType::Clutter:
+        return "clutter";
+    case SceneType::Towers:
+        return "towers";
+    }
+    return "unknown";
+}
+
+// False if the name isn't one of city, terrain, clutter or towers
+inline bool parseSceneType(const char* name, SceneType& type) {
+    const SceneType types[] = { SceneType::City, SceneType::Terrain, SceneType::Clutter, SceneType::Towers };
+    for (SceneType candidate : types) {
+        if (std::strcmp(name, getSceneName(candidate)) == 0) {
+            type = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds boxCount boxes to meshes, the first one is the ground. The area grows
+// with the count so the density stays about the same at every size
+inline SceneBounds generateScene(SceneType type, size_t boxCount, uint32_t seed, std::list<Mesh>& meshes) {
+    scenegen::Random random(seed * 0x2545F4914F6CDD1Dull + static_cast<uint64_t>(type));
+
+    // Boxes each part of the area holds on average, sets how big the area is
+    float extent = 0.0f;
+    switch (type) {
+    case SceneType::City:
+        extent = scenegen::gridSide(boxCount / 9.0) * 30.0f;
+        break;
+    case SceneType::Terrain:
+        extent = static_cast<float>(scenegen::gridSide(boxCount / 8.5));
+        break;
+    case SceneType::Clutter:
+        extent = std::sqrt(static_cast<float>(boxCount)) * 10.0f;
+        break;
+    case SceneType::Towers:
+        extent = scenegen::gridSide(boxCount / 22.5) * 6.0f;
+        break;
+    }
+
+    size_t first = meshes.size();
+    boxCount += first;
+    meshes.push_back({ { -10.0f, -1.0f, -10.0f }, { extent + 20.0f, 1.0f, extent + 20.0f }, { 60, 110, 50 } });
+
+    switch (type) {
+    case SceneType::City:
+        scenegen::makeCity(boxCount, random, meshes, extent);
+        break;
+    case SceneType::Terrain:
+        scenegen::makeTerrain(boxCount, seed, meshes, static_cast<size_t>(extent));
+        break;
+    case SceneType::Clutter:
+        scenegen::makeClutter(boxCount, random, meshes, extent);
+        break;
+    case SceneType::Towers:
+        scenegen::makeTowers(boxCount, random, meshes, extent);
+        break;
+    }
+
+    SceneBounds bounds = { { 1e30f, 1e30f, 1e30f }, { -1e30f, -1e30f, -1e30f } };
+    auto it = meshes.begin();
+    std::advance(it, first);
+    for (; it != meshes.end(); ++it) {
+        for (int axis = 0; axis < 3; axis++) {
+            bounds.boundsMin[axis] = std::min(bounds.boundsMin[axis], it->location[axis]);
+            bounds.boundsMax[axis] = std::max(bounds.boundsMax[axis], it->location[axis] + it->size[axis]);
+        }
+    }
+    return bounds;
+}
+
+// Puts the camera above the near edge of the scene looking in over it. The
+// far plane is pulled in to just past the far side of the scene, a huge
+// range would leave little depth precision between stacked boxes
+inline void placeCamera(Camera& camera, const SceneBounds& bounds, float fieldOfView, float aspect) {
+    float extent[3];
+    for (int axis = 0; axis < 3; axis++) {
+        extent[axis] = bounds.boundsMax[axis] - bounds.boundsMin[axis];
+    }
+    float centerX = (bounds.boundsMin[0] + bounds.boundsMax[0]) * 0.5f;
+    float height = bounds.boundsMax[1] * 1.2f + std::max(extent[0], extent[2]) * 0.1f;
+    float back = std::max(extent[2] * 0.05f, 10.0f);
+    camera.setPosition(centerX, height, bounds.boundsMax[2] + back);
+    camera.setRotation(-25.0f, -90.0f);
+
+    float farthest = std::sqrt(extent[0] * extent[0] * 0.25f + height * height + (extent[2] + back) * (extent[2] + back));
+    camera.setPerspective(fieldOfView, aspect, 0.5f, std::max(farthest * 1.1f, 1000.0f));
+}
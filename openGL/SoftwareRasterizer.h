@@ -0,0 +1,512 @@
+#pragma once
+
+#include "Image.h"
+#include "LevelOfDetail.h"
+#include "MathLib.h"
+#include "Mesh.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if MATHLIB_SSE
+#include <emmintrin.h>
+#endif
+
+// Renders boxes on the CPU, for machines without a GPU
+//
+// Meshes are drawn the same way as with GL, Mesh::draw(rasterizer) instead
+// of Mesh::draw(). Drawing only sets up triangles and sorts them into the
+// screen tiles they touch, endFrame then fills the tiles in parallel, each
+// tile on one thread so no two threads ever write the same pixel. Edge
+// functions are tested four pixels at a time. Each tile keeps the farthest
+// depth of every 8x8 block in it, so triangles behind what's already drawn
+// are dropped for a whole block or tile without testing a pixel. Output
+// matches the GL path, flat unlit colors with a less-than depth test
+class SoftwareRasterizer {
+public:
+    static const int tileSize = 64;
+    static const int blockSize = 8;
+    static const int blocksPerTile = (tileSize / blockSize) * (tileSize / blockSize);
+
+    bool hierarchicalDepth = true; // off tests every covered pixel, for comparing
+
+    SoftwareRasterizer(int width, int height) {
+        resize(width, height);
+    }
+
+    void resize(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+        tilesX = (width + tileSize - 1) / tileSize;
+        tilesY = (height + tileSize - 1) / tileSize;
+
+        // Buffers are padded to whole tiles so the pixel loops never check the edge
+        stride = tilesX * tileSize;
+        colorBuffer.assign(static_cast<size_t>(stride) * tilesY * tileSize, 0);
+        depthBuffer.assign(colorBuffer.size(), 1.0f);
+        bins.resize(static_cast<size_t>(tilesX) * tilesY);
+    }
+
+    // Starts a frame cleared to an RGB color in 0-1, viewProjection is column major like the camera's
+    void beginFrame(const Mat4& newViewProjection, const float* clearColor) {
+        viewProjection = newViewProjection;
+        clearValue = packColor(clearColor[0] * 255.0f, clearColor[1] * 255.0f, clearColor[2] * 255.0f);
+        triangles.clear();
+        for (std::vector<uint32_t>& bin : bins) {
+            bin.clear();
+        }
+        binnedCount = 0;
+        hiddenCount.store(0, std::memory_order_relaxed);
+    }
+
+    // Sets up the 12 triangles of a box and bins the ones facing the camera, color is 0-255 RGB
+    void drawBox(const float* boxMin, const float* boxMax, const float* color) {
+        Vec4 clip[8];
+        for (int i = 0; i < 8; i++) {
+            Vec4 corner = makePoint((i & 1) ? boxMax[0] : boxMin[0], (i & 2) ? boxMax[1] : boxMin[1], (i & 4) ? boxMax[2] : boxMin[2]);
+            clip[i] = viewProjection * corner;
+        }
+
+        // Whole box outside one plane of the frustum
+        for (int axis = 0; axis < 3; axis++) {
+            bool allBelow = true;
+            bool allAbove = true;
+            for (int i = 0; i < 8; i++) {
+                allBelow = allBelow && clip[i][axis] < -clip[i].w;
+                allAbove = allAbove && clip[i][axis] > clip[i].w;
+            }
+            if (allBelow || allAbove) {
+                return;
+            }
+        }
+
+        // Corners indexed by the bits x=1, y=2, z=4, counter clockwise seen from outside
+        static const int faces[6][4] = {
+            { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, // z min, z max
+            { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, // y min, y max
+            { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, // x min, x max
+        };
+
+        uint32_t packed = packColor(color[0], color[1], color[2]);
+        for (int face = 0; face < 6; face++) {
+            const int* f = faces[face];
+            addTriangle(clip[f[0]], clip[f[1]], clip[f[2]], packed);
+            addTriangle(clip[f[0]], clip[f[2]], clip[f[3]], packed);
+        }
+    }
+
+    // Sets up one triangle, counter clockwise seen from the front, and bins it if it faces the camera
+    void drawTriangle(const float* a, const float* b, const float* c, const float* color) {
+        Vec4 clipA = viewProjection * makePoint(a[0], a[1], a[2]);
+        Vec4 clipB = viewProjection * makePoint(b[0], b[1], b[2]);
+        Vec4 clipC = viewProjection * makePoint(c[0], c[1], c[2]);
+        addTriangle(clipA, clipB, clipC, packColor(color[0], color[1], color[2]));
+    }
+
+    // Fills every tile from its bin, returns once the frame is in the buffers
+    void endFrame(ThreadPool& pool) {
+        pool.parallelFor(bins.size(), 1, [this](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++) {
+                rasterizeTile(static_cast<int>(tile));
+            }
+        });
+    }
+
+    // Saves the frame as a PPM image
+    bool writeImage(const char* path) const {
+        std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+        for (int y = 0; y < height; y++) {
+            const uint32_t* pixels = &colorBuffer[static_cast<size_t>(y) * stride];
+            uint8_t* row = &rgb[static_cast<size_t>(y) * width * 3];
+            for (int x = 0; x < width; x++) {
+                row[x * 3 + 0] = static_cast<uint8_t>(pixels[x]);
+                row[x * 3 + 1] = static_cast<uint8_t>(pixels[x] >> 8);
+                row[x * 3 + 2] = static_cast<uint8_t>(pixels[x] >> 16);
+            }
+        }
+        return writePpm(path, width, height, rgb.data());
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    // RGBA8 of a pixel, row 0 at the top
+    uint32_t getPixel(int x, int y) const {
+        return colorBuffer[static_cast<size_t>(y) * stride + x];
+    }
+
+    // Depth of a pixel, 0 at the near plane and 1 at the far plane or where nothing was drawn
+    float getDepth(int x, int y) const {
+        return depthBuffer[static_cast<size_t>(y) * stride + x];
+    }
+
+    // Triangles set up this frame, after facing and clipping
+    size_t getTriangleCount() const {
+        return triangles.size();
+    }
+
+    // Triangle and tile pairs in the bins
+    size_t getBinnedCount() const {
+        return binnedCount;
+    }
+
+    // Times the depth hierarchy dropped a triangle from a tile or block without testing a pixel
+    size_t getHiddenCount() const {
+        return hiddenCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Screen space setup, each value at a pixel is a * x + b * y + c
+    struct Triangle {
+        float edgeA[3], edgeB[3], edgeC[3]; // >= 0 on all three inside, not scaled by the area
+        float depthA, depthB, depthC;
+        float nearestDepth, farthestDepth; // depths at the corners, what's between can't be outside them
+        int minX, minY, maxX, maxY; // pixel bounds, clamped to the screen
+        uint32_t color;
+    };
+
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<uint32_t> colorBuffer;
+    std::vector<float> depthBuffer;
+
+    Mat4 viewProjection;
+    uint32_t clearValue = 0;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins; // triangle indices per tile, in draw order
+    size_t binnedCount = 0;
+    std::atomic<size_t> hiddenCount{ 0 };
+
+    static uint32_t packColor(float r, float g, float b) {
+        uint32_t red = static_cast<uint32_t>(std::min(std::max(r, 0.0f), 255.0f));
+        uint32_t green = static_cast<uint32_t>(std::min(std::max(g, 0.0f), 255.0f));
+        uint32_t blue = static_cast<uint32_t>(std::min(std::max(b, 0.0f), 255.0f));
+        return red | (green << 8) | (blue << 16) | 0xFF000000u;
+    }
+
+    static Vec4 lerp(const Vec4& a, const Vec4& b, float t) {
+        return a + (b - a) * t;
+    }
+
+    // Clips against the near plane, z >= -w, which leaves up to a quad to split in two
+    void addTriangle(const Vec4& a, const Vec4& b, const Vec4& c, uint32_t color) {
+        const Vec4* input[3] = { &a, &b, &c };
+        float distance[3];
+        int insideCount = 0;
+        for (int i = 0; i < 3; i++) {
+            distance[i] = input[i]->z + input[i]->w;
+            insideCount += distance[i] >= 0.0f;
+        }
+        if (insideCount == 0) {
+            return;
+        }
+        if (insideCount == 3) {
+            setupTriangle(a, b, c, color);
+            return;
+        }
+
+        Vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; i++) {
+            int next = (i + 1) % 3;
+            if (distance[i] >= 0.0f) {
+                polygon[count++] = *input[i];
+            }
+            if ((distance[i] >= 0.0f) != (distance[next] >= 0.0f)) {
+                polygon[count++] = lerp(*input[i], *input[next], distance[i] / (distance[i] - distance[next]));
+            }
+        }
+        setupTriangle(polygon[0], polygon[1], polygon[2], color);
+        if (count == 4) {
+            setupTriangle(polygon[0], polygon[2], polygon[3], color);
+        }
+    }
+
+    void setupTriangle(const Vec4& a, const Vec4& b, const Vec4& c, uint32_t color) {
+        // To pixels with row 0 at the top, and depth in [0, 1]
+        float screen[3][3];
+        const Vec4* clip[3] = { &a, &b, &c };
+        for (int i = 0; i < 3; i++) {
+            float inverseW = 1.0f / clip[i]->w;
+            screen[i][0] = (clip[i]->x * inverseW * 0.5f + 0.5f) * width;
+            screen[i][1] = (0.5f - clip[i]->y * inverseW * 0.5f) * height;
+            screen[i][2] = clip[i]->z * inverseW * 0.5f + 0.5f;
+        }
+
+        // Counter clockwise turns clockwise once y points down, so front faces have a negative area
+        float area = (screen[1][0] - screen[0][0]) * (screen[2][1] - screen[0][1]) - (screen[1][1] - screen[0][1]) * (screen[2][0] - screen[0][0]);
+        if (area > -1e-8f) {
+            return;
+        }
+
+        Triangle triangle;
+        float boundsMinX = std::min(screen[0][0], std::min(screen[1][0], screen[2][0]));
+        float boundsMinY = std::min(screen[0][1], std::min(screen[1][1], screen[2][1]));
+        float boundsMaxX = std::max(screen[0][0], std::max(screen[1][0], screen[2][0]));
+        float boundsMaxY = std::max(screen[0][1], std::max(screen[1][1], screen[2][1]));
+        triangle.minX = std::max(0, static_cast<int>(std::floor(boundsMinX)));
+        triangle.minY = std::max(0, static_cast<int>(std::floor(boundsMinY)));
+        triangle.maxX = std::min(width - 1, static_cast<int>(std::ceil(boundsMaxX)));
+        triangle.maxY = std::min(height - 1, static_cast<int>(std::ceil(boundsMaxY)));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+            return;
+        }
+
+        // Edge i is opposite vertex i, sampled at pixel centers. It's worked out
+        // from its corners in a fixed order and negated if this triangle needs
+        // the other side, so two triangles sharing an edge get exactly opposite
+        // values and every pixel along it lands in at least one of them
+        float inverseArea = 1.0f / area;
+        float weightA[3], weightB[3], weightC[3];
+        for (int i = 0; i < 3; i++) {
+            const float* from = screen[(i + 1) % 3];
+            const float* to = screen[(i + 2) % 3];
+            bool swapped = to[0] < from[0] || (to[0] == from[0] && to[1] < from[1]);
+            if (swapped) {
+                std::swap(from, to);
+            }
+            float a = from[1] - to[1];
+            float b = to[0] - from[0];
+            float c = (to[1] - from[1]) * from[0] - (to[0] - from[0]) * from[1];
+            c += (a + b) * 0.5f;
+            if (swapped != (area < 0.0f)) {
+                a = -a;
+                b = -b;
+                c = -c;
+            }
+            triangle.edgeA[i] = a;
+            triangle.edgeB[i] = b;
+            triangle.edgeC[i] = c;
+
+            // The same edge scaled to the barycentric weight of vertex i
+            float scale = std::fabs(inverseArea);
+            weightA[i] = a * scale;
+            weightB[i] = b * scale;
+            weightC[i] = c * scale;
+        }
+
+        // Depth after the divide is linear in screen space
+        triangle.depthA = weightA[0] * screen[0][2] + weightA[1] * screen[1][2] + weightA[2] * screen[2][2];
+        triangle.depthB = weightB[0] * screen[0][2] + weightB[1] * screen[1][2] + weightB[2] * screen[2][2];
+        triangle.depthC = weightC[0] * screen[0][2] + weightC[1] * screen[1][2] + weightC[2] * screen[2][2];
+        triangle.nearestDepth = std::min(screen[0][2], std::min(screen[1][2], screen[2][2]));
+        triangle.farthestDepth = std::max(screen[0][2], std::max(screen[1][2], screen[2][2]));
+        triangle.color = color;
+
+        uint32_t index = static_cast<uint32_t>(triangles.size());
+        triangles.push_back(triangle);
+
+        // Into the bins of the tiles under its bounds that aren't wholly outside one edge
+        for (int tileY = triangle.minY / tileSize; tileY <= triangle.maxY / tileSize; tileY++) {
+            for (int tileX = triangle.minX / tileSize; tileX <= triangle.maxX / tileSize; tileX++) {
+                if (outsideRect(triangle, tileX * tileSize, tileY * tileSize, tileSize)) {
+                    continue;
+                }
+                bins[tileY * tilesX + tileX].push_back(index);
+                binnedCount++;
+            }
+        }
+    }
+
+    // True if a square of pixels starting at x, y is wholly outside one of the edges
+    static bool outsideRect(const Triangle& triangle, int x, int y, int size) {
+        for (int i = 0; i < 3; i++) {
+            // The corner farthest along the inside of the edge
+            float cornerX = static_cast<float>(triangle.edgeA[i] > 0.0f ? x + size - 1 : x);
+            float cornerY = static_cast<float>(triangle.edgeB[i] > 0.0f ? y + size - 1 : y);
+            if (triangle.edgeA[i] * cornerX + triangle.edgeB[i] * cornerY + triangle.edgeC[i] < 0.0f) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // True if a square of pixels is wholly inside all three edges
+    static bool insideRect(const Triangle& triangle, int x, int y, int size) {
+        for (int i = 0; i < 3; i++) {
+            float cornerX = static_cast<float>(triangle.edgeA[i] > 0.0f ? x : x + size - 1);
+            float cornerY = static_cast<float>(triangle.edgeB[i] > 0.0f ? y : y + size - 1);
+            if (triangle.edgeA[i] * cornerX + triangle.edgeB[i] * cornerY + triangle.edgeC[i] < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void rasterizeTile(int tile) {
+        int tileX = (tile % tilesX) * tileSize;
+        int tileY = (tile / tilesX) * tileSize;
+
+        for (int y = tileY; y < tileY + tileSize; y++) {
+            std::fill_n(&colorBuffer[static_cast<size_t>(y) * stride + tileX], tileSize, clearValue);
+            std::fill_n(&depthBuffer[static_cast<size_t>(y) * stride + tileX], tileSize, 1.0f);
+        }
+
+        // Farthest depth in each block and in the whole tile
+        const int blocksAcross = tileSize / blockSize;
+        float blockFarthest[blocksPerTile];
+        std::fill_n(blockFarthest, blocksPerTile, 1.0f);
+        float tileFarthest = 1.0f;
+        size_t hidden = 0;
+
+        for (uint32_t index : bins[tile]) {
+            const Triangle& triangle = triangles[index];
+            if (hierarchicalDepth && triangle.nearestDepth >= tileFarthest) {
+                hidden++;
+                continue;
+            }
+
+            int blockX0 = (std::max(triangle.minX, tileX) - tileX) / blockSize;
+            int blockY0 = (std::max(triangle.minY, tileY) - tileY) / blockSize;
+            int blockX1 = (std::min(triangle.maxX, tileX + tileSize - 1) - tileX) / blockSize;
+            int blockY1 = (std::min(triangle.maxY, tileY + tileSize - 1) - tileY) / blockSize;
+
+            bool changed = false;
+            for (int blockY = blockY0; blockY <= blockY1; blockY++) {
+                for (int blockX = blockX0; blockX <= blockX1; blockX++) {
+                    int block = blockY * blocksAcross + blockX;
+                    int x = tileX + blockX * blockSize;
+                    int y = tileY + blockY * blockSize;
+                    if (hierarchicalDepth && triangle.nearestDepth >= blockFarthest[block]) {
+                        hidden++;
+                        continue;
+                    }
+                    if (outsideRect(triangle, x, y, blockSize)) {
+                        continue;
+                    }
+                    if (rasterizeBlock(triangle, x, y, insideRect(triangle, x, y, blockSize)) && hierarchicalDepth) {
+                        blockFarthest[block] = farthestInBlock(x, y);
+                        changed = true;
+                    }
+                }
+            }
+
+            if (changed) {
+                tileFarthest = *std::max_element(blockFarthest, blockFarthest + blocksPerTile);
+            }
+        }
+
+        hiddenCount.fetch_add(hidden, std::memory_order_relaxed);
+    }
+
+    float farthestInBlock(int x, int y) const {
+        float farthest = 0.0f;
+        for (int row = y; row < y + blockSize; row++) {
+            const float* depth = &depthBuffer[static_cast<size_t>(row) * stride + x];
+            for (int i = 0; i < blockSize; i++) {
+                farthest = std::max(farthest, depth[i]);
+            }
+        }
+        return farthest;
+    }
+
+    // Depth tests and writes one block, a block wholly inside skips the edge tests. True if any pixel was written
+    bool rasterizeBlock(const Triangle& triangle, int x, int y, bool covered) {
+        bool written = false;
+#if MATHLIB_SSE
+        const __m128 offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        __m128 edgeStep[3];
+        for (int i = 0; i < 3; i++) {
+            edgeStep[i] = _mm_set1_ps(triangle.edgeA[i] * 4.0f);
+        }
+        const __m128 depthStep = _mm_set1_ps(triangle.depthA * 4.0f);
+        const __m128 color = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(triangle.color)));
+        const __m128 nearest = _mm_set1_ps(triangle.nearestDepth);
+        const __m128 farthest = _mm_set1_ps(triangle.farthestDepth);
+
+        for (int row = y; row < y + blockSize; row++) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+            __m128 py = _mm_set1_ps(static_cast<float>(row));
+            __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.depthA)), _mm_mul_ps(py, _mm_set1_ps(triangle.depthB))), _mm_set1_ps(triangle.depthC));
+            __m128 edge[3];
+            for (int i = 0; i < 3; i++) {
+                edge[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.edgeA[i])), _mm_mul_ps(py, _mm_set1_ps(triangle.edgeB[i]))), _mm_set1_ps(triangle.edgeC[i]));
+            }
+
+            float* depthRow = &depthBuffer[static_cast<size_t>(row) * stride + x];
+            float* colorRow = reinterpret_cast<float*>(&colorBuffer[static_cast<size_t>(row) * stride + x]);
+            for (int i = 0; i < blockSize; i += 4) {
+                // Slivers have steep slopes that lose precision far from the origin, clamping keeps them behind what covers them
+                __m128 clamped = _mm_min_ps(_mm_max_ps(depth, nearest), farthest);
+                __m128 stored = _mm_loadu_ps(depthRow + i);
+                __m128 mask = _mm_cmplt_ps(clamped, stored);
+                if (!covered) {
+                    __m128 zero = _mm_setzero_ps();
+                    mask = _mm_and_ps(mask, _mm_cmpge_ps(edge[0], zero));
+                    mask = _mm_and_ps(mask, _mm_cmpge_ps(edge[1], zero));
+                    mask = _mm_and_ps(mask, _mm_cmpge_ps(edge[2], zero));
+                }
+
+                if (_mm_movemask_ps(mask)) {
+                    _mm_storeu_ps(depthRow + i, _mm_or_ps(_mm_and_ps(mask, clamped), _mm_andnot_ps(mask, stored)));
+                    __m128 oldColor = _mm_loadu_ps(colorRow + i);
+                    _mm_storeu_ps(colorRow + i, _mm_or_ps(_mm_and_ps(mask, color), _mm_andnot_ps(mask, oldColor)));
+                    written = true;
+                }
+
+                depth = _mm_add_ps(depth, depthStep);
+                for (int e = 0; e < 3; e++) {
+                    edge[e] = _mm_add_ps(edge[e], edgeStep[e]);
+                }
+            }
+        }
+#else
+        for (int row = y; row < y + blockSize; row++) {
+            float* depthRow = &depthBuffer[static_cast<size_t>(row) * stride];
+            uint32_t* colorRow = &colorBuffer[static_cast<size_t>(row) * stride];
+            for (int column = x; column < x + blockSize; column++) {
+                float px = static_cast<float>(column);
+                float py = static_cast<float>(row);
+                if (!covered) {
+                    bool inside = true;
+                    for (int i = 0; i < 3; i++) {
+                        inside = inside && triangle.edgeA[i] * px + triangle.edgeB[i] * py + triangle.edgeC[i] >= 0.0f;
+                    }
+                    if (!inside) {
+                        continue;
+                    }
+                }
+                // Slivers have steep slopes that lose precision far from the origin, clamping keeps them behind what covers them
+                float depth = triangle.depthA * px + triangle.depthB * py + triangle.depthC;
+                depth = std::min(std::max(depth, triangle.nearestDepth), triangle.farthestDepth);
+                if (depth < depthRow[column]) {
+                    depthRow[column] = depth;
+                    colorRow[column] = triangle.color;
+                    written = true;
+                }
+            }
+        }
+#endif
+        return written;
+    }
+};
+
+// Same box as the GL draw, into the rasterizer's bins
+inline void Mesh::draw(SoftwareRasterizer& target) const {
+    float boxMax[3] = { location[0] + size[0], location[1] + size[1], location[2] + size[2] };
+    target.drawBox(location.data(), boxMax, color.data());
+}
+
+inline void LodSelector::draw(SoftwareRasterizer& target) const {
+    for (uint32_t index : proxyClusters) {
+        const Cluster& cluster = clusters[index];
+        target.drawBox(cluster.boxMin, cluster.boxMax, cluster.color);
+    }
+    for (uint32_t first : impostorVertices) {
+        const BoxVertex* quad = &proxyVertices[first];
+        float color[3] = { static_cast<float>(quad[0].color[0]), static_cast<float>(quad[0].color[1]), static_cast<float>(quad[0].color[2]) };
+        target.drawTriangle(quad[0].position, quad[1].position, quad[2].position, color);
+        target.drawTriangle(quad[0].position, quad[2].position, quad[3].position, color);
+    }
+}
@@ -0,0 +1,451 @@
+#pragma once
+
+#include "Mesh.h"
+#include "Picking.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+// Uniform grid over the mesh boxes, hashed so it needs no bounds
+//
+// A box no bigger than a cell covers at most 2 x 2 x 2 cells and is listed
+// in the bucket of each. Every entry remembers where it sits, so moving or
+// removing a box is a handful of swap-and-pops no matter how full the grid
+// is. Boxes bigger than a cell, like the ground, go on a separate list that
+// every query checks. Rays walk the cells they pass through in order
+// (Amanatides and Woo) and stop as soon as the next cell starts beyond the
+// nearest hit so far, or once they leave the range of cells anything has
+// been listed in, so an endless ray doesn't walk forever
+class SpatialGrid {
+public:
+    explicit SpatialGrid(float cellSize = 32.0f, size_t bucketCount = 1 << 16) {
+        reset(cellSize, bucketCount);
+    }
+
+    // Cells for the given boxes, whatever units the scene is built in. At
+    // least twice the median of their longest sides so nearly every box fits
+    // in one, and about three times the spacing between them, the side of the
+    // cube each box would get if they were spread evenly, so a sparse scene
+    // doesn't have rays stepping through cell after empty cell
+    static float cellSizeFor(const std::list<Mesh>& meshes) {
+        if (meshes.empty()) {
+            return 32.0f;
+        }
+        std::vector<float> longest;
+        longest.reserve(meshes.size());
+        float boundsMin[3] = { 1e30f, 1e30f, 1e30f };
+        float boundsMax[3] = { -1e30f, -1e30f, -1e30f };
+        for (const Mesh& mesh : meshes) {
+            longest.push_back(std::max(mesh.size[0], std::max(mesh.size[1], mesh.size[2])));
+            for (int axis = 0; axis < 3; axis++) {
+                boundsMin[axis] = std::min(boundsMin[axis], mesh.location[axis]);
+                boundsMax[axis] = std::max(boundsMax[axis], mesh.location[axis] + mesh.size[axis]);
+            }
+        }
+        auto median = longest.begin() + longest.size() / 2;
+        std::nth_element(longest.begin(), median, longest.end());
+
+        double volume = 1.0;
+        for (int axis = 0; axis < 3; axis++) {
+            volume *= boundsMax[axis] - boundsMin[axis];
+        }
+        float spacing = static_cast<float>(std::cbrt(volume / meshes.size()));
+        return std::max(std::max(*median * 2.0f, spacing * 3.0f), 1e-3f);
+    }
+
+    // Drops everything, bucketCount is rounded up to a power of two
+    void reset(float newCellSize, size_t bucketCount) {
+        cellSize = newCellSize;
+        inverseCellSize = 1.0f / newCellSize;
+        size_t power = 1;
+        while (power < bucketCount) {
+            power <<= 1;
+        }
+        buckets.assign(power, std::vector<Entry>());
+        bucketMask = static_cast<uint32_t>(power - 1);
+        records.clear();
+        largeRecords.clear();
+        recordIndices.clear();
+        for (int axis = 0; axis < 3; axis++) {
+            usedCellMin[axis] = INT32_MAX;
+            usedCellMax[axis] = INT32_MIN;
+        }
+        smallExtent = 0.0f;
+    }
+
+    void build(std::list<Mesh>& meshes) {
+        reset(cellSize, buckets.size());
+        for (Mesh& mesh : meshes) {
+            insert(mesh);
+        }
+    }
+
+    size_t size() const {
+        return records.size();
+    }
+
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    // Longest side of any box listed in cells, it only grows until the next reset
+    float getSmallExtent() const {
+        return smallExtent;
+    }
+
+    // The mesh has to stay where it is in memory until it's removed
+    void insert(Mesh& mesh) {
+        uint32_t index = static_cast<uint32_t>(records.size());
+        records.push_back(Record());
+        Record& record = records.back();
+        record.mesh = &mesh;
+        record.handle = mesh.handle;
+        recordIndices[mesh.handle] = index;
+
+        setBounds(record, mesh);
+        link(index);
+    }
+
+    void remove(MeshHandle handle) {
+        auto found = recordIndices.find(handle);
+        if (found == recordIndices.end()) {
+            return;
+        }
+        uint32_t index = found->second;
+        recordIndices.erase(found);
+        unlink(index);
+
+        // The last record fills the gap, so everything pointing at it is moved along
+        uint32_t last = static_cast<uint32_t>(records.size() - 1);
+        if (index != last) {
+            records[index] = records[last];
+            Record& moved = records[index];
+            for (uint32_t corner = 0; corner < moved.cellCount; corner++) {
+                buckets[moved.buckets[corner]][moved.slots[corner]].record = index;
+            }
+            if (moved.cellCount == 0) {
+                largeRecords[moved.largeSlot] = index;
+            }
+            recordIndices[moved.handle] = index;
+        }
+        records.pop_back();
+    }
+
+    // Call after a mesh moved or changed size
+    void update(Mesh& mesh) {
+        auto found = recordIndices.find(mesh.handle);
+        if (found == recordIndices.end()) {
+            insert(mesh);
+            return;
+        }
+
+        Record& record = records[found->second];
+        int oldCellMin[3] = { record.cellMin[0], record.cellMin[1], record.cellMin[2] };
+        int oldCellMax[3] = { record.cellMax[0], record.cellMax[1], record.cellMax[2] };
+        bool wasLarge = record.cellCount == 0;
+        setBounds(record, mesh);
+        record.mesh = &mesh;
+
+        // Still in the same cells, only the bounds had to change
+        bool sameCells = wasLarge == isLarge(record);
+        for (int axis = 0; axis < 3 && sameCells && !wasLarge; axis++) {
+            sameCells = oldCellMin[axis] == record.cellMin[axis] && oldCellMax[axis] == record.cellMax[axis];
+        }
+        if (sameCells) {
+            return;
+        }
+
+        // Entries remember their buckets, so unlinking doesn't need the old cells
+        unlink(found->second);
+        link(found->second);
+    }
+
+    // nullptr if the handle isn't in the grid
+    Mesh* find(MeshHandle handle) const {
+        auto found = recordIndices.find(handle);
+        return found == recordIndices.end() ? nullptr : records[found->second].mesh;
+    }
+
+    // Meshes whose boxes overlap the given box, each listed once
+    void queryBox(const float* boxMin, const float* boxMax, std::vector<Mesh*>& results) const {
+        querySmall(boxMin, boxMax, results);
+
+        for (uint32_t index : largeRecords) {
+            if (overlaps(records[index], boxMin, boxMax)) {
+                results.push_back(records[index].mesh);
+            }
+        }
+    }
+
+    // Like queryBox, but leaves out the boxes bigger than a cell
+    void querySmall(const float* boxMin, const float* boxMax, std::vector<Mesh*>& results) const {
+        results.clear();
+
+        int cellMin[3];
+        int cellMax[3];
+        // Cells past the used ones only hold boxes that are listed in a used cell as well
+        for (int axis = 0; axis < 3; axis++) {
+            cellMin[axis] = std::max(usedCellMin[axis], static_cast<int>(std::floor(boxMin[axis] * inverseCellSize)));
+            cellMax[axis] = std::min(usedCellMax[axis], static_cast<int>(std::floor(boxMax[axis] * inverseCellSize)));
+        }
+
+        for (int x = cellMin[0]; x <= cellMax[0]; x++) {
+            for (int y = cellMin[1]; y <= cellMax[1]; y++) {
+                for (int z = cellMin[2]; z <= cellMax[2]; z++) {
+                    for (const Entry& entry : buckets[bucketOf(x, y, z)]) {
+                        if (overlaps(records[entry.record], boxMin, boxMax)) {
+                            results.push_back(records[entry.record].mesh);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Boxes over two cells, or hashed into the same bucket twice, came up more than once
+        std::sort(results.begin(), results.end());
+        results.erase(std::unique(results.begin(), results.end()), results.end());
+    }
+
+    // Meshes bigger than a cell, which every query checks one by one
+    void getLargeMeshes(std::vector<Mesh*>& results) const {
+        results.clear();
+        for (uint32_t index : largeRecords) {
+            results.push_back(records[index].mesh);
+        }
+    }
+
+    // Nearest box between the two distances
+    RayHit intersect(const Ray& ray, float minDistance, float maxDistance) const {
+        RayHit hit = { noMeshHandle, maxDistance };
+
+        for (uint32_t index : largeRecords) {
+            testRecord(ray, records[index], minDistance, hit);
+        }
+
+        // A box in a later cell can't be entered before that cell is
+        walkCells(ray, maxDistance, [&](const int*, const std::vector<Entry>& bucket) {
+            for (const Entry& entry : bucket) {
+                testRecord(ray, records[entry.record], minDistance, hit);
+            }
+            return hit.distance;
+        });
+
+        return hit;
+    }
+
+    // Meshes listed in the cells the ray passes through up to maxDistance,
+    // and the large ones it hits, each listed once. Anything that can cover
+    // the pixel the ray goes through is in there, give or take the boxes
+    // that only touch its edges
+    void queryRay(const Ray& ray, float minDistance, float maxDistance, std::vector<Mesh*>& results) const {
+        results.clear();
+
+        for (uint32_t index : largeRecords) {
+            float distance;
+            if (intersectRayBox(ray, records[index].boundsMin, records[index].boundsMax, minDistance, maxDistance, distance)) {
+                results.push_back(records[index].mesh);
+            }
+        }
+
+        walkCells(ray, maxDistance, [&](const int* cell, const std::vector<Entry>& bucket) {
+            for (const Entry& entry : bucket) {
+                // Boxes from other cells hashed into the same bucket aren't on the ray
+                const Record& record = records[entry.record];
+                if (cell[0] >= record.cellMin[0] && cell[0] <= record.cellMax[0] &&
+                    cell[1] >= record.cellMin[1] && cell[1] <= record.cellMax[1] &&
+                    cell[2] >= record.cellMin[2] && cell[2] <= record.cellMax[2]) {
+                    results.push_back(record.mesh);
+                }
+            }
+            return maxDistance;
+        });
+
+        std::sort(results.begin(), results.end());
+        results.erase(std::unique(results.begin(), results.end()), results.end());
+    }
+
+private:
+    // Where a box is listed in one bucket
+    struct Entry {
+        uint32_t record;
+        uint32_t corner; // Which of the record's cells this is
+    };
+
+    struct Record {
+        Mesh* mesh = nullptr;
+        MeshHandle handle = noMeshHandle;
+        float boundsMin[3] = { 0.0f, 0.0f, 0.0f };
+        float boundsMax[3] = { 0.0f, 0.0f, 0.0f };
+        int cellMin[3] = { 0, 0, 0 };
+        int cellMax[3] = { 0, 0, 0 };
+        uint32_t cellCount = 0; // 0 means it's on the large list
+        uint32_t buckets[8] = { 0 };
+        uint32_t slots[8] = { 0 };
+        uint32_t largeSlot = 0;
+    };
+
+    float cellSize = 32.0f;
+    float inverseCellSize = 1.0f / 32.0f;
+    uint32_t bucketMask = 0;
+    std::vector<std::vector<Entry>> buckets;
+    std::vector<Record> records;
+    std::vector<uint32_t> largeRecords;
+    std::unordered_map<MeshHandle, uint32_t> recordIndices;
+    int usedCellMin[3] = { INT32_MAX, INT32_MAX, INT32_MAX }; // Cells any small box was listed in
+    int usedCellMax[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+    float smallExtent = 0.0f;
+
+    uint32_t bucketOf(int x, int y, int z) const {
+        // Large primes from Teschner et al., collisions only cost extra box tests
+        uint32_t hash = (static_cast<uint32_t>(x) * 73856093u) ^ (static_cast<uint32_t>(y) * 19349663u) ^ (static_cast<uint32_t>(z) * 83492791u);
+        return hash & bucketMask;
+    }
+
+    static bool isLarge(const Record& record) {
+        return record.cellMax[0] - record.cellMin[0] > 1 || record.cellMax[1] - record.cellMin[1] > 1 || record.cellMax[2] - record.cellMin[2] > 1;
+    }
+
+    void setBounds(Record& record, const Mesh& mesh) const {
+        for (int axis = 0; axis < 3; axis++) {
+            record.boundsMin[axis] = mesh.location[axis];
+            record.boundsMax[axis] = mesh.location[axis] + mesh.size[axis];
+            record.cellMin[axis] = static_cast<int>(std::floor(record.boundsMin[axis] * inverseCellSize));
+            record.cellMax[axis] = static_cast<int>(std::floor(record.boundsMax[axis] * inverseCellSize));
+        }
+    }
+
+    // Lists the record in the buckets of its cells, or on the large list
+    void link(uint32_t index) {
+        Record& record = records[index];
+        if (isLarge(record)) {
+            record.cellCount = 0;
+            record.largeSlot = static_cast<uint32_t>(largeRecords.size());
+            largeRecords.push_back(index);
+            return;
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            usedCellMin[axis] = std::min(usedCellMin[axis], record.cellMin[axis]);
+            usedCellMax[axis] = std::max(usedCellMax[axis], record.cellMax[axis]);
+            smallExtent = std::max(smallExtent, record.boundsMax[axis] - record.boundsMin[axis]);
+        }
+
+        uint32_t corner = 0;
+        for (int x = record.cellMin[0]; x <= record.cellMax[0]; x++) {
+            for (int y = record.cellMin[1]; y <= record.cellMax[1]; y++) {
+                for (int z = record.cellMin[2]; z <= record.cellMax[2]; z++) {
+                    uint32_t bucket = bucketOf(x, y, z);
+                    record.buckets[corner] = bucket;
+                    record.slots[corner] = static_cast<uint32_t>(buckets[bucket].size());
+                    buckets[bucket].push_back({ index, corner });
+                    corner++;
+                }
+            }
+        }
+        record.cellCount = corner;
+    }
+
+    // Takes the record out of its buckets or the large list, it stays in records
+    void unlink(uint32_t index) {
+        Record& record = records[index];
+        if (record.cellCount == 0) {
+            uint32_t movedIndex = largeRecords.back();
+            largeRecords[record.largeSlot] = movedIndex;
+            records[movedIndex].largeSlot = record.largeSlot;
+            largeRecords.pop_back();
+            return;
+        }
+
+        for (uint32_t corner = 0; corner < record.cellCount; corner++) {
+            std::vector<Entry>& bucket = buckets[record.buckets[corner]];
+            uint32_t slot = record.slots[corner];
+            Entry moved = bucket.back();
+            bucket[slot] = moved;
+            records[moved.record].slots[moved.corner] = slot;
+            bucket.pop_back();
+        }
+        record.cellCount = 0;
+    }
+
+    static bool overlaps(const Record& record, const float* boxMin, const float* boxMax) {
+        return record.boundsMin[0] <= boxMax[0] && record.boundsMax[0] >= boxMin[0] &&
+            record.boundsMin[1] <= boxMax[1] && record.boundsMax[1] >= boxMin[1] &&
+            record.boundsMin[2] <= boxMax[2] && record.boundsMax[2] >= boxMin[2];
+    }
+
+    // Calls visit with each cell the ray passes through and its bucket,
+    // nearest first, until the next cell starts beyond the distance visit
+    // returns or past the used cells
+    template <typename Visit>
+    void walkCells(const Ray& ray, float endDistance, Visit visit) const {
+        int cell[3];
+        int step[3];
+        float nextCrossing[3];
+        float crossingSpacing[3];
+        for (int axis = 0; axis < 3; axis++) {
+            float origin = ray.origin[axis] * inverseCellSize;
+            cell[axis] = static_cast<int>(std::floor(origin));
+            float direction = ray.direction[axis];
+
+            if (direction > 0.0f) {
+                step[axis] = 1;
+                nextCrossing[axis] = ((cell[axis] + 1) * cellSize - ray.origin[axis]) / direction;
+                crossingSpacing[axis] = cellSize / direction;
+            }
+            else if (direction < 0.0f) {
+                step[axis] = -1;
+                nextCrossing[axis] = (cell[axis] * cellSize - ray.origin[axis]) / direction;
+                crossingSpacing[axis] = -cellSize / direction;
+            }
+            else {
+                step[axis] = 0;
+                nextCrossing[axis] = INFINITY;
+                crossingSpacing[axis] = INFINITY;
+            }
+        }
+
+        // Past the used cells the buckets only hold hash collisions, which
+        // were already tested in their own cells. The range only grows until
+        // the next reset, so it's never too small
+        float walkEnd = INFINITY;
+        for (int axis = 0; axis < 3; axis++) {
+            if (usedCellMin[axis] > usedCellMax[axis]) {
+                return;
+            }
+            if (step[axis] > 0) {
+                walkEnd = std::min(walkEnd, ((usedCellMax[axis] + 1) * cellSize - ray.origin[axis]) / ray.direction[axis]);
+            }
+            else if (step[axis] < 0) {
+                walkEnd = std::min(walkEnd, (usedCellMin[axis] * cellSize - ray.origin[axis]) / ray.direction[axis]);
+            }
+            else if (cell[axis] < usedCellMin[axis] || cell[axis] > usedCellMax[axis]) {
+                return;
+            }
+        }
+        if (walkEnd == INFINITY) {
+            walkEnd = 0.0f; // No direction at all, only the starting cell
+        }
+
+        float cellEnter = 0.0f;
+        while (cellEnter <= endDistance && cellEnter <= walkEnd) {
+            endDistance = visit(cell, buckets[bucketOf(cell[0], cell[1], cell[2])]);
+
+            int axis = nextCrossing[0] < nextCrossing[1] ? (nextCrossing[0] < nextCrossing[2] ? 0 : 2) : (nextCrossing[1] < nextCrossing[2] ? 1 : 2);
+            cellEnter = nextCrossing[axis];
+            cell[axis] += step[axis];
+            nextCrossing[axis] += crossingSpacing[axis];
+        }
+    }
+
+    static void testRecord(const Ray& ray, const Record& record, float minDistance, RayHit& hit) {
+        float distance;
+        if (intersectRayBox(ray, record.boundsMin, record.boundsMax, minDistance, hit.distance, distance) &&
+            (hit.handle == noMeshHandle || distance < hit.distance)) {
+            hit.handle = record.handle;
+            hit.distance = distance;
+        }
+    }
+};
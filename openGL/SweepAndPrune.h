@@ -0,0 +1,329 @@
+#pragma once
+
+#include "Memory.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Broadphase that keeps the set of overlapping box pairs up to date as boxes move
+//
+// Each axis has a sorted array of box start and end points. Boxes only move
+// a little between frames, so the arrays are nearly sorted and an insertion
+// sort puts them back in order with a few swaps. Every swap is an event: a
+// start point passing an end point means the two boxes may have started to
+// overlap, an end point passing a start point means they've separated. So
+// the work each frame follows how much moved, not how many pairs there are.
+// Adding many boxes at once would be a long insertion sort from scratch, so
+// then the arrays are fully sorted and the pairs found again with one sweep
+class SweepAndPrune {
+public:
+    using ProxyId = uint32_t;
+    using Pair = std::pair<ProxyId, ProxyId>;
+
+    // An ignored axis isn't sorted and pairs only have to overlap on the other
+    // two. Worth it when boxes are spread out flat, like a floor covered in
+    // them, where nearly everything overlaps along the up axis and moving up
+    // or down would pass thousands of points. The caller checks that axis
+    explicit SweepAndPrune(int ignored = -1) : ignoredAxis(ignored) {}
+
+    ProxyId addProxy(const float* boxMin, const float* boxMax) {
+        ProxyId id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        else {
+            id = static_cast<ProxyId>(proxies.size());
+            proxies.push_back(Proxy());
+            partners.push_back(std::vector<ProxyId>());
+        }
+
+        Proxy& proxy = proxies[id];
+        proxy.removing = false;
+        setBounds(proxy, boxMin, boxMax);
+        for (int axis = 0; axis < 3; axis++) {
+            proxy.previousMin[axis] = FLT_MAX;
+            proxy.previousMax[axis] = -FLT_MAX;
+        }
+
+        // New points go on the end, the next update sorts them in and finds their pairs
+        for (int axis = 0; axis < 3; axis++) {
+            if (axis == ignoredAxis) {
+                continue;
+            }
+            endpoints[axis].push_back({ proxy.boundsMin[axis], id << 1 });
+            endpoints[axis].push_back({ proxy.boundsMax[axis], (id << 1) | 1 });
+        }
+        proxyCount++;
+        addedCount++;
+        return id;
+    }
+
+    void moveProxy(ProxyId id, const float* boxMin, const float* boxMax) {
+        setBounds(proxies[id], boxMin, boxMax);
+    }
+
+    // The proxy is sorted to the far end on the next update, which drops its pairs, and is freed there
+    void removeProxy(ProxyId id) {
+        Proxy& proxy = proxies[id];
+        for (int axis = 0; axis < 3; axis++) {
+            proxy.boundsMin[axis] = FLT_MAX;
+            proxy.boundsMax[axis] = FLT_MAX;
+        }
+        proxy.removing = true;
+        removingCount++;
+    }
+
+    // Sorts the moved points back into place and updates the pairs on the way
+    void updatePairs() {
+        swapCount = 0;
+        bool rebuild = addedCount * 4 > proxyCount;
+        for (int axis = 0; axis < 3; axis++) {
+            if (axis == ignoredAxis) {
+                continue;
+            }
+            std::vector<Endpoint>& points = endpoints[axis];
+            for (Endpoint& point : points) {
+                const Proxy& proxy = proxies[point.proxyAndEnd >> 1];
+                point.value = (point.proxyAndEnd & 1) ? proxy.boundsMax[axis] : proxy.boundsMin[axis];
+            }
+            if (rebuild) {
+                std::sort(points.begin(), points.end(), [](const Endpoint& a, const Endpoint& b) { return goesAfter(b, a); });
+            }
+            else {
+                sortAxis(points);
+            }
+        }
+        if (rebuild) {
+            findAllPairs();
+        }
+        addedCount = 0;
+
+        for (Proxy& proxy : proxies) {
+            for (int axis = 0; axis < 3; axis++) {
+                proxy.previousMin[axis] = proxy.boundsMin[axis];
+                proxy.previousMax[axis] = proxy.boundsMax[axis];
+            }
+        }
+
+        // Removed proxies sorted to the end and have no pairs left
+        if (removingCount > 0) {
+            for (int axis = 0; axis < 3; axis++) {
+                std::vector<Endpoint>& points = endpoints[axis];
+                while (!points.empty() && proxies[points.back().proxyAndEnd >> 1].removing) {
+                    points.pop_back();
+                }
+            }
+            for (ProxyId id = 0; id < proxies.size(); id++) {
+                if (proxies[id].removing) {
+                    proxies[id].removing = false;
+                    freeIds.push_back(id);
+                    proxyCount--;
+                }
+            }
+            removingCount = 0;
+        }
+    }
+
+    // Pairs overlapping after the last update, lower id first
+    const std::vector<Pair>& getPairs() const {
+        return pairs;
+    }
+
+    // Proxies overlapping this one after the last update, in no order
+    const std::vector<ProxyId>& getPartners(ProxyId id) const {
+        return partners[id];
+    }
+
+    // Whether the two boxes overlap along one axis, for checking the ignored one
+    bool overlapsOnAxis(ProxyId a, ProxyId b, int axis) const {
+        return proxies[a].boundsMin[axis] <= proxies[b].boundsMax[axis] && proxies[b].boundsMin[axis] <= proxies[a].boundsMax[axis];
+    }
+
+    size_t getPairCount() const {
+        return pairs.size();
+    }
+
+    size_t getProxyCount() const {
+        return proxyCount;
+    }
+
+    // Endpoint swaps in the last update, the measure of how much work it was
+    size_t getSwapCount() const {
+        return swapCount;
+    }
+
+private:
+    struct Proxy {
+        float boundsMin[3];
+        float boundsMax[3];
+        float previousMin[3]; // Bounds at the last update, empty until the first
+        float previousMax[3];
+        bool removing = false;
+    };
+
+    struct Endpoint {
+        float value;
+        uint32_t proxyAndEnd; // Proxy id << 1, low bit set for the end point
+    };
+
+    int ignoredAxis = -1;
+    std::vector<Proxy> proxies;
+    std::vector<ProxyId> freeIds;
+    std::vector<Endpoint> endpoints[3];
+    // Pairs in a flat list to walk quickly, the map finds a pair's slot for swap-and-pop removal
+    std::vector<Pair> pairs;
+    std::unordered_map<uint64_t, uint32_t, std::hash<uint64_t>, std::equal_to<uint64_t>, PoolAllocator<std::pair<const uint64_t, uint32_t>>> pairSlots;
+    // The same pairs from each side, so finding one proxy's doesn't walk them all
+    std::vector<std::vector<ProxyId>> partners;
+    size_t proxyCount = 0;
+    size_t removingCount = 0;
+    size_t addedCount = 0;
+    size_t swapCount = 0;
+    std::vector<ProxyId> active;
+    std::vector<uint32_t> activeSlots;
+
+    static void setBounds(Proxy& proxy, const float* boxMin, const float* boxMax) {
+        for (int axis = 0; axis < 3; axis++) {
+            proxy.boundsMin[axis] = boxMin[axis];
+            proxy.boundsMax[axis] = boxMax[axis];
+        }
+    }
+
+    // Equal values put start points first, so touching boxes count as overlapping
+    static bool goesAfter(const Endpoint& a, const Endpoint& b) {
+        return a.value > b.value || (a.value == b.value && (a.proxyAndEnd & 1) && !(b.proxyAndEnd & 1));
+    }
+
+    static uint64_t pairKey(ProxyId a, ProxyId b) {
+        return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+    }
+
+    void addPair(ProxyId a, ProxyId b) {
+        if (pairSlots.emplace(pairKey(a, b), static_cast<uint32_t>(pairs.size())).second) {
+            pairs.push_back({ std::min(a, b), std::max(a, b) });
+            partners[a].push_back(b);
+            partners[b].push_back(a);
+        }
+    }
+
+    // Most boxes touch a handful of others, so the linear search is short
+    void removePartner(ProxyId from, ProxyId partner) {
+        std::vector<ProxyId>& list = partners[from];
+        auto found = std::find(list.begin(), list.end(), partner);
+        *found = list.back();
+        list.pop_back();
+    }
+
+    void removePair(ProxyId a, ProxyId b) {
+        auto found = pairSlots.find(pairKey(a, b));
+        if (found == pairSlots.end()) {
+            return;
+        }
+        uint32_t slot = found->second;
+        pairSlots.erase(found);
+        removePartner(a, b);
+        removePartner(b, a);
+        if (slot != pairs.size() - 1) {
+            pairs[slot] = pairs.back();
+            pairSlots[pairKey(pairs[slot].first, pairs[slot].second)] = slot;
+        }
+        pairs.pop_back();
+    }
+
+    bool overlaps(ProxyId a, ProxyId b) const {
+        const Proxy& first = proxies[a];
+        const Proxy& second = proxies[b];
+        for (int axis = 0; axis < 3; axis++) {
+            if (axis == ignoredAxis) {
+                continue;
+            }
+            if (first.boundsMin[axis] > second.boundsMax[axis] || second.boundsMin[axis] > first.boundsMax[axis]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Sweeps the sorted x points, or z when x is ignored, keeping the boxes
+    // open at each one. Every box that starts is checked against the open ones
+    void findAllPairs() {
+        pairs.clear();
+        pairSlots.clear();
+        for (std::vector<ProxyId>& list : partners) {
+            list.clear();
+        }
+        active.clear();
+        activeSlots.resize(proxies.size());
+        for (const Endpoint& point : endpoints[ignoredAxis == 0 ? 2 : 0]) {
+            ProxyId proxy = point.proxyAndEnd >> 1;
+            if (proxies[proxy].removing) {
+                continue;
+            }
+            if (point.proxyAndEnd & 1) {
+                ProxyId moved = active.back();
+                active[activeSlots[proxy]] = moved;
+                activeSlots[moved] = activeSlots[proxy];
+                active.pop_back();
+                continue;
+            }
+            for (ProxyId other : active) {
+                if (overlaps(proxy, other)) {
+                    addPair(proxy, other);
+                }
+            }
+            activeSlots[proxy] = static_cast<uint32_t>(active.size());
+            active.push_back(proxy);
+        }
+    }
+
+    bool overlappedBefore(ProxyId a, ProxyId b) const {
+        const Proxy& first = proxies[a];
+        const Proxy& second = proxies[b];
+        for (int axis = 0; axis < 3; axis++) {
+            if (axis == ignoredAxis) {
+                continue;
+            }
+            if (first.previousMin[axis] > second.previousMax[axis] || second.previousMin[axis] > first.previousMax[axis]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void sortAxis(std::vector<Endpoint>& points) {
+        for (size_t i = 1; i < points.size(); i++) {
+            Endpoint key = points[i];
+            size_t j = i;
+            while (j > 0 && goesAfter(points[j - 1], key)) {
+                const Endpoint& other = points[j - 1];
+                ProxyId keyProxy = key.proxyAndEnd >> 1;
+                ProxyId otherProxy = other.proxyAndEnd >> 1;
+                bool keyIsEnd = key.proxyAndEnd & 1;
+                bool otherIsEnd = other.proxyAndEnd & 1;
+
+                if (!keyIsEnd && otherIsEnd) {
+                    // Start now before the other's end, overlapping on this axis, maybe on all
+                    if (keyProxy != otherProxy && overlaps(keyProxy, otherProxy)) {
+                        addPair(keyProxy, otherProxy);
+                    }
+                }
+                else if (keyIsEnd && !otherIsEnd) {
+                    // End now before the other's start, separated. Only boxes that
+                    // overlapped last update can be a pair, the rest skip the lookup
+                    if (overlappedBefore(keyProxy, otherProxy)) {
+                        removePair(keyProxy, otherProxy);
+                    }
+                }
+
+                points[j] = other;
+                j--;
+                swapCount++;
+            }
+            points[j] = key;
+        }
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops
+//
+// parallelFor splits a range into batches that the workers and the calling
+// thread pull from a shared counter until it runs out, so uneven batches
+// balance themselves. One loop runs at a time, it isn't reentrant. The loop
+// body is passed as a pointer and a plain function that calls it, not a
+// std::function, so starting a loop never allocates
+class ThreadPool {
+public:
+    // 0 uses every hardware thread, the caller counts as one of them
+    explicit ThreadPool(unsigned threadCount = 0) {
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 1; i < threadCount; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned getThreadCount() const {
+        return static_cast<unsigned>(workers.size()) + 1;
+    }
+
+    // Calls function(begin, end) over [0, count) in batches of batchSize, returns once every batch is done
+    template <typename Function>
+    void parallelFor(size_t count, size_t batchSize, const Function& function) {
+        if (count == 0) {
+            return;
+        }
+        batchSize = std::max<size_t>(batchSize, 1);
+        if (workers.empty() || count <= batchSize) {
+            function(static_cast<size_t>(0), count);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &function;
+            jobRunner = [](const void* context, size_t begin, size_t end) {
+                (*static_cast<const Function*>(context))(begin, end);
+            };
+            jobCount = count;
+            jobBatchSize = batchSize;
+            nextIndex.store(0, std::memory_order_relaxed);
+            busyWorkers = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        runBatches();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const void* job = nullptr;
+    void (*jobRunner)(const void* context, size_t begin, size_t end) = nullptr;
+    size_t jobCount = 0;
+    size_t jobBatchSize = 1;
+    std::atomic<size_t> nextIndex{ 0 };
+    size_t busyWorkers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void runBatches() {
+        for (;;) {
+            size_t begin = nextIndex.fetch_add(jobBatchSize, std::memory_order_relaxed);
+            if (begin >= jobCount) {
+                return;
+            }
+            jobRunner(job, begin, std::min(begin + jobBatchSize, jobCount));
+        }
+    }
+
+    void workerLoop() {
+        uint64_t seenGeneration = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+
+            lock.unlock();
+            runBatches();
+            lock.lock();
+
+            if (--busyWorkers == 0) {
+                done.notify_one();
+            }
+        }
+    }
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Camera.h"
+#include "PathTracer.h"
+#include "RayBenchmark.h"
+#include "ThreadPool.h"
+#include <cstdio>
+#include <list>
+
+// Path tracer throughput in rays per second per thread, run with --bench-trace
+
+namespace tracebench {
+
+    // Random boxes on a floor seen from the edge of the area, like the ray benchmark's view
+    inline void runScene(size_t boxCount, ThreadPool& pool) {
+        std::list<Mesh> meshes = raybench::makeScene(boxCount, 1);
+        meshes.push_back({ { -600.0f, -1.0f, -600.0f }, { 1200.0f, 1.0f, 1200.0f }, { 0, 200, 0 } });
+
+        Camera camera;
+        camera.setPosition(0.0f, 50.0f, 600.0f);
+        camera.setRotation(-5.0f, -90.0f);
+        camera.setPerspective(60.0f, 1.0f, 0.1f, 2000.0f);
+
+        PathTracer tracer;
+        tracer.build(meshes);
+        tracer.beginImage(camera, 512, 512);
+        const int samples = 4;
+        for (int sample = 0; sample < samples; sample++) {
+            tracer.addSample(pool);
+        }
+
+        double raysPerSecond = tracer.getRayCount() / tracer.getTraceSeconds();
+        std::printf("%-8zu %8u %10d %12.2f %12.2f %14.2f\n", boxCount, pool.getThreadCount(), samples, tracer.getTraceSeconds() * 1000.0 / samples,
+            raysPerSecond / 1e6, raysPerSecond / 1e6 / pool.getThreadCount());
+    }
+
+}
+
+inline void runPathTraceBenchmark() {
+    std::printf("Path trace benchmark, 512 x 512, up to 4 bounces with a shadow ray each\n");
+    std::printf("%-8s %8s %10s %12s %12s %14s\n", "boxes", "threads", "samples", "sample ms", "Mrays/s", "Mrays/s/thread");
+
+    ThreadPool single(1);
+    ThreadPool all;
+    const size_t boxCounts[] = { 1000, 10000, 100000 };
+    for (size_t boxCount : boxCounts) {
+        tracebench::runScene(boxCount, single);
+        tracebench::runScene(boxCount, all);
+    }
+}
@@ -1,106 +1,333 @@
 #include <GLFW/glfw3.h>
-#include <iostream>
+#include "Camera.h"
+#include "Collision.h"
+#include "CollisionBenchmark.h"
+#include "FramePacing.h"
+#include "FrameStats.h"
+#include "FrustumCulling.h"
+#include "GLExtensions.h"
+#include "GpuPicker.h"
+#include "IndirectRenderer.h"
+#include "InputLatency.h"
+#include "LevelOfDetail.h"
+#include "Log.h"
+#include "MathBenchmark.h"
+#include "MathLib.h"
+#include "Memory.h"
+#include "Mesh.h"
+#include "MicroBenchmark.h"
+#include "OcclusionCulling.h"
+#include "OverlayRenderer.h"
+#include "PathTracer.h"
+#include "Physics.h"
+#include "Picking.h"
+#include "RasterBenchmark.h"
+#include "RayBenchmark.h"
+#include "RenderQueue.h"
+#include "SceneBenchmark.h"
+#include "SceneGenerator.h"
+#include "SoftwareRasterizer.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+#include "TraceBenchmark.h"
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <ctime>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <list>
 #include <vector>
 
+// Every heap allocation goes through here to be counted for the per frame
+// report. Blocks are counted at the size malloc reports for them, which
+// freeing can ask for again to take the same amount off the live bytes
+void* operator new(std::size_t size) {
+    if (void* block = std::malloc(size > 0 ? size : 1)) {
+        memory::countAllocation(memory::getBlockSize(block));
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    if (!pointer) {
+        return;
+    }
+    memory::countFree(memory::getBlockSize(pointer));
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
 // camear rot stuff
 
 // Global variables to keep track of the state
 bool isRightMouseButtonPressed = false;
 double lastMouseX = 0.0, lastMouseY = 0.0;
 
+// Mouse look waits here until latchCameraInput applies it, right before the view matrix is built
+float pendingPitch = 0.0f, pendingYaw = 0.0f;
+double pendingInputTime = -1.0; // when the oldest input not in a frame yet came in, negative when there's none
+double lastMoveTime = 0.0;
 
-// pi
-const float PI = 3.14159265358979323846f;
 
 // Window dimensions
 const int windowWidth = 1080;
 const int windowHeight = 1080;
 
-// Player size and speed
-const float playerSize = 0.0f;
+// Player size and speed, the player is a box this wide around the camera
+const float playerSize = 1.0f;
 const float playerSpeed = 100.0f;
 
-// Camera position
-float cameraX = 0.0f;
-float cameraY = 0.0f;
-float cameraZ = 5.0f;
-
-// Camera rot
-float camerarotX = 0.0f;
-float camerarotY = 0.0f;
-float camerarotZ = 5.0f;
-
-// Mesh class
-class Mesh {
-public:
-    std::array<float, 3> location;
-    std::array<float, 3> size;
-    std::array<float, 3> color; // Add color attribute (RGB format)
-
-    Mesh(std::array<float, 3> loc, std::array<float, 3> sz, std::array<float, 3> col) : location(loc), size(sz), color(col) {}
-
-    void draw() {
-        float x = location[0];
-        float y = location[1];
-        float z = location[2];
-        float width = size[0];
-        float height = size[1];
-        float depth = size[2];
-        float r = color[0] / 255;
-        float g = color[1] / 255;
-        float b = color[2] / 255;
-
-        glColor3f(r, g, b); // Set the color for the mesh
-
-        glBegin(GL_QUADS);
-
-        // Front face
-        glVertex3f(x, y, z);
-        glVertex3f(x + width, y, z);
-        glVertex3f(x + width, y + height, z);
-        glVertex3f(x, y + height, z);
-
-        // Back face
-        glVertex3f(x, y, z + depth);
-        glVertex3f(x + width, y, z + depth);
-        glVertex3f(x + width, y + height, z + depth);
-        glVertex3f(x, y + height, z + depth);
-
-        // Top face
-        glVertex3f(x, y + height, z);
-        glVertex3f(x + width, y + height, z);
-        glVertex3f(x + width, y + height, z + depth);
-        glVertex3f(x, y + height, z + depth);
-
-        // Bottom face
-        glVertex3f(x, y, z);
-        glVertex3f(x + width, y, z);
-        glVertex3f(x + width, y, z + depth);
-        glVertex3f(x, y, z + depth);
-
-        // Right face
-        glVertex3f(x + width, y, z);
-        glVertex3f(x + width, y + height, z);
-        glVertex3f(x + width, y + height, z + depth);
-        glVertex3f(x + width, y, z + depth);
-
-        // Left face
-        glVertex3f(x, y, z);
-        glVertex3f(x, y + height, z);
-        glVertex3f(x, y + height, z + depth);
-        glVertex3f(x, y, z + depth);
-
-        glEnd();
-    }
-};
+// Boxes the grid returns around the player's move, kept to reuse its memory
+std::vector<Mesh*> collisionCandidates;
+
+// Camera position, rotation and everything derived from them
+Camera camera;
+
+// Hides meshes behind the big boxes in front of the camera, toggled with O
+OcclusionCuller occlusionCuller;
+bool occlusionCullingEnabled = true;
+bool occlusionKeyWasPressed = false;
+
+// Swaps far away boxes for proxies and billboards, toggled with L
+LodSelector lodSelector;
+bool lodEnabled = true;
+bool lodKeyWasPressed = false;
 
 // Where meshes are stored
 std::list<Mesh> meshes;
 
+// Finds the boxes along picking rays, kept up to date as boxes move instead of being rebuilt
+SpatialGrid meshGrid;
+
+// Moves the dynamic meshes, stepped at a fixed rate on the worker threads
+PhysicsWorld physics;
+ThreadPool physicsPool;
+const double physicsStepTime = 1.0 / 60.0;
+const int maxPhysicsSteps = 4; // Per frame, a long hitch drops time instead of stepping to catch up
+double physicsTimeLeft = 0.0;
+
+// How fast a clicked dynamic box is thrown up
+const float clickLaunchSpeed = 15.0f;
+
+// Draws all meshes in one call when the context supports it
+IndirectRenderer indirectRenderer;
+
+// With nothing moving the window waits for input instead of drawing the
+// same frame again, toggled with I. Anything that changes what's on screen
+// asks for a redraw, a few frames so the GPU pick result that comes back
+// later gets drawn too
+bool idleRenderingEnabled = true;
+bool idleKeyWasPressed = false;
+const double idleWaitTimeout = 0.5; // wakes up now and then even without events
+const int redrawFramesAfterChange = 3;
+int redrawFramesLeft = redrawFramesAfterChange;
+uint64_t drawnCameraVersion = 0;
+uint64_t framesDrawn = 0;
+uint64_t idleWaits = 0;
+
+void requestRedraw() {
+    redrawFramesLeft = redrawFramesAfterChange;
+}
+
+// Exposed, restored or resized, the contents have to be drawn again
+void windowRefreshCallback(GLFWwindow* window) {
+    requestRedraw();
+}
+
+// Meshes moved this frame, kept so collecting them doesn't allocate
+std::vector<Mesh*> movedMeshes;
+
+// Updates just what the moved meshes touch in everything that caches mesh data
+void meshesMoved(const std::vector<Mesh*>& moved) {
+    indirectRenderer.update(moved);
+    lodSelector.update(moved);
+    requestRedraw();
+}
+
+// Sorts each frame's draws and skips GL state changes that change nothing
+RenderQueue renderQueue;
+GLStateCache stateCache;
+
+// Data that only lives for one frame, like the draw arguments the render queue holds on to
+FrameArena frameArena;
+FrameAllocationStats frameAllocations;
+
+// Frame time percentiles every few seconds and at exit, frames over budget are reported with the zones that ran long
+const double frameBudget = 0.025;
+const double frameStatsInterval = 5.0;
+FrameStats frameStats(frameBudget, frameStatsInterval);
+FrameProfiler frameProfiler;
+
+// Swap interval and frame rate cap, set with --vsync off|on|adaptive and --fps rate, 0 is uncapped
+VsyncMode vsyncMode = VsyncMode::Adaptive;
+double targetFrameRate = 0.0;
+FramePacer framePacer(frameStatsInterval);
+const int zonePhysics = frameProfiler.addZone("physics");
+const int zoneInput = frameProfiler.addZone("input");
+const int zoneCulling = frameProfiler.addZone("culling");
+const int zoneQueue = frameProfiler.addZone("queue");
+const int zoneDraw = frameProfiler.addZone("draw");
+const int zonePacing = frameProfiler.addZone("pacing");
+const int zoneSwap = frameProfiler.addZone("swap");
+const int zoneLatch = frameProfiler.addZone("latch");
+
+// Input to present latency, and how many frames the CPU may queue ahead of the GPU, set with --frames-ahead count, 0 leaves it to the driver
+// --low-latency caps it at one and waits for the frame rate cap before input is sampled instead of before the swap
+InputLatencyMonitor inputLatency(frameStatsInterval);
+bool lowLatency = false;
+
+// What the world draw needs this frame
+struct WorldDrawArgs {
+    const Frustum* frustum;
+    const OcclusionCuller* occlusion;
+    const LodSelector* lod;
+};
+
+void drawWorld(const void* data) {
+    const WorldDrawArgs* args = static_cast<const WorldDrawArgs*>(data);
+    indirectRenderer.draw(meshes, *args->frustum, args->occlusion, args->lod);
+}
+
+void drawMesh(const void* data) {
+    static_cast<const Mesh*>(data)->draw();
+}
+
+void drawLodProxies(const void* data) {
+    static_cast<const LodSelector*>(data)->draw();
+}
+
+// Crosshair and stats text, collected each frame and drawn in one call
+OverlayRenderer overlay;
+
+// Stats in the top left corner, toggled with H. The text is redone a few times a second so it can be read
+bool hudEnabled = true;
+bool hudKeyWasPressed = false;
+const double hudRefreshInterval = 0.25;
+double hudRefreshTime = 0.0;
+double hudFrameTime = 0.0; // averaged over roughly the last 20 frames
+char hudText[256] = "";
+const int hudTextScale = 2;
+const float hudMargin = 8.0f;
+const float hudPadding = 6.0f;
+
+// Depth test and blending come from the overlay pass, the texture from the queue item
+void drawOverlay(const void* data) {
+    static_cast<const OverlayRenderer*>(data)->draw();
+}
+
+// Picking only hits boxes this far along the ray, the same reach the old ray march had
+const float pickMinDistance = 5.0f;
+const float pickMaxDistance = 505.0f;
+
+// Box under the cursor, outlined while hovered
+const Mesh* hoveredMesh = nullptr;
+
+// Where the cursor is now, lastMouseX/Y only follow it while dragging
+double cursorX = 0.0, cursorY = 0.0;
+
+// Picks through an ID buffer on the GPU instead of ray casting, toggled with G
+GpuPicker gpuPicker;
+bool gpuPickingEnabled = false;
+std::vector<Mesh*> pickCandidates; // boxes in the cells along the cursor ray, all the ID buffer draws
+int pickingCheckCount = 0; // --check-picking compares this many picks against the grid and exits
+bool gpuPickingKeyWasPressed = false;
+
+// Path traces the current view into trace.ppm on P, the window waits until it's done
+const char* const tracePath = "trace.ppm";
+const int traceSamples = 16;
+bool traceKeyWasPressed = false;
+
+// Framebuffer pixels per window unit, more than 1 on high DPI screens. The
+// scene keeps the viewport the context started with, in the bottom left
+// corner, when the window is resized
+int framebufferWidth = windowWidth;
+int framebufferHeight = windowHeight;
+double framebufferScaleX = 1.0;
+double framebufferScaleY = 1.0;
+int viewportWidth = windowWidth;
+int viewportHeight = windowHeight;
+
+// The ID buffer follows the framebuffer, minimized windows keep the old one
+void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
+    int windowSizeX = 0, windowSizeY = 0;
+    glfwGetWindowSize(window, &windowSizeX, &windowSizeY);
+    if (width > 0 && height > 0 && windowSizeX > 0 && windowSizeY > 0) {
+        framebufferWidth = width;
+        framebufferHeight = height;
+        framebufferScaleX = static_cast<double>(width) / windowSizeX;
+        framebufferScaleY = static_cast<double>(height) / windowSizeY;
+        if (gpuPicker.isAvailable()) {
+            gpuPicker.resize(width, height);
+        }
+    }
+    requestRedraw();
+}
+
+// Framebuffer pixel under a window position, counted from the bottom left like GL does
+void cursorPixel(double x, double y, int& pixelX, int& pixelY) {
+    pixelX = static_cast<int>(std::floor(x * framebufferScaleX));
+    pixelY = framebufferHeight - 1 - static_cast<int>(std::floor(y * framebufferScaleY));
+}
+
+// Ray from the camera through the center of a framebuffer pixel
+Ray pixelRay(int pixelX, int pixelY) {
+    float viewX = pixelX + 0.5f;
+    float viewY = viewportHeight - (pixelY + 0.5f);
+    return screenRay(camera.getInverseViewProjection(), viewX, viewY, static_cast<float>(viewportWidth), static_cast<float>(viewportHeight));
+}
+
+// Ray from the camera through a window position
+Ray cursorRay(double x, double y) {
+    float viewX = static_cast<float>(x * framebufferScaleX);
+    float viewY = static_cast<float>(viewportHeight - (framebufferHeight - y * framebufferScaleY));
+    return screenRay(camera.getInverseViewProjection(), viewX, viewY, static_cast<float>(viewportWidth), static_cast<float>(viewportHeight));
+}
+
+// Box edges on top of everything, depth test and blending come from the overlay pass
+void drawHoverOutline(const void* data) {
+    const Mesh* mesh = static_cast<const Mesh*>(data);
+    float low[3] = { mesh->location[0], mesh->location[1], mesh->location[2] };
+    float high[3] = { low[0] + mesh->size[0], low[1] + mesh->size[1], low[2] + mesh->size[2] };
+
+    glColor4f(1.0f, 1.0f, 1.0f, 0.6f);
+    glBegin(GL_LINES);
+    for (int axis = 0; axis < 3; axis++) {
+        // Four edges run along each axis, one from each corner of the face at its low end
+        int a = (axis + 1) % 3;
+        int b = (axis + 2) % 3;
+        for (int corner = 0; corner < 4; corner++) {
+            float start[3];
+            start[axis] = low[axis];
+            start[a] = (corner & 1) ? high[a] : low[a];
+            start[b] = (corner & 2) ? high[b] : low[b];
+            float end[3] = { start[0], start[1], start[2] };
+            end[axis] = high[axis];
+            glVertex3fv(start);
+            glVertex3fv(end);
+        }
+    }
+    glEnd();
+}
+
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
     if (button == GLFW_MOUSE_BUTTON_RIGHT) {
         if (action == GLFW_PRESS) {
@@ -116,44 +343,95 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
         if (action == GLFW_PRESS) {
             glfwGetCursorPos(window, &lastMouseX, &lastMouseY);
 
-            float distance = 5.0f;
+            // Throw up the box under the cursor, static ones are lifted, the GPU already has it from the last frames
+            MeshHandle handle = gpuPickingEnabled ? gpuPicker.getResult() :
+                meshGrid.intersect(cursorRay(lastMouseX, lastMouseY), pickMinDistance, pickMaxDistance).handle;
+            Mesh* mesh = meshGrid.find(handle);
+            LOG_DEBUG("Clicked mesh " << handle << (mesh && mesh->dynamic ? ", dynamic" : ""));
+            if (mesh && mesh->dynamic) {
+                physics.addVelocity(mesh->handle, Vec4(0.0f, clickLaunchSpeed, 0.0f));
+            }
+            else if (mesh) {
+                mesh->location = { mesh->location[0], mesh->location[1] + 2, mesh->location[2] };
+                meshGrid.update(*mesh);
+                physics.update(*mesh);
+                movedMeshes.assign(1, mesh);
+                meshesMoved(movedMeshes);
+            }
+        }
+    }
 
+}
 
+// Events only carry the time they're handled, the closest there is to when they happened
+void noteInput() {
+    if (pendingInputTime < 0.0) {
+        pendingInputTime = glfwGetTime();
+    }
+}
 
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (action != GLFW_REPEAT) {
+        noteInput();
+    }
+}
 
-            for (int i = 0; i < 100000; i++) {
+bool isMovementKeyHeld(GLFWwindow* window) {
+    return glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS ||
+        glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+}
 
-                float mouseXReal = lastMouseX - (windowWidth / 2);
-                float mouseYReal = lastMouseY - (windowHeight / 2);
+// Mouse look or movement the next frame has to show
+bool isCameraInputPending(GLFWwindow* window) {
+    return pendingPitch != 0.0f || pendingYaw != 0.0f || isMovementKeyHeld(window);
+}
 
-                distance += 0.005f;
-                float radianRotY = camerarotY * (PI / 180.0f); // Convert degrees to radians
-                float radianRotX = camerarotX * (PI / 180.0f); // Convert degrees to radiansw
-                float rayX = cameraX + (distance * std::cos(radianRotX) * std::cos(radianRotY));
-                float rayY = cameraY + (distance * std::sin(radianRotX));
-                float rayZ = cameraZ + (distance * std::cos(radianRotX) * std::sin(radianRotY));
+// Applies the camera input as late as it can, right before the view matrix is
+// built, so what's drawn is where the mouse and keys were when the frame was
+// about to go to the GPU and not where they were when it started. Returns
+// when the oldest input in the frame came in, a held key counts from now, and
+// negative when there's none
+double latchCameraInput(GLFWwindow* window) {
+    glfwPollEvents();
+    double now = glfwGetTime();
+    double moveTime = std::min(now - lastMoveTime, maxPhysicsSteps * physicsStepTime); // a long wait doesn't throw the camera through the scene
+    lastMoveTime = now;
+
+    if (pendingPitch != 0.0f || pendingYaw != 0.0f) {
+        camera.rotate(pendingPitch, pendingYaw);
+        pendingPitch = 0.0f;
+        pendingYaw = 0.0f;
+    }
 
-                for (auto it = meshes.begin(); it != meshes.end(); ++it) {
-                    Mesh& mesh = *it;
+    // Move along the camera's cached basis vectors
+    Vec4 movement;
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
+        movement += camera.getRight();
+    }
 
-                    bool inside = (rayX >= mesh.location[0] && rayX <= mesh.location[0] + mesh.size[0]) &&
-                        (rayY >= mesh.location[1] && rayY <= mesh.location[1] + mesh.size[1]) &&
-                        (rayZ >= mesh.location[2] && rayZ <= mesh.location[2] + mesh.size[2]);
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+        movement -= camera.getRight();
+    }
 
-                    if (inside) {
-                        // std::cout << mesh.color[0] << ", " << mesh.color[0] << ", " << mesh.color[0] << std::endl;
-                        // mesh.color = {255, 255, 255};
-                        mesh.location = { mesh.location[0], mesh.location[1] + 2, mesh.location[2] };
-                        // meshes.push_front({ {rayX, rayY, rayZ}, {2.0f, 2.0f, 2.0f}, {255, 255, 255} });
-                        return;
-                    }
-                }
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+        movement -= camera.getForward();
+    }
 
-            }
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+        movement += camera.getForward();
+    }
 
-        }
+    bool moving = dot3(movement, movement) > 0.0f;
+    if (moving) {
+        // Swept against the boxes near the move, so fast moves can't tunnel through thin ones
+        Vec4 halfSize(playerSize * 0.5f, playerSize * 0.5f, playerSize * 0.5f);
+        Vec4 delta = movement * static_cast<float>(playerSpeed * moveTime);
+        camera.setPosition(sweepBox(meshGrid, camera.getPosition(), halfSize, delta, collisionCandidates));
     }
 
+    double inputTime = pendingInputTime >= 0.0 ? pendingInputTime : moving ? now : -1.0;
+    pendingInputTime = -1.0;
+    return inputTime;
 }
 
 void cursorPositionCallback(GLFWwindow* window, double mouseX, double mouseY) {
@@ -162,96 +440,360 @@ void cursorPositionCallback(GLFWwindow* window, double mouseX, double mouseY) {
         double deltaX = mouseX - lastMouseX;
         double deltaY = mouseY - lastMouseY;
 
-        // Update the camera rotation
-        camerarotY += static_cast<float>(deltaX / 5); // Left and right angle
-        camerarotX -= static_cast<float>(deltaY / 5); // Up and down angle
+        // Up and down angle then left and right angle, the camera turns when the frame latches it
+        pendingPitch += static_cast<float>(-deltaY / 5);
+        pendingYaw += static_cast<float>(deltaX / 5);
+        noteInput();
 
         // Update the last mouse position
         lastMouseX = mouseX;
         lastMouseY = mouseY;
     }
-}
 
-void setPerspective(float fov, float aspect, float near, float far) {
-    float f = 1.0f / tan(fov * 3.14159265358979323846f / 360.0f);
-    float zDiff = near - far;
+    cursorX = mouseX;
+    cursorY = mouseY;
 
-    float projection[16] = {
-        f / aspect, 0, 0, 0,
-        0, f, 0, 0,
-        0, 0, (far + near) / zDiff, -1,
-        0, 0, (2 * far * near) / zDiff, 0
-    };
+    // Only the boxes in the cells along the ray are tested, cheap enough for every cursor move
+    if (!gpuPickingEnabled) {
+        const Mesh* hovered = meshGrid.find(meshGrid.intersect(cursorRay(mouseX, mouseY), pickMinDistance, pickMaxDistance).handle);
+        if (hovered != hoveredMesh) {
+            hoveredMesh = hovered;
+            requestRedraw();
+        }
+    }
+    else {
+        // The ID buffer has to be drawn at the new cursor to find what's under it
+        requestRedraw();
+    }
+}
 
+// Loads the camera matrices into the fixed function pipeline
+void loadCameraMatrices() {
     glMatrixMode(GL_PROJECTION);
-    glLoadMatrixf(projection);
+    glLoadMatrixf(camera.getProjection().data());
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadMatrixf(camera.getView().data());
 }
 
-void lookAt(float eyeX, float eyeY, float eyeZ, float rotX, float rotY, float rotZ) {
-    // Convert rotation angles to radians
-    float pitch = rotX * 3.14159265358979323846f / 180.0f;
-    float yaw = rotY * 3.14159265358979323846f / 180.0f;
-    float roll = rotZ * 3.14159265358979323846f / 180.0f;
 
-    // Compute forward vector based on yaw and pitch
-    float forwardX = cos(yaw) * cos(pitch);
-    float forwardY = sin(pitch);
-    float forwardZ = sin(yaw) * cos(pitch);
+// A generated scene replaces the houses when --scene asks for one
+SceneType generatedSceneType = SceneType::City;
+size_t generatedSceneSize = 0;
+uint32_t generatedSceneSeed = 1;
+
+// Fills the mesh list and puts the camera at the start, the same with or without a window
+void setupScene() {
+    if (generatedSceneSize > 0) {
+        SceneBounds bounds = generateScene(generatedSceneType, generatedSceneSize, generatedSceneSeed, meshes);
+        placeCamera(camera, bounds, 45.0f, (float)windowWidth / (float)windowHeight);
+        LOG_INFO("Generated " << getSceneName(generatedSceneType) << " scene of " << meshes.size() << " boxes, seed " << generatedSceneSeed);
+        return;
+    }
+
+    //   Add To List           Location                  Size
+    //meshes.push_back({ { -1.0f, 3.5f, -2.5f }, { 5.0f, 15.0f, 5.0f } });
+    // 
+    // Adds a mesh to the list
+    meshes.push_back({ { -250.0f, 0.0f, -250.0f }, { 500.0f, 0.1f, 500.0f }, {0, 255, 0} });
+
+    meshes.push_back({ { 0.0f, 0.0f, -50.0f }, { 25.0f, 14.0f, 20.0f }, {110, 72, 13} });
+    meshes.push_back({ { 0.0f, 14.0f, -50.0f }, { 25.0f, 1.0f, 20.0f }, {0, 100, 0} });
 
-    float forwardLength = sqrt(forwardX * forwardX + forwardY * forwardY + forwardZ * forwardZ);
-    forwardX /= forwardLength;
-    forwardY /= forwardLength;
-    forwardZ /= forwardLength;
+    meshes.push_back({ { 25.0f, 0.0f, -50.0f }, { 25.0f, 18.0f, 20.0f }, {110, 72, 13} });
+    meshes.push_back({ { 25.0f, 18.0f, -50.0f }, { 25.0f, 1.0f, 20.0f }, {0, 100, 0} });
 
-    // Up vector remains constant as we rotate around Y axis
-    float upX = 0.0f;
-    float upY = 1.0f;
-    float upZ = 0.0f;
+    // A stack of crates dropped next to the houses, the physics moves these
+    for (int crate = 0; crate < 5; crate++) {
+        meshes.push_back({ { -15.0f + crate * 0.5f, 2.0f + crate * 6.0f, -40.0f }, { 4.0f, 4.0f, 4.0f }, {180, 140, 80}, true });
+    }
 
-    // Compute right vector
-    float sideX = forwardY * upZ - forwardZ * upY;
-    float sideY = forwardZ * upX - forwardX * upZ;
-    float sideZ = forwardX * upY - forwardY * upX;
+    float renderDistance = 1000.0f;
+    float fieldOfView = 45.0f;
 
-    float sideLength = sqrt(sideX * sideX + sideY * sideY + sideZ * sideZ);
-    sideX /= sideLength;
-    sideY /= sideLength;
-    sideZ /= sideLength;
+    // Camera starts a little back from the origin, with the player box just above the ground
+    camera.setPosition(0.0f, 1.0f, 5.0f);
+    camera.setPerspective(fieldOfView, (float)windowWidth / (float)windowHeight, 0.1f, renderDistance);
+}
 
-    // Recompute up vector
-    upX = sideY * forwardZ - sideZ * forwardY;
-    upY = sideZ * forwardX - sideX * forwardZ;
-    upZ = sideX * forwardY - sideY * forwardX;
+// Picks random pixel centers with the ID buffer and the grid, run with --check-picking, and works under
+// software GL. The grid ray spans the camera's near to far planes, which is what the ID buffer can see.
+// Pixels on a box's silhouette or where two boxes are at nearly the same depth can go either way, so up
+// to 1% may differ
+bool checkGpuPicking(int count) {
+    if (!gpuPicker.isAvailable()) {
+        LOG_ERROR("GPU picking isn't supported by this context");
+        return false;
+    }
 
-    float matrix[16] = { 0 };
+    loadCameraMatrices();
+    scenegen::Random random(7);
+    int mismatches = 0;
+    for (int pick = 0; pick < count; pick++) {
+        double x = std::floor(random.uniform(0.0f, static_cast<float>(windowWidth))) + 0.5;
+        double y = std::floor(random.uniform(0.0f, static_cast<float>(windowHeight))) + 0.5;
+        int pixelX, pixelY;
+        cursorPixel(x, y, pixelX, pixelY);
+        Ray ray = pixelRay(pixelX, pixelY);
+        meshGrid.queryRay(ray, camera.getNear(), camera.getFar(), pickCandidates);
+        MeshHandle gpuHandle = gpuPicker.pickNow(indirectRenderer, meshes, pickCandidates, pixelX, pixelY, stateCache);
+        MeshHandle gridHandle = meshGrid.intersect(ray, camera.getNear(), camera.getFar()).handle;
+        if (gpuHandle != gridHandle) {
+            if (mismatches < 10) {
+                LOG_WARNING("Pixel " << x << ", " << y << ": ID buffer picked " << gpuHandle << ", grid picked " << gridHandle);
+            }
+            mismatches++;
+        }
+    }
 
-    matrix[0] = sideX;
-    matrix[4] = sideY;
-    matrix[8] = sideZ;
+    LOG_INFO("GPU picking check: " << count - mismatches << " of " << count << " pixels match the grid");
+    return mismatches * 100 <= count;
+}
 
-    matrix[1] = upX;
-    matrix[5] = upY;
-    matrix[9] = upZ;
+// Path traces what the camera sees, saving the image every few samples so it can be watched sharpening
+bool traceView(const char* path, int samples, ThreadPool& pool) {
+    PathTracer tracer;
+    tracer.build(meshes);
+    tracer.beginImage(camera, windowWidth, windowHeight);
 
-    matrix[2] = -forwardX;
-    matrix[6] = -forwardY;
-    matrix[10] = -forwardZ;
+    for (int sample = 1; sample <= samples; sample++) {
+        tracer.addSample(pool);
+        if (sample % 8 != 0 && sample != samples) {
+            continue;
+        }
+        if (!tracer.writeImage(path)) {
+            return false;
+        }
+        double raysPerThread = tracer.getRayCount() / tracer.getTraceSeconds() / pool.getThreadCount();
+        LOG_INFO("Path traced " << sample << " of " << samples << " samples into " << path << ", " << raysPerThread / 1e6
+            << " Mrays/s per thread on " << pool.getThreadCount() << " threads");
+    }
+    return true;
+}
 
-    matrix[15] = 1.0f;
+// Draws the starting view on the CPU and saves it, for machines without a GPU
+int renderSoftware(const char* path) {
+    setupScene();
+
+    SoftwareRasterizer rasterizer(windowWidth, windowHeight);
+    ThreadPool pool;
+    const float clearColor[3] = { 0.0f, 0.0f, 0.0f };
+    const Frustum& cameraFrustum = camera.getFrustum();
+
+    // A few frames so the time isn't just the first one filling the bins
+    const int frameCount = 10;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frameCount; frame++) {
+        rasterizer.beginFrame(camera.getViewProjection(), clearColor);
+        for (const Mesh& mesh : meshes) {
+            float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+            if (cameraFrustum.intersectsBox(mesh.location.data(), boxMax)) {
+                mesh.draw(rasterizer);
+            }
+        }
+        rasterizer.endFrame(pool);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
 
-    glMatrixMode(GL_MODELVIEW);
-    glLoadMatrixf(matrix);
-    glTranslatef(-eyeX, -eyeY, -eyeZ);
+    double frameMilliseconds = std::chrono::duration<double, std::milli>(end - start).count() / frameCount;
+    LOG_INFO("Software frame: " << frameMilliseconds << " ms on " << pool.getThreadCount()
+        << " threads, " << rasterizer.getTriangleCount() << " triangles");
+    if (!rasterizer.writeImage(path)) {
+        return -1;
+    }
+    LOG_INFO("Saved " << path);
+    return 0;
 }
 
 
-int main()
+// Culls generated scenes from a few views and draws them on the CPU with every box in its own color, run
+// with --check-occlusion. Culling is only right if no box it hides has a pixel in the frame. The GPU cull
+// tests the same pyramid the same way, so this covers it too. --scene checks that scene, otherwise each
+// kind is checked at 20k boxes
+bool checkOcclusion() {
+    const SceneType types[] = { SceneType::City, SceneType::Terrain, SceneType::Clutter, SceneType::Towers };
+    const int viewCount = 8;
+    const float clearColor[3] = { 0.0f, 0.0f, 0.0f };
+    SoftwareRasterizer rasterizer(windowWidth, windowHeight);
+    ThreadPool pool;
+    OcclusionCuller culler;
+    SpatialGrid grid;
+    std::vector<uint8_t> drawn;
+    size_t failures = 0;
+
+    for (SceneType type : types) {
+        if (generatedSceneSize > 0 && type != generatedSceneType) {
+            continue;
+        }
+        std::list<Mesh> sceneMeshes;
+        SceneBounds bounds = generateScene(type, generatedSceneSize > 0 ? generatedSceneSize : 20000, generatedSceneSeed, sceneMeshes);
+        grid.reset(SpatialGrid::cellSizeFor(sceneMeshes), std::max<size_t>(size_t(1) << 16, sceneMeshes.size()));
+        grid.build(sceneMeshes);
+
+        // The overview a generated scene starts with, then random spots in the lower half of the scene
+        Camera view;
+        scenegen::Random random(3);
+        size_t culled = 0;
+        size_t wrong = 0;
+        for (int viewIndex = 0; viewIndex < viewCount; viewIndex++) {
+            placeCamera(view, bounds, 45.0f, (float)windowWidth / (float)windowHeight);
+            if (viewIndex > 0) {
+                float height = bounds.boundsMin[1] + random.uniform(1.0f, std::max(2.0f, (bounds.boundsMax[1] - bounds.boundsMin[1]) * 0.5f));
+                view.setPosition(random.uniform(bounds.boundsMin[0], bounds.boundsMax[0]), height, random.uniform(bounds.boundsMin[2], bounds.boundsMax[2]));
+                view.setRotation(random.uniform(-20.0f, 10.0f), random.uniform(0.0f, 360.0f));
+            }
+            const Frustum& frustum = view.getFrustum();
+            float eye[3] = { view.getPosition().x, view.getPosition().y, view.getPosition().z };
+            culler.beginFrame(view.getViewProjection().data());
+            culler.renderOccluders(grid, eye, frustum);
+
+            // Box i is drawn in color i + 1, black is the background
+            rasterizer.beginFrame(view.getViewProjection(), clearColor);
+            uint32_t id = 0;
+            for (const Mesh& mesh : sceneMeshes) {
+                id++;
+                float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+                float color[3] = { static_cast<float>(id & 255), static_cast<float>((id >> 8) & 255), static_cast<float>((id >> 16) & 255) };
+                rasterizer.drawBox(mesh.location.data(), boxMax, color);
+            }
+            rasterizer.endFrame(pool);
+
+            drawn.assign(sceneMeshes.size() + 1, 0);
+            for (int y = 0; y < rasterizer.getHeight(); y++) {
+                for (int x = 0; x < rasterizer.getWidth(); x++) {
+                    drawn[rasterizer.getPixel(x, y) & 0xFFFFFF] = 1;
+                }
+            }
+
+            id = 0;
+            for (const Mesh& mesh : sceneMeshes) {
+                id++;
+                float boxMax[3] = { mesh.location[0] + mesh.size[0], mesh.location[1] + mesh.size[1], mesh.location[2] + mesh.size[2] };
+                if (!frustum.intersectsBox(mesh.location.data(), boxMax) || culler.isVisible(mesh.location.data(), boxMax)) {
+                    continue;
+                }
+                culled++;
+                if (drawn[id]) {
+                    if (wrong < 10) {
+                        LOG_WARNING(getSceneName(type) << " view " << viewIndex << ": box " << id - 1 << " was culled but has pixels in the frame");
+                    }
+                    wrong++;
+                }
+            }
+        }
+
+        LOG_INFO("Occlusion check, " << getSceneName(type) << " of " << sceneMeshes.size() << " boxes: " << culled << " culled over "
+            << viewCount << " views, " << wrong << " of them visible");
+        failures += wrong;
+    }
+    return failures == 0;
+}
+
+
+int main(int argc, char** argv)
 {
+    // Log lines also go to a file, --log-file path picks which
+    const char* logPath = "engine.log";
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--log-file") == 0) {
+            logPath = argv[i + 1];
+        }
+    }
+    if (!getLogger().openFile(logPath)) {
+        LOG_WARNING("Could not open " << logPath << ", logging to the console only");
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--low-latency") == 0) {
+            lowLatency = true;
+            inputLatency.setMaxFramesAhead(1);
+        }
+        if (std::strcmp(argv[i], "--check-picking") == 0) {
+            pickingCheckCount = i + 1 < argc && argv[i + 1][0] != '-' ? std::max(1, std::atoi(argv[i + 1])) : 1000;
+        }
+    }
+
+    // --scene type boxes [seed] and the pacing options, read first so they apply to whatever else runs
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--vsync") == 0 && !parseVsyncMode(argv[i + 1], vsyncMode)) {
+            LOG_ERROR("Unknown vsync mode " << argv[i + 1] << ", use off, on or adaptive");
+            return -1;
+        }
+        if (std::strcmp(argv[i], "--fps") == 0) {
+            targetFrameRate = std::max(0.0, std::atof(argv[i + 1]));
+        }
+        if (std::strcmp(argv[i], "--frames-ahead") == 0) {
+            inputLatency.setMaxFramesAhead(std::atoi(argv[i + 1]));
+        }
+        if (std::strcmp(argv[i], "--scene") == 0 && i + 2 < argc) {
+            if (!parseSceneType(argv[i + 1], generatedSceneType)) {
+                LOG_ERROR("Unknown scene " << argv[i + 1] << ", use city, terrain, clutter or towers");
+                return -1;
+            }
+            generatedSceneSize = std::strtoull(argv[i + 2], nullptr, 10);
+            if (i + 3 < argc && argv[i + 3][0] != '-') {
+                generatedSceneSeed = static_cast<uint32_t>(std::strtoul(argv[i + 3], nullptr, 10));
+            }
+        }
+    }
+
+    // Benchmarks run without a window
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--bench-math") == 0) {
+            runMathBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-rays") == 0) {
+            runRayBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-grid") == 0) {
+            runGridBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-sap") == 0) {
+            runSweepAndPruneBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-physics") == 0) {
+            runPhysicsBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-raster") == 0) {
+            runRasterBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-scenes") == 0) {
+            runSceneBenchmark(i + 1 < argc ? std::strtoull(argv[i + 1], nullptr, 10) : 1000000);
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-trace") == 0) {
+            runPathTraceBenchmark();
+            return 0;
+        }
+        if (std::strcmp(argv[i], "--bench-micro") == 0) {
+            const char* jsonPath = i + 1 < argc && argv[i + 1][0] != '-' ? argv[i + 1] : "microbench.json";
+            const char* baselinePath = i + 2 < argc && argv[i + 2][0] != '-' ? argv[i + 2] : nullptr;
+            return runMicroBenchmark(jsonPath, baselinePath) ? 0 : 1;
+        }
+        if (std::strcmp(argv[i], "--check-occlusion") == 0) {
+            return checkOcclusion() ? 0 : 1;
+        }
+        if (std::strcmp(argv[i], "--render-software") == 0) {
+            return renderSoftware(i + 1 < argc ? argv[i + 1] : "frame.ppm");
+        }
+        if (std::strcmp(argv[i], "--path-trace") == 0) {
+            setupScene();
+            const char* path = i + 1 < argc ? argv[i + 1] : tracePath;
+            int samples = i + 2 < argc ? std::max(1, std::atoi(argv[i + 2])) : 64;
+            return traceView(path, samples, physicsPool) ? 0 : -1;
+        }
+    }
 
     // stuff said at start
-    std::cout << "Starting Engine..." << std::endl;
-    std::cout << "Loaded!" << std::endl;
-    std::cout << "Logs will apear here | closing this console will close the program" << std::endl;
+    LOG_INFO("Starting Engine...");
+    LOG_INFO("Loaded!");
+    LOG_INFO("Logs will apear here | closing this console will close the program");
 
 
 
@@ -275,150 +817,380 @@ int main()
     /* Make the window's context current */
     glfwMakeContextCurrent(window);
 
+    vsyncMode = applyVsync(vsyncMode);
+    framePacer.setTargetRate(targetFrameRate);
+    if (targetFrameRate > 0.0) {
+        LOG_INFO("Vsync " << getVsyncName(vsyncMode) << ", frame rate capped at " << targetFrameRate);
+    }
+    else {
+        LOG_INFO("Vsync " << getVsyncName(vsyncMode) << ", frame rate uncapped");
+    }
+
     // Set the mouse button callback
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
 
     // Set the cursor position callback
     glfwSetCursorPosCallback(window, cursorPositionCallback);
 
-    //   Add To List           Location                  Size
-    //meshes.push_back({ { -1.0f, 3.5f, -2.5f }, { 5.0f, 15.0f, 5.0f } });
-    // 
-    // Adds a mesh to the list
-    meshes.push_back({ { -250.0f, 0.0f, -250.0f }, { 500.0f, 0.1f, 500.0f }, {0, 255, 0} });
+    // Key presses only mark when input came in, the keys are read where they're used
+    glfwSetKeyCallback(window, keyCallback);
 
-    meshes.push_back({ { 0.0f, 0.0f, -50.0f }, { 25.0f, 14.0f, 20.0f }, {110, 72, 13} });
-    meshes.push_back({ { 0.0f, 14.0f, -50.0f }, { 25.0f, 1.0f, 20.0f }, {0, 100, 0} });
+    // Redraw when the window needs it even if nothing in the scene changed
+    glfwSetWindowRefreshCallback(window, windowRefreshCallback);
+    glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
 
-    meshes.push_back({ { 25.0f, 0.0f, -50.0f }, { 25.0f, 18.0f, 20.0f }, {110, 72, 13} });
-    meshes.push_back({ { 25.0f, 18.0f, -50.0f }, { 25.0f, 1.0f, 20.0f }, {0, 100, 0} });
+    // Load the GL entry points newer than 1.1
+    glext::load();
+
+    if (indirectRenderer.init()) {
+        LOG_INFO("Using multi-draw indirect rendering");
+
+        if (indirectRenderer.isGpuCulling()) {
+            LOG_INFO("Frustum culling on the GPU");
+        }
+        else {
+            LOG_WARNING("Compute shaders not supported, frustum culling on the CPU");
+        }
+    }
+    else {
+        LOG_WARNING("Multi-draw indirect not supported, drawing meshes one by one");
+    }
+
+    overlay.init();
+
+    // The context starts with the viewport covering the whole framebuffer, nothing changes it after
+    glfwGetFramebufferSize(window, &viewportWidth, &viewportHeight);
+    framebufferSizeCallback(window, viewportWidth, viewportHeight);
+
+    if (gpuPicker.init(framebufferWidth, framebufferHeight)) {
+        LOG_INFO("GPU picking available, toggle with G");
+    }
+
+    if (!glext::hasSync) {
+        LOG_WARNING("Fences not supported, input latency is only measured to the swap and frames ahead are left to the driver");
+    }
+    else if (inputLatency.getMaxFramesAhead() > 0) {
+        LOG_INFO("At most " << inputLatency.getMaxFramesAhead() << " frames queued ahead of the GPU" << (lowLatency ? ", input sampled after the frame rate cap" : ""));
+    }
+
+    setupScene();
+
+    // The houses suit the default cells, generated scenes are built in whatever units they like
+    if (generatedSceneSize > 0) {
+        meshGrid.reset(SpatialGrid::cellSizeFor(meshes), std::max<size_t>(size_t(1) << 16, meshes.size()));
+    }
+    meshGrid.build(meshes);
+    physics.build(meshes);
+
+    if (pickingCheckCount > 0) {
+        bool passed = checkGpuPicking(pickingCheckCount);
+        indirectRenderer.release();
+        overlay.release();
+        gpuPicker.release();
+        glfwTerminate();
+        return passed ? 0 : 1;
+    }
 
     // Initialize time
     double lastTime = glfwGetTime();
     double deltaTime;
+    lastMoveTime = lastTime;
+    bool frameFinished = false; // there's no frame before the first one to record
 
     // Enable depth test
-    glEnable(GL_DEPTH_TEST);
+    stateCache.setDepthTest(true);
         
     /* Loop until the user closes the window */
     while (!glfwWindowShouldClose(window))
     {
+        // Last frame's temporaries are done with, an arena that outgrew its block reallocates here and counts towards this frame
+        frameAllocations.beginFrame();
+        frameArena.reset();
 
         // Calculate delta time
         double currentTime = glfwGetTime();
         deltaTime = currentTime - lastTime;
         lastTime = currentTime;
 
-        /* Render here */
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // Set the background color
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-            float radianRotY = camerarotY * (PI / 180.0f); // Convert degrees to radians
-
-            cameraX += playerSpeed * deltaTime * std::cos(radianRotY + PI / 2);
-            cameraZ += playerSpeed * deltaTime * std::sin(radianRotY + PI / 2);
+        // From the start of the last frame to the start of this one
+        if (frameFinished) {
+            frameProfiler.endFrame();
+            frameStats.addFrame(deltaTime, frameProfiler);
+            hudFrameTime = hudFrameTime > 0.0 ? hudFrameTime + (deltaTime - hudFrameTime) * 0.05 : deltaTime;
         }
-
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-            float radianRotY = camerarotY * (PI / 180.0f); // Convert degrees to radians
-
-            cameraX += playerSpeed * deltaTime * std::cos(radianRotY - PI / 2);
-            cameraZ += playerSpeed * deltaTime * std::sin(radianRotY - PI / 2);
+        frameFinished = true;
+
+        // Fixed steps so the stacks behave the same at any frame rate
+        physicsTimeLeft = std::min(physicsTimeLeft + deltaTime, maxPhysicsSteps * physicsStepTime);
+        movedMeshes.clear();
+        {
+            ProfileZone zone(frameProfiler, zonePhysics);
+            while (physicsTimeLeft >= physicsStepTime) {
+                physics.step(static_cast<float>(physicsStepTime), physicsPool);
+                for (Mesh* mesh : physics.getMovedMeshes()) {
+                    meshGrid.update(*mesh);
+                    movedMeshes.push_back(mesh);
+                }
+                physicsTimeLeft -= physicsStepTime;
+            }
+        }
+        if (!movedMeshes.empty()) {
+            meshesMoved(movedMeshes);
         }
 
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-            float radianRotY = camerarotY * (PI / 180.0f); // Convert degrees to radians
-            float radianRotX = camerarotX * (PI / 180.0f); // Convert degrees to radians
+        frameProfiler.begin(zoneInput);
 
-            cameraX -= playerSpeed * deltaTime * std::cos(radianRotY);
-            cameraZ -= playerSpeed * deltaTime * std::sin(radianRotY);
+        if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
+            //cameraY += playerSpeed * deltaTime;
+        }
 
-            cameraY -= playerSpeed * deltaTime * std::sin(radianRotX);
+        if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+            //cameraY -= playerSpeed * deltaTime;
         }
 
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-            float radianRotY = camerarotY * (PI / 180.0f); // Convert degrees to radians
-            float radianRotX = camerarotX * (PI / 180.0f); // Convert degrees to radians
+        // Toggle occlusion culling on the key press, not every frame it's held
+        bool occlusionKeyPressed = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+        if (occlusionKeyPressed && !occlusionKeyWasPressed) {
+            occlusionCullingEnabled = !occlusionCullingEnabled;
+            requestRedraw();
+            LOG_INFO("Occlusion culling " << (occlusionCullingEnabled ? "on" : "off"));
+        }
+        occlusionKeyWasPressed = occlusionKeyPressed;
 
-            cameraX += playerSpeed * deltaTime * std::cos(radianRotY);
-            cameraZ += playerSpeed * deltaTime * std::sin(radianRotY);
+        bool lodKeyPressed = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+        if (lodKeyPressed && !lodKeyWasPressed) {
+            lodEnabled = !lodEnabled;
+            requestRedraw();
+            LOG_INFO("Level of detail " << (lodEnabled ? "on" : "off"));
+        }
+        lodKeyWasPressed = lodKeyPressed;
 
-            cameraY += playerSpeed * deltaTime * std::sin(radianRotX);
+        bool gpuPickingKeyPressed = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+        if (gpuPickingKeyPressed && !gpuPickingKeyWasPressed && gpuPicker.isAvailable()) {
+            gpuPickingEnabled = !gpuPickingEnabled;
+            requestRedraw();
+            LOG_INFO("GPU picking " << (gpuPickingEnabled ? "on" : "off"));
         }
+        gpuPickingKeyWasPressed = gpuPickingKeyPressed;
 
-        if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-            //cameraY += playerSpeed * deltaTime;
+        bool idleKeyPressed = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+        if (idleKeyPressed && !idleKeyWasPressed) {
+            idleRenderingEnabled = !idleRenderingEnabled;
+            LOG_INFO("Idle rendering " << (idleRenderingEnabled ? "on, waiting for input while nothing changes" : "off, drawing every frame"));
         }
+        idleKeyWasPressed = idleKeyPressed;
 
-        if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
-            //cameraY -= playerSpeed * deltaTime;
+        bool hudKeyPressed = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+        if (hudKeyPressed && !hudKeyWasPressed) {
+            hudEnabled = !hudEnabled;
+            hudRefreshTime = 0.0;
+            requestRedraw();
         }
+        hudKeyWasPressed = hudKeyPressed;
+
+        // The trace below is a wait, not frame work, and stays out of the zones
+        frameProfiler.end(zoneInput);
+
+        bool traceKeyPressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+        if (traceKeyPressed && !traceKeyWasPressed) {
+            traceView(tracePath, traceSamples, physicsPool);
+            lastTime = glfwGetTime(); // the wait isn't a frame, don't step the physics through it
+            lastMoveTime = lastTime;
+            framePacer.skipInterval();
+            inputLatency.skipInterval();
+        }
+        traceKeyWasPressed = traceKeyPressed;
 
+        // Nothing on screen would change, so wait for input instead of drawing the same frame again
+        if (isCameraInputPending(window)) {
+            requestRedraw();
+        }
+        if (camera.getVersion() != drawnCameraVersion) {
+            drawnCameraVersion = camera.getVersion();
+            requestRedraw();
+        }
+        if (idleRenderingEnabled && redrawFramesLeft == 0 && physics.isSettled()) {
+            frameProfiler.discardFrame();
+            frameFinished = false;
+            double waitStart = glfwGetTime();
+            glfwWaitEventsTimeout(idleWaitTimeout);
+            double waited = glfwGetTime() - waitStart;
+            lastTime += waited; // the wait isn't frame time, and the physics was asleep through it
+            lastMoveTime += waited; // nor does the camera move through it
+            framePacer.skipInterval();
+            inputLatency.skipInterval();
+            pendingInputTime = -1.0; // whatever came in changed nothing on screen
+            idleWaits++;
+            continue;
+        }
+        redrawFramesLeft = std::max(redrawFramesLeft - 1, 0);
+        framesDrawn++;
 
-        float renderDistance = 1000.0f;
+        /* Render here */
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // Set the background color
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Set the perspective projection
-        setPerspective(45.0f, (float)windowWidth / (float)windowHeight, 0.1f, renderDistance);
+        // Low latency waits out the frame rate cap here, so the input is sampled as late as the deadline allows
+        if (lowLatency) {
+            frameProfiler.begin(zonePacing);
+            framePacer.waitForDeadline();
+            frameProfiler.end(zonePacing);
+        }
 
-        // Set the view transformation based on the camera position
-        lookAt(cameraX, cameraY, cameraZ, camerarotX, camerarotY, camerarotZ);
+        frameProfiler.begin(zoneLatch);
+        double inputTime = latchCameraInput(window);
+        frameProfiler.end(zoneLatch);
+
+        // Set the projection and the view transformation based on the camera position
+        loadCameraMatrices();
+
+        // Frustum planes for culling, cached by the camera
+        const Frustum& cameraFrustum = camera.getFrustum();
+        const Vec4& cameraPosition = camera.getPosition();
+        float eye[3] = { cameraPosition.x, cameraPosition.y, cameraPosition.z };
+
+        frameProfiler.begin(zoneCulling);
+
+        // Draw the ID of the box under the cursor, the answer comes back a frame or two later
+        if (gpuPickingEnabled) {
+            int pixelX, pixelY;
+            cursorPixel(cursorX, cursorY, pixelX, pixelY);
+            meshGrid.queryRay(pixelRay(pixelX, pixelY), camera.getNear(), camera.getFar(), pickCandidates);
+            gpuPicker.render(indirectRenderer, meshes, pickCandidates, pixelX, pixelY, stateCache);
+            const Mesh* hovered = meshGrid.find(gpuPicker.getResult());
+            if (hovered != hoveredMesh) {
+                hoveredMesh = hovered;
+                requestRedraw();
+            }
+        }
 
+        // Rasterize the biggest boxes into the occlusion depth pyramid
+        const OcclusionCuller* occlusion = nullptr;
+        if (occlusionCullingEnabled) {
+            occlusionCuller.beginFrame(camera.getViewProjection().data());
+            occlusionCuller.renderOccluders(meshGrid, eye, cameraFrustum);
+            occlusion = &occlusionCuller;
+        }
 
-        for (auto it = meshes.begin(); it != meshes.end(); ++it) {
-            it->draw();
+        // Pick the detail level of each cluster of boxes
+        const LodSelector* lod = nullptr;
+        if (lodEnabled) {
+            lodSelector.select(meshes, eye, camera.getPixelsPerUnit(windowHeight), cameraFrustum);
+            lod = &lodSelector;
         }
 
 
-        // Start 2D drawing for the crosshair
-        glMatrixMode(GL_PROJECTION);
-        glPushMatrix(); // Save the current projection matrix
+        frameProfiler.end(zoneCulling);
 
-        glLoadIdentity();
-        // Set an orthographic projection for 2D drawing
-        glOrtho(0, windowWidth, windowHeight, 0, -1, 1); // Define the orthographic projection
+        // Queue up this frame's draws
+        frameProfiler.begin(zoneQueue);
+        renderQueue.clear();
 
-        glMatrixMode(GL_MODELVIEW);
-        glPushMatrix(); // Save the current modelview matrix
+        if (indirectRenderer.isAvailable()) {
+            WorldDrawArgs* worldArgs = frameArena.create<WorldDrawArgs>(&cameraFrustum, occlusion, lod);
+            renderQueue.submit(PassOpaque, 0, 0, 0.0f, drawWorld, worldArgs);
+        }
+        else {
+            size_t meshIndex = 0;
+            for (auto it = meshes.begin(); it != meshes.end(); ++it, ++meshIndex) {
+                if (lod && !lod->isFullDetail(meshIndex)) {
+                    continue;
+                }
+                float boxMax[3] = { it->location[0] + it->size[0], it->location[1] + it->size[1], it->location[2] + it->size[2] };
+                if (!cameraFrustum.intersectsBox(it->location.data(), boxMax)) {
+                    continue;
+                }
+                if (occlusion && !occlusion->isVisible(it->location.data(), boxMax)) {
+                    continue;
+                }
 
-        glLoadIdentity();
-        glDisable(GL_DEPTH_TEST); // Disable depth testing to ensure the crosshair is rendered on top
+                // Squared distance to the box center, nearest boxes draw first
+                float dx = it->location[0] + it->size[0] * 0.5f - cameraPosition.x;
+                float dy = it->location[1] + it->size[1] * 0.5f - cameraPosition.y;
+                float dz = it->location[2] + it->size[2] * 0.5f - cameraPosition.z;
+                renderQueue.submit(PassOpaque, 0, 0, dx * dx + dy * dy + dz * dz, drawMesh, &*it);
+            }
+        }
 
-        // Enable blending
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        if (lod) {
+            renderQueue.submit(PassOpaque, 0, 0, 0.0f, drawLodProxies, lod);
+        }
 
-        // Set color for the crosshair (gray with 50% transparency)
-        glColor4f(1.0f, 1.0f, 1.0f, 0.9f);
+        if (hoveredMesh) {
+            renderQueue.submit(PassOverlay, 0, 0, 0.0f, drawHoverOutline, hoveredMesh);
+        }
 
-        // Draw the crosshair
-        glBegin(GL_LINES);
-        // Vertical line
-        glVertex2f(windowWidth / 2 - 10, windowHeight / 2);
-        glVertex2f(windowWidth / 2 + 10, windowHeight / 2);
-        // Horizontal line
-        glVertex2f(windowWidth / 2, windowHeight / 2 - 10);
-        glVertex2f(windowWidth / 2, windowHeight / 2 + 10);
-        glEnd();
+        // The crosshair and the stats go into one overlay draw
+        overlay.beginFrame(windowWidth, windowHeight);
+        const OverlayColor crosshairColor = makeOverlayColor(1.0f, 1.0f, 1.0f, 0.9f);
+        overlay.addLine(windowWidth / 2 - 10.0f, windowHeight / 2.0f, windowWidth / 2 + 10.0f, windowHeight / 2.0f, 2.0f, crosshairColor);
+        overlay.addLine(windowWidth / 2.0f, windowHeight / 2 - 10.0f, windowWidth / 2.0f, windowHeight / 2 + 10.0f, 2.0f, crosshairColor);
+        if (hudEnabled && hudFrameTime > 0.0) {
+            if (currentTime >= hudRefreshTime) {
+                // Only the CPU cull counts what it drew and hid, the GPU cull's counts stay on the GPU
+                char cullText[64] = "";
+                if (indirectRenderer.isGpuCulling()) {
+                    std::snprintf(cullText, sizeof(cullText), "  culled on the gpu");
+                }
+                else if (indirectRenderer.isAvailable()) {
+                    std::snprintf(cullText, sizeof(cullText), "  %zu drawn  %zu occluded", indirectRenderer.getVisibleCount(), indirectRenderer.getOccludedCount());
+                }
+                std::snprintf(hudText, sizeof(hudText), "%.2f ms  %.0f fps\n%zu boxes%s\nocclusion %s (%d occluders)  lod %s (%zu proxies, %zu impostors)\ngpu picking %s  idle %s",
+                    hudFrameTime * 1000.0, 1.0 / hudFrameTime, meshes.size(), cullText,
+                    occlusionCullingEnabled ? "on" : "off", occlusionCullingEnabled ? occlusionCuller.getOccluderCount() : 0, lodEnabled ? "on" : "off",
+                    lodEnabled ? lodSelector.getProxyCount() : 0, lodEnabled ? lodSelector.getImpostorCount() : 0, gpuPickingEnabled ? "on" : "off", idleRenderingEnabled ? "on" : "off");
+                hudRefreshTime = currentTime + hudRefreshInterval;
+            }
+            float textWidth, textHeight;
+            OverlayRenderer::measureText(hudText, hudTextScale, textWidth, textHeight);
+            overlay.addQuad(hudMargin, hudMargin, textWidth + 2 * hudPadding, textHeight + 2 * hudPadding, makeOverlayColor(0.0f, 0.0f, 0.0f, 0.5f));
+            overlay.addText(hudMargin + hudPadding, hudMargin + hudPadding, hudText, hudTextScale, makeOverlayColor(1.0f, 1.0f, 1.0f, 1.0f));
+        }
+        renderQueue.submit(PassOverlay, 0, overlay.getTexture(), 0.0f, drawOverlay, &overlay);
 
-        // Disable blending and re-enable depth testing
-        glDisable(GL_BLEND);
-        glEnable(GL_DEPTH_TEST);
+        renderQueue.sort();
+        frameProfiler.end(zoneQueue);
 
-        // Restore the projection and modelview matrices
-        glMatrixMode(GL_PROJECTION);
-        glPopMatrix(); // Restore the saved projection matrix
+        frameProfiler.begin(zoneDraw);
+        renderQueue.execute(stateCache);
+        frameProfiler.end(zoneDraw);
 
-        glMatrixMode(GL_MODELVIEW);
-        glPopMatrix(); // Restore the saved modelview matrix
+        // Hold the frame to the target rate, then swap front and back buffers
+        if (!lowLatency) {
+            frameProfiler.begin(zonePacing);
+            framePacer.waitForDeadline();
+            frameProfiler.end(zonePacing);
+        }
 
-        // Swap front and back buffers
+        // Events are polled when the next frame latches its input
+        frameProfiler.begin(zoneSwap);
         glfwSwapBuffers(window);
+        framePacer.framePresented();
+        inputLatency.framePresented(inputTime);
+        frameProfiler.end(zoneSwap);
+
+        // With frames ahead capped, wait here until few enough are queued
+        frameProfiler.begin(zonePacing);
+        inputLatency.waitForFrameSlot();
+        frameProfiler.end(zonePacing);
 
-        // Poll for and process events
-        glfwPollEvents();
+        frameAllocations.endFrame();
     }
 
+    indirectRenderer.release();
+    overlay.release();
+    gpuPicker.release();
+    inputLatency.release();
+
+    frameStats.printSummary();
+    framePacer.printSummary();
+    inputLatency.printSummary();
+    LOG_INFO("Frames drawn: " << framesDrawn << ", idle waits for input: " << idleWaits);
+    LOG_INFO("GL state changes: " << stateCache.getIssuedCount() << " issued, " << stateCache.getAvoidedCount() << " avoided");
+    LOG_INFO("Heap allocations per frame: " << frameAllocations.getAverage() << " average, " << frameAllocations.getMaxFrame() << " most, "
+        << frameAllocations.getAllocatingFrameCount() << " of " << frameAllocations.getFrameCount() << " frames allocated");
+    LOG_INFO("Frame arena: " << frameArena.getPeak() << " bytes at most in a frame");
+
     glfwTerminate();
     return 0;
 }